@@ -7,127 +7,827 @@
 
 #include "acc.h"
 #include "cmd.h"
+#include "vta/tf_driver.h"
 
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include <spdlog/spdlog.h>
 
 std::vector<Acc *> accelerators;
+AccScheduler *acc_scheduler;
 
 Acc::Acc(unsigned int id)
 {
 	this->id = id;
 
-	state = AccState::idle;
-
 	ramdisk_in = false;
 	ramdisk_in_base = ramdisk_in_size = 0;
 
 	ramdisk_out = false;
 	ramdisk_out_base = ramdisk_out_size = 0;
+
+	ibuf = obuf = nullptr;
+	ibuf_fd = obuf_fd = -1;
+	ibuf_size = obuf_size = 0;
+
+	chunk_size = state_size = 0;
+
+	cancel_requested = false;
+
+	stats = {};
+	queued_at = 0;
+	ticket = 0;
+
+	setState(AccState::idle);
 }
 
-void Acc::runBPF(void)
+static std::mutex programs_mutex;
+static std::map<unsigned int, std::shared_ptr<BPFProgram>> programs;
+
+std::shared_ptr<BPFProgram> getBPFProgram(unsigned int fw_id, const FirmwareBlob &fw)
 {
+	const uint64_t hash = fw->hash;
 	char *errmsg;
 	int ret;
 
-	spdlog::info("[ACC#{}] Starting", id);
+	std::lock_guard<std::mutex> lock(programs_mutex);
 
-	state = AccState::running;
+	auto it = programs.find(fw_id);
+	if(it != programs.end() && it->second->hash == hash) {
+		spdlog::debug("Using cached program for firmware #{}", fw_id);
+		return it->second;
+	}
 
-	struct ubpf_vm *vm = ubpf_create();
+	auto program = std::make_shared<BPFProgram>();
+	program->hash = hash;
+	program->vm = ubpf_create();
 
-	if(!vm) {
-		spdlog::error("[ACC#{}] Failed to create VM!", id);
-		state = AccState::fail;
-		return;
+	if(!program->vm) {
+		spdlog::error("Failed to create VM for firmware #{}!", fw_id);
+		return nullptr;
 	}
 
-	register_functions(vm);
+	register_functions(program->vm);
 
-	ret = ubpf_load_elf(vm, firmware.data(), firmware.size(), &errmsg);
+	ret = ubpf_load_elf(program->vm, fw->data.data(), fw->data.size(), &errmsg);
 
 	if(ret) {
-		spdlog::error("[ACC#{}] Failed to load code: {}\n", id, errmsg);
-		state = AccState::fail;
+		spdlog::error("Failed to load firmware #{}: {}", fw_id, errmsg);
 		free(errmsg);
-		return;
+		return nullptr;
 	}
 
-	if(ramdisk_in)
-		ramdiskToBuf();
+	ubpf_toggle_bounds_check(program->vm, false);
+
+	program->jit = ubpf_compile(program->vm, &errmsg);
+
+	if(!program->jit) {
+		spdlog::warn("Failed to JIT-compile firmware #{}, falling back to interpreter: {}", fw_id, errmsg);
+		free(errmsg);
+	}
+
+	/* Firmware bound to the same ID with different content replaces the old program,
+	 * accelerators still running it keep their reference */
+	programs[fw_id] = program;
+
+	return program;
+}
+
+/* JIT-compiled code takes BPF r1-r3 from the first three native argument registers */
+typedef uint64_t (*bpf_jit_entry)(void *ibuf, size_t isize, void *obuf);
+
+static int run_program(BPFProgram *prog, uint64_t ticket, void *ibuf, size_t isize, void *obuf, uint64_t *bpf_return_value)
+{
+	int ret = 0;
+
+	vm_abort_arm(ticket);
+
+	if(prog->jit)
+		*bpf_return_value = reinterpret_cast<bpf_jit_entry>(prog->jit)(ibuf, isize, obuf);
+	else
+		ret = ubpf_exec(prog->vm, ibuf, isize, obuf, bpf_return_value);
 
-	if(ramdisk_out)
-		obuf.resize(ramdisk_out_size);
+	vm_abort_disarm();
 
-	ubpf_toggle_bounds_check(vm, false);
+	return ret;
+}
+
+static int exec_program(BPFProgram *prog, uint64_t ticket, void *ibuf, size_t isize, void *obuf, size_t osize, uint64_t *bpf_return_value)
+{
+	/* helpers may only access the buffers of the program */
+	vm_set_regions(ibuf, isize, obuf, osize);
+
+	/* the watchdog of the scheduler jumps back here when it aborts the program */
+	if(sigsetjmp(*vm_abort_env(), 1))
+		return -ECANCELED;
+
+	return run_program(prog, ticket, ibuf, isize, obuf, bpf_return_value);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void Acc::setState(AccState s)
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
 
-	uint64_t bpf_return_value = 0;
-	ret = ubpf_exec(vm, ibuf.data(), ibuf.size(), obuf.data(), &bpf_return_value);
+	state = s;
 
-	if(ramdisk_out)
-		bufToRamdisk();
+	if(stats.history_len == ACC_STATE_HISTORY) {
+		std::copy(stats.history + 1, stats.history + ACC_STATE_HISTORY, stats.history);
+		stats.history_len--;
+	}
 
-	ubpf_destroy(vm);
+	stats.history[stats.history_len].ts_ns = now_ns();
+	stats.history[stats.history_len].state = static_cast<uint64_t>(s);
+	stats.history_len++;
 
-	state = AccState::done;
+	if(s == AccState::queued)
+		queued_at = stats.history[stats.history_len - 1].ts_ns;
+}
 
-	spdlog::info("[ACC#{}] Finished: {}\n", id, ret);
+AccStats Acc::getStats(void)
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
 
+	return stats;
 }
 
-void Acc::ramdiskToBuf(void)
+/* Runs the job on the calling slot, returns the state it ends in */
+AccState Acc::runBPF(void)
 {
-	unsigned char *buf;
-	int fd;
+	AccStats job = {};
+	uint64_t t;
+	int ret;
+
+	spdlog::info("[ACC#{}] Starting", id);
+
+	t = now_ns();
+	job.queue_ns = t - queued_at;
+
+	if(cancel_requested)
+		return AccState::cancelled;
+
+	std::shared_ptr<BPFProgram> prog;
+
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		prog = program;
+	}
 
-	mmap_buffer(ramdisk_in_base, ramdisk_in_size, &fd, &buf);
+	if(!prog) {
+		spdlog::error("[ACC#{}] No firmware loaded!", id);
+		return AccState::fail;
+	}
+
+	if(mapRamdisk()) {
+		spdlog::error("[ACC#{}] Failed to map ramdisk!", id);
+		unmapRamdisk();
+		return AccState::fail;
+	}
+
+	vm_set_cancel_flag(&cancel_requested);
+
+	const uint64_t vta_busy = VTADeviceBusyTime();
+
+	if(chunk_size) {
+		ret = runStreaming(prog.get(), job);
+	} else {
+		const size_t isize = ibuf_size;
+		const size_t osize = obuf_size;
+
+		job.copy_in_ns = now_ns() - t;
+		job.bytes_in = isize;
+		job.bytes_out = osize;
+
+		t = now_ns();
+		ret = exec_program(prog.get(), ticket, ibuf, isize, obuf, osize, &job.ret);
+		job.compute_ns = now_ns() - t;
+	}
+
+	job.vta_busy_ns = VTADeviceBusyTime() - vta_busy;
+
+	vm_set_cancel_flag(nullptr);
+
+	t = now_ns();
+	unmapRamdisk();
+	job.copy_out_ns += now_ns() - t;
 
-	ibuf.assign(buf, buf+ramdisk_in_size);
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
 
-	mmap_cleanup(ramdisk_in_size, fd, buf);
+		job.jobs = stats.jobs + 1;
+		job.history_len = stats.history_len;
+		std::copy(stats.history, stats.history + ACC_STATE_HISTORY, job.history);
+		stats = job;
+	}
+
+	spdlog::info("[ACC#{}] Finished: {} (queue {} ns, in {} ns, compute {} ns, out {} ns)\n", id, ret,
+			job.queue_ns, job.copy_in_ns, job.compute_ns, job.copy_out_ns);
+
+	if(cancel_requested)
+		return AccState::cancelled;
+
+	return ret ? AccState::fail : AccState::done;
+}
+
+/* Allows the calling thread to run on any core, threads started by a slot inherit its affinity otherwise */
+static void unpin_thread(void)
+{
+	const unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	for(unsigned int cpu = 0; cpu < cpus && cpu < CPU_SETSIZE; cpu++)
+		CPU_SET(cpu, &cpuset);
+
+	if(pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+		spdlog::warn("Failed to reset thread affinity");
 }
 
-void Acc::bufToRamdisk(void)
+/* Helper thread of a streaming job, runs the prefetch and write-back of one chunk at a time.
+ * It is not pinned, so the copies overlap with the computation on the core of the slot. */
+class StreamIO {
+private:
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::function<void()> work;
+	bool busy;
+	bool stopping;
+	std::thread thread;
+
+	void run(void)
+	{
+		unpin_thread();
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		for(;;) {
+			cv.wait(lock, [this] { return stopping || work; });
+
+			if(!work)
+				break;
+
+			std::function<void()> w = std::move(work);
+			work = nullptr;
+
+			lock.unlock();
+			w();
+			lock.lock();
+
+			busy = false;
+			cv.notify_all();
+		}
+	}
+public:
+	StreamIO() : busy(false), stopping(false), thread(&StreamIO::run, this) {}
+
+	~StreamIO()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cv.notify_all();
+		thread.join();
+	}
+
+	void post(std::function<void()> w)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy = true;
+			work = std::move(w);
+		}
+		cv.notify_all();
+	}
+
+	void wait(void)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		cv.wait(lock, [this] { return !busy; });
+	}
+};
+
+/* Runs the program on consecutive chunks of the input region.
+ *
+ * While chunk k is processed, chunk k+1 is prefetched from the ramdisk
+ * and outputs of chunk k-1 are written back. The program returns the
+ * number of output bytes it produced, outputs of all chunks are written
+ * to the output region one after another. */
+int Acc::runStreaming(BPFProgram *prog, AccStats &job)
 {
-	unsigned char *buf;
-	int fd;
+	const size_t hdr_size = sizeof(acc_chunk_hdr);
+	const size_t in_size = ibuf_size;
+	const size_t out_size = obuf_size;
+	const size_t chunks = (in_size + chunk_size - 1) / chunk_size;
+
+	std::vector<unsigned char> in[2];
+	std::vector<unsigned char> out[2];
+	size_t out_len[2] = {0, 0};
+	size_t out_offset = 0;
+	size_t prev_offset = 0;
+
+	for(int i = 0; i < 2; i++) {
+		in[i].resize(hdr_size + chunk_size);
+		out[i].resize(state_size + chunk_size);
+	}
+
+	uint64_t prefetch_ns = 0;
+	uint64_t writeback_ns = 0;
+
+	auto prefetch = [&](size_t k) {
+		const uint64_t t = now_ns();
+		acc_chunk_hdr *hdr = (acc_chunk_hdr*)in[k % 2].data();
+		const size_t offset = k * chunk_size;
+		const size_t len = std::min<size_t>(chunk_size, in_size - offset);
+
+		hdr->index = k;
+		hdr->offset = offset;
+		hdr->len = len;
+		hdr->last = (k + 1 == chunks);
+		hdr->state_len = state_size;
+		hdr->out_len = chunk_size;
+
+		std::copy(ibuf + offset, ibuf + offset + len, in[k % 2].data() + hdr_size);
+
+		prefetch_ns += now_ns() - t;
+	};
+
+	auto writeback = [&](size_t k, size_t offset) {
+		const uint64_t t = now_ns();
+		const unsigned char *data = out[k % 2].data() + state_size;
+
+		std::copy(data, data + out_len[k % 2], obuf + offset);
+
+		writeback_ns += now_ns() - t;
+	};
+
+	/* prefetch and write-back overlap with the computation, their times are reported separately */
+	auto account = [&]() {
+		job.copy_in_ns = prefetch_ns;
+		job.copy_out_ns = writeback_ns;
+		job.bytes_out = out_offset;
+		job.ret = out_offset;
+	};
+
+	spdlog::debug("[ACC#{}] Streaming {} chunks of {} bytes", id, chunks, chunk_size);
+
+	StreamIO io;
+
+	if(chunks)
+		prefetch(0);
+
+	for(size_t k = 0; k < chunks; k++) {
+		const acc_chunk_hdr *hdr = (const acc_chunk_hdr*)in[k % 2].data();
+		uint64_t produced = 0;
+		int ret;
+
+		/* chunk boundaries are the points where a stopped job yields */
+		if(cancel_requested) {
+			spdlog::info("[ACC#{}] Cancelled before chunk {}", id, k);
+			account();
+			return -1;
+		}
+
+		/* carry the state left by the previous chunk */
+		if(k > 0)
+			std::copy(out[(k - 1) % 2].begin(), out[(k - 1) % 2].begin() + state_size, out[k % 2].begin());
+
+		io.post([&, k]() {
+			if(k + 1 < chunks)
+				prefetch(k + 1);
+			if(k > 0)
+				writeback(k - 1, prev_offset);
+		});
+
+		const uint64_t t = now_ns();
+		ret = exec_program(prog, ticket, in[k % 2].data(), hdr_size + hdr->len, out[k % 2].data(), out[k % 2].size(), &produced);
+		job.compute_ns += now_ns() - t;
+
+		io.wait();
+
+		job.chunks++;
+		job.bytes_in += hdr->len;
+
+		if(ret) {
+			spdlog::error("[ACC#{}] Chunk {} failed: {}", id, k, ret);
+			account();
+			return ret;
+		}
+
+		if(produced > chunk_size || out_offset + produced > out_size) {
+			spdlog::error("[ACC#{}] Chunk {} produced {} bytes, output region overflow", id, k, produced);
+			account();
+			return -1;
+		}
+
+		out_len[k % 2] = produced;
+		prev_offset = out_offset;
+		out_offset += produced;
+	}
+
+	if(chunks)
+		writeback(chunks - 1, prev_offset);
 
-	mmap_buffer(ramdisk_out_base, ramdisk_out_size, &fd, &buf);
+	account();
 
-	std::copy(obuf.begin(), obuf.end(), buf);
+	spdlog::debug("[ACC#{}] Streamed {} bytes of outputs", id, out_offset);
 
-	mmap_cleanup(ramdisk_out_size, fd, buf);
+	return 0;
 }
 
-void Acc::addRamdiskIn(unsigned int base, unsigned int size)
+/* Inputs are read from and outputs written to the ramdisk directly, without intermediate copies */
+int Acc::mapRamdisk(void)
 {
+	int ret;
+
+	if(ramdisk_in) {
+		ret = mmap_buffer(ramdisk_in_base, ramdisk_in_size, &ibuf_fd, &ibuf);
+		if(ret) {
+			ibuf = nullptr;
+			return ret;
+		}
+		ibuf_size = ramdisk_in_size;
+	}
+
+	if(ramdisk_out) {
+		ret = mmap_buffer(ramdisk_out_base, ramdisk_out_size, &obuf_fd, &obuf);
+		if(ret) {
+			obuf = nullptr;
+			return ret;
+		}
+		obuf_size = ramdisk_out_size;
+	}
+
+	return 0;
+}
+
+void Acc::unmapRamdisk(void)
+{
+	if(ibuf)
+		mmap_cleanup(ibuf_size, ibuf_fd, ibuf);
+
+	if(obuf)
+		mmap_cleanup(obuf_size, obuf_fd, obuf);
+
+	ibuf = obuf = nullptr;
+	ibuf_fd = obuf_fd = -1;
+	ibuf_size = obuf_size = 0;
+}
+
+/* Queued and running jobs read the configuration of the accelerator from their slot */
+bool Acc::isStarted(void)
+{
+	const AccState s = state;
+
+	return s == AccState::queued || s == AccState::running || s == AccState::cancelling;
+}
+
+bool Acc::addRamdiskIn(uint64_t base, unsigned int size)
+{
+	if(isStarted()) {
+		spdlog::error("[ACC#{}] Can't change the input region of a started job!", id);
+		return false;
+	}
+
 	ramdisk_in = true;
 	ramdisk_in_base = base;
 	ramdisk_in_size = size;
+
+	return true;
 }
 
-void Acc::addRamdiskOut(unsigned int base, unsigned int size)
+bool Acc::addRamdiskOut(uint64_t base, unsigned int size)
 {
+	if(isStarted()) {
+		spdlog::error("[ACC#{}] Can't change the output region of a started job!", id);
+		return false;
+	}
+
 	ramdisk_out = true;
 	ramdisk_out_base = base;
 	ramdisk_out_size = size;
+
+	return true;
+}
+
+/* Fails if a job is started or the firmware can't be loaded, the previous program is kept then */
+bool Acc::addFirmware(unsigned int fw_id, const FirmwareBlob &fw)
+{
+	if(isStarted()) {
+		spdlog::error("[ACC#{}] Can't change the firmware of a started job!", id);
+		return false;
+	}
+
+	if(!fw) {
+		spdlog::error("[ACC#{}] Firmware #{} not found!", id, fw_id);
+		return false;
+	}
+
+	std::shared_ptr<BPFProgram> prog = getBPFProgram(fw_id, fw);
+
+	if(!prog)
+		return false;
+
+	std::lock_guard<std::mutex> lock(stats_mutex);
+
+	program = prog;
+
+	return true;
 }
 
-void Acc::addFirmware(std::vector<unsigned char> &vec)
+/* The state is carried in the output buffer of a chunk, so it can't be larger than the chunk */
+bool Acc::setStreaming(unsigned int chunk_size, unsigned int state_size)
 {
-	firmware = vec;
+	if(isStarted()) {
+		spdlog::error("[ACC#{}] Can't change streaming parameters of a started job!", id);
+		return false;
+	}
+
+	if(chunk_size > ACC_STREAM_MAX_CHUNK || (chunk_size && state_size > chunk_size)) {
+		spdlog::error("[ACC#{}] Invalid streaming parameters! (chunk: {}, state: {}, max chunk: {})", id,
+				chunk_size, state_size, ACC_STREAM_MAX_CHUNK);
+		return false;
+	}
+
+	this->chunk_size = chunk_size;
+	this->state_size = chunk_size ? state_size : 0;
+
+	return true;
 }
 
-void Acc::start(void)
+bool Acc::start(void)
 {
-	th = new std::thread(&Acc::runBPF, this);
+	return acc_scheduler->submit(this);
 }
 
+/* Queued jobs are removed right away, running ones are cancelling until they
+ * stop at the next cancellation point or the watchdog aborts them. */
 void Acc::stop(void)
 {
+	if(acc_scheduler->cancel(this))
+		spdlog::info("[ACC#{}] Removed from queue", id);
+	else if(state == AccState::cancelling)
+		spdlog::info("[ACC#{}] Stopping", id);
+}
+
+AccScheduler::AccScheduler(unsigned int slots, unsigned int timeout_ms) : slots(slots)
+{
+	stopping = false;
+	tickets = 0;
+	timeout_ns = timeout_ms * 1000000ULL;
+
+	for(unsigned int slot = 0; slot < slots; slot++) {
+		this->slots[slot].generation = 0;
+		this->slots[slot].acc = nullptr;
+		this->slots[slot].thread = std::thread(&AccScheduler::worker, this, slot, 0);
+	}
+
+	watchdog_thread = std::thread(&AccScheduler::watchdog, this);
+}
+
+AccScheduler::~AccScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_cv.notify_all();
+	watchdog_cv.notify_all();
+
+	for(auto &s : slots)
+		s.thread.join();
+
+	watchdog_thread.join();
+}
+
+void AccScheduler::worker(unsigned int slot, unsigned int generation)
+{
+	const unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+	cpu_set_t cpuset;
+
+	/* Pin each slot to its own core, so jobs don't migrate between them. Multi-threaded
+	 * TFLite invocations and the streaming I/O helper widen the affinity of their threads. */
+	CPU_ZERO(&cpuset);
+	CPU_SET(slot % cpus, &cpuset);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+		spdlog::warn("Failed to set affinity of accelerator slot #{}", slot);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	AccSlot &s = slots[slot];
+
+	s.handle = pthread_self();
+
+	for(;;) {
+		work_cv.wait(lock, [&] { return stopping || !queue.empty(); });
+
+		if(stopping)
+			break;
+
+		Acc *a = queue.front();
+		queue.pop_front();
+
+		s.acc = a;
+		s.ticket = a->ticket = ++tickets;
+		s.started_ns = now_ns();
+		s.cancel_ns = 0;
+		s.signalled = false;
+		a->setState(AccState::running);
+		watchdog_cv.notify_one();
+
+		lock.unlock();
+		spdlog::debug("[ACC#{}] Running on slot #{}", a->getId(), slot);
+		const AccState result = a->runBPF();
+		lock.lock();
+
+		/* the final state is set under the lock, so it can't race with a cancellation */
+		a->setState(result);
+		active.erase(a);
+
+		/* the watchdog gave up on this worker, a new one took over the slot */
+		const bool replaced = s.generation != generation;
+
+		if(!replaced)
+			s.acc = nullptr;
+
+		if(retired.erase(a)) {
+			spdlog::debug("[ACC#{}] Reaping reset accelerator", a->getId());
+			lock.unlock();
+			delete a;
+			lock.lock();
+		}
+
+		if(replaced)
+			break;
+	}
+}
+
+/* Cancels jobs over the timeout, aborts the ones not yielding and replaces stuck workers */
+void AccScheduler::watch(unsigned int slot, uint64_t now)
+{
+	AccSlot &s = slots[slot];
+	Acc *a = s.acc;
+
+	if(timeout_ns && !a->cancel_requested && now - s.started_ns > timeout_ns) {
+		spdlog::warn("[ACC#{}] Timed out on slot #{}, cancelling", a->getId(), slot);
+		a->cancel_requested = true;
+		a->setState(AccState::cancelling);
+	}
+
+	if(!a->cancel_requested)
+		return;
+
+	if(!s.cancel_ns) {
+		s.cancel_ns = now;
+		return;
+	}
+
+	if(!s.signalled && now - s.cancel_ns > ACC_CANCEL_GRACE_MS * 1000000ULL) {
+		spdlog::warn("[ACC#{}] Not yielding, aborting the program on slot #{}", a->getId(), slot);
+		if(!vm_abort_thread(s.handle, s.ticket))
+			spdlog::error("[ACC#{}] Failed to signal slot #{}", a->getId(), slot);
+		s.signalled = true;
+	} else if(s.signalled && now - s.cancel_ns > (ACC_CANCEL_GRACE_MS + ACC_SLOT_STUCK_MS) * 1000000ULL) {
+		/* the abort is deferred while a helper runs, this one does not return */
+		spdlog::error("[ACC#{}] Slot #{} is stuck, replacing its worker", a->getId(), slot);
+		s.thread.detach();
+		s.generation++;
+		s.acc = nullptr;
+		s.thread = std::thread(&AccScheduler::worker, this, slot, s.generation);
+	}
+}
+
+void AccScheduler::watchdog(void)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while(!stopping) {
+		const uint64_t now = now_ns();
+		bool busy = false;
+
+		for(unsigned int slot = 0; slot < slots.size(); slot++) {
+			if(!slots[slot].acc)
+				continue;
+
+			watch(slot, now);
+			busy = true;
+		}
+
+		if(busy)
+			watchdog_cv.wait_for(lock, std::chrono::milliseconds(ACC_WATCHDOG_TICK_MS));
+		else
+			watchdog_cv.wait(lock);
+	}
+}
+
+/* Returns false if the accelerator is already started or a reset one with its ID is still running */
+bool AccScheduler::submit(Acc *a)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if(active.count(a)) {
+			spdlog::warn("[ACC#{}] Already started!", a->getId());
+			return false;
+		}
+
+		for(Acc *r : retired) {
+			if(r->getId() == a->getId()) {
+				spdlog::warn("[ACC#{}] Previous job is still cancelling!", a->getId());
+				return false;
+			}
+		}
+
+		a->setState(AccState::queued);
+		a->cancel_requested = false;
+		active.insert(a);
+		queue.push_back(a);
+	}
+	work_cv.notify_one();
+
+	return true;
+}
+
+/* Requests cancellation, removes the accelerator from the queue right away.
+ * Returns false if it is not queued. */
+bool AccScheduler::cancel(Acc *a)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	a->cancel_requested = true;
+
+	auto it = std::find(queue.begin(), queue.end(), a);
+	if(it == queue.end()) {
+		if(active.count(a))
+			a->setState(AccState::cancelling);
+		return false;
+	}
+
+	queue.erase(it);
+	active.erase(a);
+	a->setState(AccState::cancelled);
+
+	return true;
+}
+
+/* Deletes the accelerator, right away if it is idle, otherwise once its job ends */
+void AccScheduler::retire(Acc *a)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		a->cancel_requested = true;
+
+		auto it = std::find(queue.begin(), queue.end(), a);
+		if(it != queue.end()) {
+			queue.erase(it);
+			active.erase(a);
+		}
+
+		if(active.count(a)) {
+			a->setState(AccState::cancelling);
+			retired.insert(a);
+			return;
+		}
+	}
+
+	delete a;
+}
+
+bool AccScheduler::isRetiring(unsigned int id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for(Acc *a : retired) {
+		if(a->getId() == id)
+			return true;
+	}
+
+	return false;
+}
+
+AccState getAccState(unsigned int id)
+{
+	if(acc_scheduler->isRetiring(id))
+		return AccState::cancelling;
 
+	return accelerators[id]->getState();
 }
@@ -13,52 +13,185 @@
 #include <thread>
 #include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <set>
 
 #include "vm.h"
+#include "firmware.h"
 
 #define ACC_IO_OP_RESET		0x00
 #define ACC_IO_OP_START		0x01
 #define ACC_IO_OP_STOP		0x02
 #define ACC_IO_OP_SET_FW	0x03
+#define ACC_IO_OP_SET_STREAM	0x04
 
-enum class AccState {idle = 0, running, done, fail};
+/* Largest chunk accepted by ACC_IO_OP_SET_STREAM, a job holds four buffers of about this size */
+#define ACC_STREAM_MAX_CHUNK	(16 << 20)
+
+/* Header at the start of the input buffer passed to the program in streaming mode,
+ * followed by the chunk data. The output buffer starts with the state carried
+ * between chunks (zeroed before the first one), followed by space for outputs. */
+struct acc_chunk_hdr {
+	uint64_t index;		/* chunk number */
+	uint64_t offset;	/* offset of the chunk in the input region */
+	uint64_t len;		/* length of the chunk data */
+	uint64_t last;		/* 1 for the last chunk */
+	uint64_t state_len;	/* length of the state */
+	uint64_t out_len;	/* space available for outputs after the state */
+};
+
+/* Jobs that don't stop within ACC_CANCEL_GRACE_MS of a cancellation are aborted by a signal.
+ * A worker still busy ACC_SLOT_STUCK_MS later is abandoned and replaced with a new one. */
+#define ACC_CANCEL_GRACE_MS	100
+#define ACC_SLOT_STUCK_MS	1000
+#define ACC_WATCHDOG_TICK_MS	10
+
+/* cancelling - stop was requested and the job has not yielded yet */
+enum class AccState {idle = 0, running, done, fail, queued, cancelled, cancelling};
+
+/* Loaded accelerator firmware, shared between accelerators running the same code */
+struct BPFProgram {
+	struct ubpf_vm *vm;
+	ubpf_jit_fn jit;	/* nullptr if JIT compilation failed, the interpreter is used then */
+	uint64_t hash;
+
+	BPFProgram() : vm(nullptr), jit(nullptr), hash(0) {}
+	~BPFProgram() { if(vm) ubpf_destroy(vm); }
+};
+
+std::shared_ptr<BPFProgram> getBPFProgram(unsigned int fw_id, const FirmwareBlob &fw);
+
+#define ACC_STATE_HISTORY	8
+
+/* Metrics of the last job of an accelerator, times are in nanoseconds */
+struct AccStats {
+	uint64_t queue_ns;	/* from start until a slot picked the job up */
+	uint64_t copy_in_ns;	/* mapping or prefetching inputs */
+	uint64_t compute_ns;	/* running the program */
+	uint64_t copy_out_ns;	/* writing outputs back */
+	uint64_t vta_busy_ns;	/* VTA running instructions issued by the job */
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t ret;		/* BPF return value, bytes produced in streaming mode */
+	uint64_t insns;		/* executed BPF instructions, 0 if not counted */
+	uint64_t chunks;	/* processed chunks in streaming mode */
+	uint64_t jobs;		/* jobs finished since reset */
+	uint64_t history_len;
+	struct {
+		uint64_t ts_ns;	/* CLOCK_MONOTONIC */
+		uint64_t state;	/* AccState */
+	} history[ACC_STATE_HISTORY];	/* recent state changes, oldest first */
+};
 
 class Acc {
 private:
 	bool ramdisk_in;
-	unsigned int ramdisk_in_base;
+	uint64_t ramdisk_in_base;
 	unsigned int ramdisk_in_size;
 
 	bool ramdisk_out;
-	unsigned int ramdisk_out_base;
+	uint64_t ramdisk_out_base;
 	unsigned int ramdisk_out_size;
 
 	unsigned int id;
 
-	void ramdiskToBuf(void);
-	void bufToRamdisk(void);
+	unsigned int chunk_size;	/* 0 runs the program once over the whole input */
+	unsigned int state_size;
 
-	std::vector<unsigned char> firmware;
-	std::vector<unsigned char> ibuf;
-	std::vector<unsigned char> obuf;
+	int mapRamdisk(void);
+	void unmapRamdisk(void);
 
-	std::thread *th;
+	std::shared_ptr<BPFProgram> program;
+	/* Ramdisk regions mapped for the duration of the run, programs work on them directly */
+	unsigned char *ibuf;
+	unsigned char *obuf;
+	int ibuf_fd;
+	int obuf_fd;
+	/* sizes the regions were mapped with */
+	size_t ibuf_size;
+	size_t obuf_size;
 
 	std::atomic<AccState> state;
+	/* Set by stop(), polled by the streaming loop, VM helpers and TFLite */
+	std::atomic<bool> cancel_requested;
 
-	void runBPF(void);
+	std::mutex stats_mutex;		/* guards stats, state history and program */
+	AccStats stats;
+	uint64_t queued_at;
+	uint64_t ticket;	/* identifies the run for the watchdog */
+
+	void setState(AccState s);
+	bool isStarted(void);
+	AccState runBPF(void);
+	int runStreaming(BPFProgram *prog, AccStats &job);
+
+	friend class AccScheduler;
 public:
 	Acc(unsigned int id);
 	unsigned int getId(void) { return id; }
 	AccState getState(void) { return state; }
-	void addRamdiskIn(unsigned int base, unsigned int size);
-	void addRamdiskOut(unsigned int base, unsigned int size);
-	void addFirmware(std::vector<unsigned char> &vec);
-	void start(void);
+	AccStats getStats(void);
+	bool addRamdiskIn(uint64_t base, unsigned int size);
+	bool addRamdiskOut(uint64_t base, unsigned int size);
+	bool addFirmware(unsigned int fw_id, const FirmwareBlob &fw);
+	bool setStreaming(unsigned int chunk_size, unsigned int state_size);
+	bool start(void);
 	void stop(void);
 };
 
+/* Worker thread of a slot and the job it runs */
+struct AccSlot {
+	std::thread thread;
+	pthread_t handle;
+	unsigned int generation;	/* bumped when a stuck worker is replaced */
+	Acc *acc;			/* nullptr while idle */
+	uint64_t ticket;
+	uint64_t started_ns;
+	uint64_t cancel_ns;		/* when the watchdog noticed the cancellation, 0 before */
+	bool signalled;			/* the program was sent the abort signal */
+};
+
+/* Runs started accelerators on a pool of worker threads, one per slot.
+ * Accelerators started while all slots are busy wait in a FIFO queue.
+ *
+ * A watchdog cancels jobs running longer than the timeout (0 disables it)
+ * and aborts cancelled jobs that don't yield. Accelerators are never waited
+ * for on the command loop, reset ones are retired and deleted by the slot
+ * once their job ends. */
+class AccScheduler {
+private:
+	std::mutex mutex;
+	std::condition_variable work_cv;
+	std::condition_variable watchdog_cv;
+	std::deque<Acc*> queue;
+	std::set<Acc*> active;		/* queued and running accelerators */
+	std::set<Acc*> retired;		/* reset while running, deleted when their job ends */
+	std::vector<AccSlot> slots;
+	std::thread watchdog_thread;
+	uint64_t timeout_ns;
+	uint64_t tickets;
+	bool stopping;
+
+	void worker(unsigned int slot, unsigned int generation);
+	void watchdog(void);
+	void watch(unsigned int slot, uint64_t now);
+public:
+	AccScheduler(unsigned int slots, unsigned int timeout_ms);
+	~AccScheduler();
+	unsigned int getSlots(void) { return slots.size(); }
+	bool submit(Acc *a);
+	bool cancel(Acc *a);
+	void retire(Acc *a);
+	bool isRetiring(unsigned int id);
+};
+
+/* State reported to the host, cancelling while a reset accelerator is still running */
+AccState getAccState(unsigned int id);
+
 extern std::vector<Acc*> accelerators;
-extern std::map<unsigned int, std::vector<unsigned char>> fw_map;
+extern AccScheduler *acc_scheduler;
 
 #endif
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "cmd.h"
+#include "blk.h"
+
+#include <spdlog/spdlog.h>
+
+/* Block store for the APU tier of the RPU, kept in memory reserved with APU_BLK_BASE and APU_BLK_SIZE.
+ * The RPU sends the address of its own buffer with each request, the blocks are copied between the
+ * two through /dev/mem. The store is disabled if APU_BLK_SIZE is not set. */
+
+#define BLK_DEFAULT_BASE	0x800000000ull
+#define BLK_RAMDISK_BASE	0x68000000	/* Used until the RPU reports the layout */
+
+static uint64_t store_base;
+static uint64_t store_size;
+static unsigned char *store;
+static int store_fd = -1;
+
+static uint64_t layout_base = BLK_RAMDISK_BASE;
+
+void setup_blk(int fd)
+{
+	const char *base_env = getenv("APU_BLK_BASE");
+	const char *size_env = getenv("APU_BLK_SIZE");
+	uint32_t msg_buf[sizeof(payload_t)/4 + 1] = {};
+	payload_t *msg = (payload_t*)msg_buf;
+
+	store_base = base_env ? strtoull(base_env, NULL, 0) : BLK_DEFAULT_BASE;
+	store_size = size_env ? strtoull(size_env, NULL, 0) : 0;
+	store_size -= store_size % BLK_SIZE;
+
+	if(store_size == 0)
+		return;
+
+	if(store_size > UINT32_MAX || mmap_buffer(store_base, store_size, &store_fd, &store)) {
+		spdlog::error("Failed to set up block store! (base: {:x}, size: {})", store_base, store_size);
+		store_size = 0;
+		return;
+	}
+
+	spdlog::info("Block store of {} blocks at {:x}", store_size / BLK_SIZE, store_base);
+
+	msg->id = PAYLOAD_BLK_INFO;
+	msg->len = sizeof(uint32_t);
+	msg->data[0] = store_size / BLK_SIZE;
+
+	if(write(fd, msg, sizeof(msg_buf)) != sizeof(msg_buf))
+		spdlog::warn("Failed to send block store info");
+}
+
+static void send_blk_done(int fd, payload_t *recv, int32_t status)
+{
+	uint32_t msg_buf[sizeof(payload_t)/4 + 1] = {};
+	payload_t *msg = (payload_t*)msg_buf;
+
+	msg->id = PAYLOAD_BLK_DONE;
+	msg->len = sizeof(uint32_t);
+	msg->priv = recv->priv;
+	msg->buf = recv->buf;
+	msg->buf_len = recv->buf_len;
+	msg->data[0] = status;
+
+	if(write(fd, msg, sizeof(msg_buf)) != sizeof(msg_buf))
+		spdlog::warn("Failed to send block completion");
+}
+
+/* Copies between the store and the RPU buffer, which does not have to start on a page boundary */
+static int blk_copy(payload_t *recv)
+{
+	const uint64_t off = (uint64_t)recv->data[0] * BLK_SIZE;
+	const uint64_t len = (uint64_t)recv->data[1] * BLK_SIZE;
+	const uint32_t page = sysconf(_SC_PAGESIZE);
+	const uint32_t skew = recv->buf % page;
+	unsigned char *buf;
+	int fd, ret;
+
+	if(off > store_size || len > store_size - off || len > recv->buf_len)
+		return -EINVAL;
+
+	ret = mmap_buffer(recv->buf - skew, len + skew, &fd, &buf);
+	if(ret)
+		return -ret;
+
+	if(recv->id == PAYLOAD_BLK_READ)
+		memcpy(buf + skew, store + off, len);
+	else
+		memcpy(store + off, buf + skew, len);
+
+	mmap_cleanup(len + skew, fd, buf);
+	return 0;
+}
+
+void handle_blk_cmd(int fd, payload_t *recv)
+{
+	int32_t status = 0;
+
+	if(!store) {
+		spdlog::error("Block request without a block store! (id: {})", recv->id);
+		status = -ENODEV;
+	} else if(recv->id != PAYLOAD_BLK_FLUSH) {
+		status = blk_copy(recv);
+		if(status)
+			spdlog::error("Block request failed! (id: {}, lba: {}, nlb: {}, ret: {})", recv->id, recv->data[0],
+				recv->data[1], status);
+	}
+
+	send_blk_done(fd, recv, status);
+}
+
+void handle_blk_layout(payload_t *recv)
+{
+	if(!recv->buf && !store)
+		spdlog::warn("RPU keeps the namespace here, but the block store is not set up (APU_BLK_SIZE)");
+
+	layout_base = recv->buf ? recv->buf : store_base;
+
+	spdlog::info("Namespace at {:x}{}", layout_base, recv->buf ? "" : " (block store)");
+}
+
+uint64_t blk_addr(uint64_t offset)
+{
+	return layout_base + offset;
+}
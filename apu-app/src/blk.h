@@ -0,0 +1,22 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BLK_H
+#define BLK_H
+
+#include "rpmsg.h"
+
+#define BLK_SIZE	512
+
+void setup_blk(int fd);
+void handle_blk_cmd(int fd, payload_t *recv);
+void handle_blk_layout(payload_t *recv);
+
+/* Physical address of the namespace byte at offset, as reported by the RPU */
+uint64_t blk_addr(uint64_t offset);
+
+#endif
@@ -16,7 +16,7 @@
 
 #include <spdlog/spdlog.h>
 
-int mmap_buffer(uint32_t base, uint32_t len, int *fd, unsigned char **buf)
+int mmap_buffer(uint64_t base, uint32_t len, int *fd, unsigned char **buf)
 {
 	*fd = open("/dev/mem", O_RDWR | O_SYNC);
 
@@ -25,7 +25,7 @@ int mmap_buffer(uint32_t base, uint32_t len, int *fd, unsigned char **buf)
 		return errno;
 	}
 
-	*buf = (unsigned char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, base);
+	*buf = (unsigned char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, (off_t)base);
 
 	spdlog::debug("mapping memory (base: {0:x}, len: {})", base, len);
 
@@ -44,17 +44,26 @@ void mmap_cleanup(uint32_t len, int fd, unsigned char *buf)
 	close(fd);
 }
 
-void send_ack(int fd, payload_t *data, uint32_t id)
+/* A nonzero status is sent in data[0] and fails the command on the host */
+void send_ack(int fd, payload_t *data, uint32_t id, uint32_t status)
 {
-	struct payload ack_msg = {
-		id : id,
-		priv : data->priv,
-		buf : data->buf,
-		buf_len : data->buf_len,
-	};
-
-	int bytes = write(fd, &ack_msg, sizeof(ack_msg));
-	if(bytes != sizeof(ack_msg))
+	uint32_t msg_buf[sizeof(payload_t)/4 + 1] = {};
+	payload_t *ack_msg = (payload_t*)msg_buf;
+	size_t len = sizeof(payload_t);
+
+	ack_msg->id = id;
+	ack_msg->priv = data->priv;
+	ack_msg->buf = data->buf;
+	ack_msg->buf_len = data->buf_len;
+
+	if(status) {
+		ack_msg->len = sizeof(uint32_t);
+		ack_msg->data[0] = status;
+		len = sizeof(msg_buf);
+	}
+
+	int bytes = write(fd, ack_msg, len);
+	if(bytes != (int)len)
 		spdlog::warn("Failed to send ACK: {}", bytes);
 }
 
@@ -70,7 +79,7 @@ void handle_adm_cmd(int fd, payload_t *recv)
 
 	if(recv->buf_len > 0) {
 		if(mmap_buffer(recv->buf, recv->buf_len, &mmap_fd, &mmap_buf)) {
-			send_ack(fd, recv, PAYLOAD_ACK);
+			send_ack(fd, recv, PAYLOAD_ACK, NVME_SC_INTERNAL);
 			return;
 		}
 	}
@@ -96,6 +105,10 @@ void handle_adm_cmd(int fd, payload_t *recv)
 			adm_cmd_status(recv, mmap_buf);
 			send_ack(fd, recv, PAYLOAD_ACK_DATA);
 			break;
+		case CMD_ADM_GET_LOG:
+			adm_cmd_get_log(recv, mmap_buf);
+			send_ack(fd, recv, PAYLOAD_ACK_DATA);
+			break;
 		default:
 			send_ack(fd, recv, PAYLOAD_ACK);
 			break;
@@ -118,30 +131,26 @@ void handle_io_cmd(int fd, payload_t *recv)
 
 	if(recv->buf_len > 0) {
 		if(mmap_buffer(recv->buf, recv->buf_len, &mmap_fd, &mmap_buf)) {
-			send_ack(fd, recv, PAYLOAD_ACK);
+			send_ack(fd, recv, PAYLOAD_ACK, NVME_SC_INTERNAL);
 			return;
 		}
 	}
 
 	switch(cmd->cdw0.opc) {
 		case CMD_IO_SEND_FW:
-			io_cmd_send_fw(recv, mmap_buf);
-			send_ack(fd, recv, PAYLOAD_ACK);
+			send_ack(fd, recv, PAYLOAD_ACK, io_cmd_send_fw(recv, mmap_buf));
 			break;
 		case CMD_IO_READ_LBA:
-			io_cmd_read_lba(recv);
-			send_ack(fd, recv, PAYLOAD_ACK);
+			send_ack(fd, recv, PAYLOAD_ACK, io_cmd_read_lba(recv));
 			break;
 		case CMD_IO_WRITE_LBA:
-			io_cmd_write_lba(recv);
-			send_ack(fd, recv, PAYLOAD_ACK);
+			send_ack(fd, recv, PAYLOAD_ACK, io_cmd_write_lba(recv));
 			break;
 		case CMD_IO_SEND_DATA:
 		case CMD_IO_READ_DATA:
 		case CMD_IO_READ_FW:
 		case CMD_IO_CTL:
-			io_cmd_acc_ctl(recv);
-			send_ack(fd, recv, PAYLOAD_ACK);
+			send_ack(fd, recv, PAYLOAD_ACK, io_cmd_acc_ctl(recv));
 			break;
 		default:
 			send_ack(fd, recv, PAYLOAD_ACK);
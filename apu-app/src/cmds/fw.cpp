@@ -7,14 +7,17 @@
 
 #include "cmd.h"
 #include "nvme.h"
+#include "firmware.h"
 #include <cstdio>
-#include <cassert>
+#include <algorithm>
 
-#include "acc.h"
 #include <spdlog/spdlog.h>
-#define DEBUG
 
-std::map<unsigned int, std::vector<unsigned char>> fw_map;
+/* Flags in cdw12 */
+#define FW_CHUNK_MORE		(1 << 0)	/* more chunks of the image follow, sent in order */
+#define FW_CHUNK_SEGMENT	(1 << 1)	/* data is a segment placed at cdw11 dwords */
+#define FW_CHUNK_COMMIT		(1 << 2)	/* store the image of cdw11 dwords, no data */
+#define FW_CHUNK_ABORT		(1 << 3)	/* drop the upload in progress, no data */
 
 typedef struct cmd_sq {
 	nvme_sq_entry_base_t base;
@@ -22,36 +25,54 @@ typedef struct cmd_sq {
 	uint32_t cdw11;
 	uint32_t cdw12;
 	uint32_t cdw13;
+	uint32_t cdw14;
 } cmd_sq_t;
 
-void io_cmd_send_fw(payload_t *recv, unsigned char *buf)
+/* cdw10 - length in dwords, cdw11 - offset or image length in dwords, cdw12 - flags, cdw13 - firmware ID,
+ * cdw14 - size of the uploaded image in dwords
+ *
+ * Without flags and image size the data is a complete image. Large images are sent either as chunks
+ * in order (FW_CHUNK_MORE, cleared on the last chunk), or as segments in any order followed by
+ * FW_CHUNK_COMMIT. Both are placed at cdw11 and carry the size of the whole image, which is checked
+ * against the memory available and APU_FW_MAX_SIZE before the upload starts. Segments can be sent
+ * again until the commit succeeds, so an interrupted upload can be resumed.
+ *
+ * Returns the NVMe status of the command, Invalid Field if the data was rejected
+ * or the image could not be committed. */
+uint32_t io_cmd_send_fw(payload_t *recv, unsigned char *buf)
 {
 	cmd_sq_t *cmd = (cmd_sq_t*)recv->data;
-	const uint32_t len = cmd->cdw10*4;
+	const uint32_t len = std::min<uint32_t>(cmd->cdw10*4, recv->buf_len);
+	const uint64_t off = (uint64_t)cmd->cdw11*4;
+	const uint32_t flags = cmd->cdw12;
 	const uint32_t id = cmd->cdw13;
-	assert(len == recv->buf_len); // For now we support only transfers that fit in a single buffer
-	spdlog::debug("Received firmware (len: {}, id: {})", len, id);
-	std::string logbuf = "";
-	for(uint32_t i = 0; i < recv->buf_len; i++) {
-		logbuf += fmt::format("{:02x} ", buf[i]);
-		if((i % 16) == 15)
-		{
-			spdlog::debug(logbuf);
-			logbuf = "";
-		}
-	}
-	if (!logbuf.empty())
-	{
-		spdlog::debug(logbuf);
-	}
+	const uint64_t size = (uint64_t)cmd->cdw14*4;
+	bool ok = true;
 
-	spdlog::debug("Map keys: ");
-	logbuf = "";
-	for(auto it = fw_map.begin(); it != fw_map.end(); it++) {
-		logbuf += fmt::format("{} ", it->first);
+	if(flags & FW_CHUNK_ABORT) {
+		spdlog::debug("Aborting firmware upload (id: {})", id);
+		fw_store.abort(id);
+	} else if(flags & FW_CHUNK_COMMIT) {
+		spdlog::debug("Committing firmware (len: {}, id: {})", off, id);
+		ok = fw_store.commit(id, off);
+	} else if(flags & FW_CHUNK_SEGMENT) {
+		spdlog::debug("Received firmware segment (len: {}, off: {:08x}, size: {}, id: {})", len, off, size, id);
+		ok = fw_store.write(id, size, off, buf, len);
+	} else if((flags & FW_CHUNK_MORE) || size) {
+		const bool more = flags & FW_CHUNK_MORE;
+		spdlog::debug("Received firmware chunk (len: {}, off: {:08x}, size: {}, id: {}{})", len, off, size, id,
+				more ? ", more chunks follow" : "");
+		/* the first chunk starts over, leftovers of an abandoned upload are dropped */
+		if(off == 0)
+			fw_store.abort(id);
+		ok = fw_store.write(id, size, off, buf, len);
+		/* the last chunk stores the image */
+		if(ok && !more)
+			ok = fw_store.commit(id, off + len);
+	} else {
+		spdlog::debug("Received firmware (len: {}, id: {})", len, id);
+		ok = fw_store.put(id, buf, len);
 	}
 
-	spdlog::debug(logbuf);
-	std::vector<unsigned char> fw(buf, buf+recv->buf_len);
-	fw_map[id] = std::move(fw);
+	return ok ? NVME_SC_SUCCESS : NVME_SC_INVALID_FIELD;
 }
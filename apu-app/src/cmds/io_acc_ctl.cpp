@@ -21,7 +21,8 @@ typedef struct cmd_sq {
 	uint32_t cdw14;
 } cmd_sq_t;
 
-void io_cmd_acc_ctl(payload_t *recv)
+/* Returns the NVMe status of the command */
+uint32_t io_cmd_acc_ctl(payload_t *recv)
 {
 	cmd_sq_t *cmd = (cmd_sq_t*)recv->data;
 	const uint32_t id = cmd->cdw14;
@@ -30,26 +31,37 @@ void io_cmd_acc_ctl(payload_t *recv)
 	spdlog::debug("IO CTL id: {}, op: {}", id, op);
 	if(id >= accelerators.size()) {
 		spdlog::error("Invalid accelerator ID! ({})", id);
-		return;
+		return NVME_SC_INVALID_FIELD;
 	}
 
 	Acc *a = accelerators[id];
 
 	switch(op) {
 		case ACC_IO_OP_RESET:
+			/* a running job is left to stop in the background, the host polls the status */
 			accelerators[id] = new Acc(id);
-			delete a;
+			acc_scheduler->retire(a);
 			break;
 		case ACC_IO_OP_START:
-			a->start();
+			if(!a->start())
+				return NVME_SC_CMD_SEQ_ERROR;
 			break;
 		case ACC_IO_OP_STOP:
 			a->stop();
 			break;
 		case ACC_IO_OP_SET_FW:
-			a->addFirmware(fw_map[fw_id]);
+			if(!a->addFirmware(fw_id, fw_store.get(fw_id)))
+				return NVME_SC_INVALID_FIELD;
+			break;
+		case ACC_IO_OP_SET_STREAM:
+			/* cdw10 - chunk size in bytes (0 disables streaming), cdw11 - state size in bytes */
+			if(!a->setStreaming(cmd->cdw10, cmd->cdw11))
+				return NVME_SC_INVALID_FIELD;
 			break;
 		default:
 			spdlog::warn("Unsupported operation! ({})", op);
+			return NVME_SC_INVALID_FIELD;
 	}
+
+	return NVME_SC_SUCCESS;
 }
@@ -8,16 +8,19 @@
 #include "cmd.h"
 #include "lba.h"
 #include "acc.h"
+#include "blk.h"
+#include "nvme.h"
 
 #include <cstdio>
 #include <spdlog/spdlog.h>
 
-void io_cmd_read_lba(payload_t *recv)
+/* Both return the NVMe status of the command */
+uint32_t io_cmd_read_lba(payload_t *recv)
 {
 	cmd_sq_t *cmd = (cmd_sq_t*)recv->data;
 	const uint64_t lba = (((uint64_t)cmd->cdw13) << 32) | cmd->cdw12;
 	const uint32_t len = cmd->cdw14.nlb;
-	const uint64_t addr = (lba * RAMDISK_PAGE) + RAMDISK_BASE;
+	const uint64_t addr = blk_addr(lba * RAMDISK_PAGE);
 	const uint32_t id = cmd->cdw15;
 #ifdef DEBUG
 	spdlog::debug("Read LBA: {}, addr: {:02x}, len: {}, id: {}", lba, addr, len, id);
@@ -45,18 +48,20 @@ void io_cmd_read_lba(payload_t *recv)
 #endif
 #endif
 
-	if(accelerators.size() > id)
-		accelerators[id]->addRamdiskIn(addr, len*RAMDISK_PAGE);
-	else
+	if(accelerators.size() <= id) {
 		spdlog::error("Invalid Accelerator ID! ({})", id);
+		return NVME_SC_SUCCESS;
+	}
+
+	return accelerators[id]->addRamdiskIn(addr, len*RAMDISK_PAGE) ? NVME_SC_SUCCESS : NVME_SC_CMD_SEQ_ERROR;
 }
 
-void io_cmd_write_lba(payload_t *recv)
+uint32_t io_cmd_write_lba(payload_t *recv)
 {
 	cmd_sq_t *cmd = (cmd_sq_t*)recv->data;
 	const uint64_t lba = (((uint64_t)cmd->cdw13) << 32) | cmd->cdw12;
 	const uint32_t len = cmd->cdw14.nlb;
-	const uint64_t addr = (lba * RAMDISK_PAGE) + RAMDISK_BASE;
+	const uint64_t addr = blk_addr(lba * RAMDISK_PAGE);
 	const uint32_t id = cmd->cdw15;
 #ifdef DEBUG
 	spdlog::debug("Write LBA: {}, addr: {:lx}, len: {}, id: {}", lba, addr, len, id);
@@ -85,8 +90,10 @@ void io_cmd_write_lba(payload_t *recv)
 #endif
 #endif
 
-	if(accelerators.size() > id)
-		accelerators[id]->addRamdiskOut(addr, len*RAMDISK_PAGE);
-	else
+	if(accelerators.size() <= id) {
 		spdlog::error("Invalid Accelerator ID! ({})", id);
+		return NVME_SC_SUCCESS;
+	}
+
+	return accelerators[id]->addRamdiskOut(addr, len*RAMDISK_PAGE) ? NVME_SC_SUCCESS : NVME_SC_CMD_SEQ_ERROR;
 }
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "cmd.h"
+#include "nvme.h"
+#include "acc.h"
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+typedef struct cmd_cdw10 {
+	uint32_t lid : 8;
+	uint32_t lsp : 4;
+	uint32_t rsvd : 3;
+	uint32_t rae : 1;
+	uint32_t numdl : 16;
+} cmd_cdw10_t;
+
+typedef struct cmd_cdw11 {
+	uint32_t numdu : 16;
+	uint32_t lsi : 16;
+} cmd_cdw11_t;
+
+typedef struct cmd_sq {
+	nvme_sq_entry_base_t base;
+	cmd_cdw10_t cdw10;
+	cmd_cdw11_t cdw11;
+	uint32_t cdw12; // LPOL
+	uint32_t cdw13; // LPOU
+} cmd_sq_t;
+
+typedef struct telemetry_head {
+	uint32_t count;		/* number of accelerators */
+	uint32_t entry_len;	/* size of a single telemetry_entry_t */
+	uint32_t rsvd[6];
+} telemetry_head_t;
+
+typedef struct telemetry_entry {
+	uint32_t id;
+	uint32_t state;
+	uint32_t rsvd[2];
+	AccStats stats;
+} telemetry_entry_t;
+
+/* Accelerator telemetry log: header followed by an entry per accelerator */
+static std::vector<unsigned char> get_telemetry_log(void)
+{
+	std::vector<unsigned char> log(sizeof(telemetry_head_t) + accelerators.size() * sizeof(telemetry_entry_t));
+	telemetry_head_t *head = (telemetry_head_t*)log.data();
+	telemetry_entry_t *entries = (telemetry_entry_t*)(log.data() + sizeof(telemetry_head_t));
+
+	head->count = accelerators.size();
+	head->entry_len = sizeof(telemetry_entry_t);
+
+	for(size_t i = 0; i < accelerators.size(); i++) {
+		entries[i].id = accelerators[i]->getId();
+		entries[i].state = static_cast<uint32_t>(getAccState(i));
+		entries[i].stats = accelerators[i]->getStats();
+	}
+
+	return log;
+}
+
+void adm_cmd_get_log(payload_t *recv, unsigned char *buf)
+{
+	cmd_sq_t *cmd = (cmd_sq_t*)recv->data;
+	const uint32_t lid = cmd->cdw10.lid;
+	const uint64_t off = ((uint64_t)cmd->cdw13) << 32 | cmd->cdw12;
+	std::vector<unsigned char> log;
+
+	spdlog::debug("Get Log Page, lid: {:02x}, offset: {}, len: {}", lid, off, recv->buf_len);
+
+	switch(lid) {
+		case LID_ACC_TELEMETRY:
+			log = get_telemetry_log();
+			break;
+		default:
+			spdlog::error("Unsupported log page! ({:02x})", lid);
+			break;
+	}
+
+	if(recv->buf_len == 0)
+		return;
+
+	memset(buf, 0, recv->buf_len);
+
+	if(off < log.size())
+		memcpy(buf, log.data() + off, std::min<size_t>(recv->buf_len, log.size() - off));
+}
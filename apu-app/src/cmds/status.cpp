@@ -12,6 +12,7 @@
 
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
 
 typedef struct cmd_cdw12 {
 	uint32_t id : 16;
@@ -32,22 +33,29 @@ typedef struct stat_head {
 	uint32_t rsvd[6];
 } stat_head_t;
 
-stat_head_t *heads;
+/* Status of an accelerator followed by the metrics of its last job */
+typedef struct stat_resp {
+	stat_head_t head;
+	AccStats stats;
+} stat_resp_t;
+
+stat_resp_t *heads;
 
 void setup_status(void) {
 	auto size = accelerators.size();
 
-	heads = new stat_head_t[size];
+	heads = new stat_resp_t[size];
 }
 
 static void calculate_status(unsigned int id)
 {
 	Acc *a = accelerators[id];
 
-	stat_head_t &head = heads[id];
+	stat_resp_t &resp = heads[id];
 
-	head.len = 8;
-	head.id = static_cast<uint32_t>(a->getState());
+	resp.head.len = sizeof(stat_resp_t);
+	resp.head.id = static_cast<uint32_t>(getAccState(id));
+	resp.stats = a->getStats();
 }
 
 void adm_cmd_status(payload_t *recv, unsigned char *buf)
@@ -64,6 +72,5 @@ void adm_cmd_status(payload_t *recv, unsigned char *buf)
 	if(!rae)
 		calculate_status(id);
 
-	if(recv->buf_len <= sizeof(heads[0]))
-		memcpy(buf, &heads[id], recv->buf_len);
+	memcpy(buf, &heads[id], std::min<size_t>(recv->buf_len, sizeof(heads[0])));
 }
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "firmware.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+FirmwareStore fw_store;
+
+/* FNV-1a, used to find identical images and to detect firmware changes */
+uint64_t firmware_hash(const unsigned char *data, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for(size_t i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/* Returns the stored image with the same content, or stores a new one */
+FirmwareBlob FirmwareStore::intern(std::vector<unsigned char> &&data)
+{
+	const uint64_t hash = firmware_hash(data.data(), data.size());
+	auto range = by_hash.equal_range(hash);
+
+	for(auto it = range.first; it != range.second;) {
+		FirmwareBlob fw = it->second.lock();
+
+		if(!fw) {
+			it = by_hash.erase(it);
+			continue;
+		}
+
+		if(fw->data == data) {
+			spdlog::debug("Firmware {:016x} already stored", hash);
+			return fw;
+		}
+
+		it++;
+	}
+
+	auto fw = std::make_shared<Firmware>();
+	fw->data = std::move(data);
+	fw->hash = hash;
+	by_hash.emplace(hash, fw);
+
+	return fw;
+}
+
+/* Largest image accepted, set with APU_FW_MAX_SIZE in bytes. By default
+ * images are only limited by the memory available when the upload starts. */
+static size_t max_image_size(void)
+{
+	static const size_t limit = []() {
+		size_t l = 0;
+		if(const char *size = getenv("APU_FW_MAX_SIZE"))
+			l = strtoull(size, nullptr, 0);
+		return l;
+	}();
+	const long pages = sysconf(_SC_AVPHYS_PAGES);
+	const long page_size = sysconf(_SC_PAGESIZE);
+	const size_t available = (pages > 0 && page_size > 0) ? (size_t)pages * page_size : SIZE_MAX;
+
+	return limit ? std::min(limit, available) : available;
+}
+
+/* Copies the segment into place, segments may arrive in any order and overlap.
+ * Fails if the segment ends past the size declared for the image. */
+bool FirmwareUpload::write(size_t offset, const unsigned char *buf, size_t len)
+{
+	if(offset > data.size() || len > data.size() - offset) {
+		spdlog::error("Firmware segment out of bounds (off: {}, len: {}, image: {})", offset, len, data.size());
+		return false;
+	}
+
+	size_t start = offset;
+	size_t end = offset + len;
+
+	std::copy(buf, buf + len, data.begin() + offset);
+
+	/* merge with the overlapping and adjacent received ranges */
+	auto it = received.upper_bound(start);
+	if(it != received.begin() && std::prev(it)->second >= start)
+		it--;
+
+	while(it != received.end() && it->first <= end) {
+		start = std::min(start, it->first);
+		end = std::max(end, it->second);
+		it = received.erase(it);
+	}
+
+	received[start] = end;
+
+	return true;
+}
+
+/* Checks that the first len bytes of the image were received */
+bool FirmwareUpload::complete(size_t len) const
+{
+	if(len == 0)
+		return true;
+
+	return !received.empty() && received.begin()->first == 0 && received.begin()->second >= len;
+}
+
+/* Returns the upload of the given ID, started with the declared image size if there is none.
+ * An upload of a different size is replaced. Returns nullptr if the size is not accepted. */
+FirmwareUpload *FirmwareStore::getUpload(unsigned int id, size_t size)
+{
+	auto it = uploads.find(id);
+
+	if(it != uploads.end() && it->second.data.size() == size)
+		return &it->second;
+
+	const size_t limit = max_image_size();
+
+	if(size == 0 || size > limit) {
+		spdlog::error("Invalid firmware #{} size ({} bytes, max: {})", id, size, limit);
+		return nullptr;
+	}
+
+	if(it != uploads.end()) {
+		spdlog::warn("Restarting upload of firmware #{} ({} -> {} bytes)", id, it->second.data.size(), size);
+		uploads.erase(it);
+	} else if(uploads.size() >= FW_MAX_UPLOADS) {
+		spdlog::error("Too many firmware uploads in progress, rejecting #{}", id);
+		return nullptr;
+	}
+
+	FirmwareUpload &image = uploads[id];
+
+	image.data.resize(size);
+
+	return &image;
+}
+
+/* Stores a complete image under the given ID, dropping an unfinished upload of it */
+bool FirmwareStore::put(unsigned int id, const unsigned char *data, size_t len)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uploads.erase(id);
+
+	images[id] = intern(std::vector<unsigned char>(data, data + len));
+	spdlog::debug("Stored firmware #{} (len: {}, hash: {:016x})", id, len, images[id]->hash);
+
+	return true;
+}
+
+/* Writes a segment of an image of the given size, starting the upload with the first segment */
+bool FirmwareStore::write(unsigned int id, size_t size, size_t offset, const unsigned char *data, size_t len)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	FirmwareUpload *image = getUpload(id, size);
+
+	return image && image->write(offset, data, len);
+}
+
+/* Stores the uploaded image of the given length, fails if any part of it is missing.
+ * The upload is kept on failure, so the missing segments can be sent again. */
+bool FirmwareStore::commit(unsigned int id, size_t len)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto upload = uploads.find(id);
+
+	if(upload == uploads.end()) {
+		spdlog::error("No upload in progress for firmware #{}!", id);
+		return false;
+	}
+
+	if(len > upload->second.data.size()) {
+		spdlog::error("Firmware #{} committed with {} bytes, {} declared", id, len, upload->second.data.size());
+		return false;
+	}
+
+	if(!upload->second.complete(len)) {
+		size_t received = 0;
+
+		for(auto &range : upload->second.received)
+			received += range.second - range.first;
+
+		spdlog::error("Firmware #{} incomplete, {} of {} bytes received in {} ranges", id,
+				received, len, upload->second.received.size());
+		return false;
+	}
+
+	std::vector<unsigned char> data = std::move(upload->second.data);
+
+	data.resize(len);
+	uploads.erase(upload);
+
+	images[id] = intern(std::move(data));
+
+	spdlog::debug("Stored firmware #{} (len: {}, hash: {:016x})", id, len, images[id]->hash);
+
+	return true;
+}
+
+void FirmwareStore::abort(unsigned int id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uploads.erase(id);
+}
+
+FirmwareBlob FirmwareStore::get(unsigned int id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = images.find(id);
+
+	return it != images.end() ? it->second : nullptr;
+}
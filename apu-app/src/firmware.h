@@ -0,0 +1,60 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/* Immutable firmware image, shared by the store and accelerators using it */
+struct Firmware {
+	std::vector<unsigned char> data;
+	uint64_t hash;
+};
+
+typedef std::shared_ptr<const Firmware> FirmwareBlob;
+
+uint64_t firmware_hash(const unsigned char *data, size_t len);
+
+/* Image being uploaded in segments, its size is declared when the upload starts */
+struct FirmwareUpload {
+	std::vector<unsigned char> data;
+	std::map<size_t, size_t> received;	/* start -> end of received ranges, merged */
+
+	bool write(size_t offset, const unsigned char *buf, size_t len);
+	bool complete(size_t len) const;
+};
+
+/* Uploads open at a time, further ones are rejected until one is committed or aborted */
+#define FW_MAX_UPLOADS	4
+
+/* Firmware images keyed by ID. Identical images uploaded under
+ * different IDs share a single buffer. */
+class FirmwareStore {
+private:
+	std::mutex mutex;
+	std::map<unsigned int, FirmwareBlob> images;
+	std::multimap<uint64_t, std::weak_ptr<const Firmware>> by_hash;
+	std::map<unsigned int, FirmwareUpload> uploads;	/* uploads in progress */
+
+	FirmwareBlob intern(std::vector<unsigned char> &&data);
+	FirmwareUpload *getUpload(unsigned int id, size_t size);
+public:
+	bool put(unsigned int id, const unsigned char *data, size_t len);
+	bool write(unsigned int id, size_t size, size_t offset, const unsigned char *data, size_t len);
+	bool commit(unsigned int id, size_t len);
+	void abort(unsigned int id);
+	FirmwareBlob get(unsigned int id);
+};
+
+extern FirmwareStore fw_store;
+
+#endif
@@ -10,7 +10,6 @@
 
 #include "nvme.h"
 
-#define RAMDISK_BASE	0x68000000
 #define RAMDISK_PAGE	4096
 
 typedef struct cmd_cdw14 {
@@ -7,23 +7,43 @@
 
 #include <unistd.h>
 #include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
 #include <vector>
 
 #include "nvme.h"
 #include "rpmsg.h"
 #include "cmd.h"
 #include "acc.h"
+#include "blk.h"
 #include "vta/tf_driver.h"
 
 #include <spdlog/spdlog.h>
 
 int rpmsg_init(void);
 
+/* Number of accelerator slots can be set with APU_ACC_SLOTS, defaults to the number of cores.
+ * APU_ACC_TIMEOUT_MS limits the run time of a job, unlimited by default. */
 static void setup_acc(void)
 {
-	Acc *a0 = new Acc(0);
+	unsigned int slots = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int timeout_ms = 0;
+	const char *env = getenv("APU_ACC_SLOTS");
 
-	accelerators.push_back(a0);
+	if(env && atoi(env) > 0)
+		slots = atoi(env);
+
+	env = getenv("APU_ACC_TIMEOUT_MS");
+	if(env && atoi(env) > 0)
+		timeout_ms = atoi(env);
+
+	spdlog::info("Setting up {} accelerator slots (job timeout: {} ms)", slots, timeout_ms);
+
+	acc_scheduler = new AccScheduler(slots, timeout_ms);
+
+	for(unsigned int i = 0; i < slots; i++)
+		accelerators.push_back(new Acc(i));
 }
 
 static void init(void)
@@ -36,7 +56,7 @@ static void init(void)
 
 int main(int argc, char *argv[])
 {
-	payload_t initial_msg = { .id = 1234, };
+	payload_t initial_msg = { .id = PAYLOAD_HELLO, };
 	char buf[NVME_TC_SQ_ENTRY_SIZE + sizeof(payload_t)];
 	int fd = rpmsg_init();
 
@@ -46,6 +66,7 @@ int main(int argc, char *argv[])
 		return fd;
 
 	write(fd, &initial_msg, sizeof(initial_msg));
+	setup_blk(fd);
 
 	for(;;) {
 		int bytes = read(fd, buf, sizeof(buf));
@@ -58,6 +79,14 @@ int main(int argc, char *argv[])
 				case PAYLOAD_IO_CMD:
 					handle_io_cmd(fd, recv);
 					break;
+				case PAYLOAD_BLK_READ:
+				case PAYLOAD_BLK_WRITE:
+				case PAYLOAD_BLK_FLUSH:
+					handle_blk_cmd(fd, recv);
+					break;
+				case PAYLOAD_BLK_LAYOUT:
+					handle_blk_layout(recv);
+					break;
 				default:
 					spdlog::warn("Unsupported command received! (id: {}, len: {}, priv: {:08x})", recv->id, recv->len, recv->priv);
 			}
@@ -59,6 +59,8 @@ typedef struct nvme_cq_entry {
 	uint32_t dnr : 1;
 } nvme_cq_entry_t;
 
+#define CMD_ADM_GET_LOG		0x02
+
 #define CMD_ADM_FW_COMMIT	0x10
 #define CMD_ADM_FW_DOWNLOAD	0x11
 
@@ -77,4 +79,12 @@ typedef struct nvme_cq_entry {
 
 #define CMD_IO_CTL		0x91
 
+#define LID_ACC_TELEMETRY	0xC0
+
+/* Generic command status codes returned with PAYLOAD_ACK */
+#define NVME_SC_SUCCESS		0x00
+#define NVME_SC_INVALID_FIELD	0x02
+#define NVME_SC_INTERNAL	0x06
+#define NVME_SC_CMD_SEQ_ERROR	0x0C
+
 #endif
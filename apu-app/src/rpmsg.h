@@ -21,7 +21,20 @@ typedef struct payload {
 
 #define PAYLOAD_ADM_CMD		0x10
 #define PAYLOAD_IO_CMD		0x11
-#define PAYLOAD_ACK		0x20
+#define PAYLOAD_ACK		0x20	/* NVMe status code in data[0] if len is set */
 #define PAYLOAD_ACK_DATA	0x21
 
+/* Sent to the RPU once the endpoint is up, it replies with PAYLOAD_BLK_LAYOUT */
+#define PAYLOAD_HELLO		1234
+
+/* Block store used by the RPU APU tier, data[0] is the LBA and data[1] the number of 512 byte blocks */
+#define PAYLOAD_BLK_READ	0x30
+#define PAYLOAD_BLK_WRITE	0x31
+#define PAYLOAD_BLK_FLUSH	0x32
+#define PAYLOAD_BLK_DONE	0x22	/* Status in data[0] */
+#define PAYLOAD_BLK_INFO	0x23	/* Number of blocks in data[0] */
+
+/* Address (0 if the namespace is kept here) and size of the namespace */
+#define PAYLOAD_BLK_LAYOUT	0x33
+
 #endif
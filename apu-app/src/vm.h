@@ -8,14 +8,108 @@
 #ifndef VM_H
 #define VM_H
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+
 extern "C" {
 #include "ubpf.h"
 }
 
+/* Status of the last helper call, returned by the error helper. Helpers that fail return 0. */
+#define VM_OK		0
+#define VM_EFAULT	1	/* range outside of the buffers of the program */
+#define VM_EINVAL	2	/* invalid type, comparison or count */
+#define VM_ENOENT	3	/* memchr or memmem found no match */
+#define VM_EDATA	4	/* corrupted compressed data or output too small */
+#define VM_ENOTSUP	5	/* helper not available in this build */
+#define VM_ETFLITE	6	/* TFLite model failed to load, prepare or run */
+
+/* Element types of columns passed to the reduction and filter helpers */
+#define VM_TYPE_I8	0
+#define VM_TYPE_U8	1
+#define VM_TYPE_I16	2
+#define VM_TYPE_U16	3
+#define VM_TYPE_I32	4
+#define VM_TYPE_U32	5
+#define VM_TYPE_I64	6
+#define VM_TYPE_U64	7
+
+/* Comparisons of the filter helper */
+#define VM_CMP_EQ	0
+#define VM_CMP_NE	1
+#define VM_CMP_LT	2
+#define VM_CMP_LE	3
+#define VM_CMP_GT	4
+#define VM_CMP_GE	5
+
 void register_functions(struct ubpf_vm *vm);
 
+void vm_set_regions(const void *ibuf, size_t isize, const void *obuf, size_t osize);
+
+void vm_set_cancel_flag(const std::atomic<bool> *flag);
+bool vm_cancel_requested(void);
+
+/* Aborting programs that don't yield. The caller of a program does
+ *
+ *	if(sigsetjmp(*vm_abort_env(), 1))
+ *		... aborted ...
+ *	vm_abort_arm(ticket);
+ *	... run the program ...
+ *	vm_abort_disarm();
+ *
+ * and vm_abort_thread() with the same ticket makes the thread leave the program. */
+int vm_abort_signal(void);
+sigjmp_buf *vm_abort_env(void);
+void vm_abort_arm(uint64_t ticket);
+void vm_abort_disarm(void);
+bool vm_abort_thread(pthread_t thread, uint64_t ticket);
+
+void vm_helper_enter(void);
+void vm_helper_leave(void);
+
+/* Registered in place of helper f, defers aborts until f returns */
+template<typename F, F f> struct vm_helper_guard;
+
+template<typename R, typename... A, R (*f)(A...)>
+struct vm_helper_guard<R (*)(A...), f> {
+	static R call(A... args)
+	{
+		vm_helper_enter();
+		if constexpr (std::is_void_v<R>) {
+			f(args...);
+			vm_helper_leave();
+		} else {
+			R ret = f(args...);
+			vm_helper_leave();
+			return ret;
+		}
+	}
+};
+
+#define VM_HELPER(f)	((void*)vm_helper_guard<decltype(&f), &f>::call)
+
 void vm_print(char *buf);
+uint64_t vm_cancelled(void);
+uint64_t vm_error(void);
+void vm_set_error(uint64_t err);
+uint64_t vm_memchr(uint64_t buf, uint64_t len, uint64_t c);
+uint64_t vm_memmem(uint64_t haystack, uint64_t hlen, uint64_t needle, uint64_t nlen);
+uint64_t vm_crc32c(uint64_t buf, uint64_t len, uint64_t crc);
+uint64_t vm_sum(uint64_t col, uint64_t count, uint64_t type);
+uint64_t vm_min(uint64_t col, uint64_t count, uint64_t type);
+uint64_t vm_max(uint64_t col, uint64_t count, uint64_t type);
+uint64_t vm_filter(uint64_t col, uint64_t count, uint64_t type_cmp, uint64_t value, uint64_t sel);
+uint64_t vm_lz4_decompress(uint64_t src, uint64_t srclen, uint64_t dst, uint64_t dstcap);
+uint64_t vm_zstd_decompress(uint64_t src, uint64_t srclen, uint64_t dst, uint64_t dstcap);
 void vm_tflite_apu(char *ibuf, char *obuf, int isize, int osize, int model_size);
 void vm_tflite_vta(char *ibuf, char *obuf, int isize, int osize, int model_size);
+void vm_tflite_apu_batch(char *ibuf, char *obuf, int isize, int osize, int model_size);
+void vm_tflite_vta_batch(char *ibuf, char *obuf, int isize, int osize, int model_size);
 
 #endif
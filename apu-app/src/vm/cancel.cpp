@@ -0,0 +1,115 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "vm.h"
+
+#include <mutex>
+
+/* Cancellation flag of the job running on this thread */
+static thread_local const std::atomic<bool> *cancel_flag = nullptr;
+
+void vm_set_cancel_flag(const std::atomic<bool> *flag)
+{
+	cancel_flag = flag;
+}
+
+bool vm_cancel_requested(void)
+{
+	return cancel_flag && cancel_flag->load();
+}
+
+uint64_t vm_cancelled(void)
+{
+	return vm_cancel_requested() ? 1 : 0;
+}
+
+/* Programs that don't poll the cancelled helper are aborted with a signal sent to the thread
+ * running them. The handler jumps back to the caller of the program only while BPF instructions
+ * are executed. A helper is allowed to finish first, as it may hold locks or allocations, and the
+ * jump is taken once it returns. The signal carries the ticket of the run it is meant for, so a
+ * late signal does not abort the next program run by the thread. */
+static thread_local sigjmp_buf abort_env;
+static thread_local volatile sig_atomic_t abort_armed = 0;
+static thread_local volatile sig_atomic_t abort_pending = 0;
+static thread_local volatile sig_atomic_t in_helper = 0;
+static thread_local uint64_t abort_ticket = 0;
+
+static void abort_handler(int sig, siginfo_t *info, void *ucontext)
+{
+	if(!abort_armed || (uint64_t)(uintptr_t)info->si_value.sival_ptr != abort_ticket)
+		return;
+
+	if(in_helper) {
+		abort_pending = 1;
+		return;
+	}
+
+	abort_armed = 0;
+	siglongjmp(abort_env, 1);
+}
+
+int vm_abort_signal(void)
+{
+	static std::once_flag installed;
+	static int sig;
+
+	std::call_once(installed, []() {
+		struct sigaction sa = {};
+
+		sig = SIGRTMIN + 1;
+		sa.sa_sigaction = abort_handler;
+		sa.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(sig, &sa, nullptr);
+	});
+
+	return sig;
+}
+
+sigjmp_buf *vm_abort_env(void)
+{
+	return &abort_env;
+}
+
+void vm_abort_arm(uint64_t ticket)
+{
+	vm_abort_signal();
+
+	abort_ticket = ticket;
+	abort_pending = 0;
+	in_helper = 0;
+	abort_armed = 1;
+}
+
+void vm_abort_disarm(void)
+{
+	abort_armed = 0;
+}
+
+bool vm_abort_thread(pthread_t thread, uint64_t ticket)
+{
+	union sigval value;
+
+	value.sival_ptr = (void*)(uintptr_t)ticket;
+
+	return pthread_sigqueue(thread, vm_abort_signal(), value) == 0;
+}
+
+void vm_helper_enter(void)
+{
+	in_helper = 1;
+}
+
+void vm_helper_leave(void)
+{
+	in_helper = 0;
+
+	if(abort_armed && abort_pending) {
+		abort_armed = 0;
+		siglongjmp(abort_env, 1);
+	}
+}
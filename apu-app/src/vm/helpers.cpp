@@ -0,0 +1,341 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "vm.h"
+
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <type_traits>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Memory regions of the job running on this thread, helpers only access those */
+struct vm_region {
+	uintptr_t base;
+	size_t size;
+};
+
+static thread_local vm_region regions[2];
+
+/* Status of the last helper call of the job running on this thread, read with the error helper.
+ * Results can take any value, so failures are not signalled in them. */
+static thread_local uint64_t last_error = VM_OK;
+
+static uint64_t vm_ok(uint64_t ret)
+{
+	last_error = VM_OK;
+	return ret;
+}
+
+static uint64_t vm_fail(uint64_t err)
+{
+	last_error = err;
+	return 0;
+}
+
+uint64_t vm_error(void)
+{
+	return last_error;
+}
+
+/* For helpers without a result, such as the TFLite ones */
+void vm_set_error(uint64_t err)
+{
+	last_error = err;
+}
+
+void vm_set_regions(const void *ibuf, size_t isize, const void *obuf, size_t osize)
+{
+	regions[0] = { reinterpret_cast<uintptr_t>(ibuf), ibuf ? isize : 0 };
+	regions[1] = { reinterpret_cast<uintptr_t>(obuf), obuf ? osize : 0 };
+	last_error = VM_OK;
+}
+
+/* Checks that [ptr, ptr + count * elem) lies within one of the regions */
+static bool vm_check(uint64_t ptr, uint64_t count, uint64_t elem = 1)
+{
+	if(count > std::numeric_limits<uint64_t>::max() / elem)
+		return false;
+
+	const uint64_t len = count * elem;
+
+	for(const auto &r : regions) {
+		if(r.size && ptr >= r.base && len <= r.size && ptr - r.base <= r.size - len)
+			return true;
+	}
+
+	return false;
+}
+
+/* Calls f with a value of the C type matching the VM_TYPE_* */
+template <typename F>
+static uint64_t vm_dispatch(uint64_t type, F f)
+{
+	switch(type) {
+		case VM_TYPE_I8:	return f(int8_t());
+		case VM_TYPE_U8:	return f(uint8_t());
+		case VM_TYPE_I16:	return f(int16_t());
+		case VM_TYPE_U16:	return f(uint16_t());
+		case VM_TYPE_I32:	return f(int32_t());
+		case VM_TYPE_U32:	return f(uint32_t());
+		case VM_TYPE_I64:	return f(int64_t());
+		case VM_TYPE_U64:	return f(uint64_t());
+		default:		return vm_fail(VM_EINVAL);
+	}
+}
+
+uint64_t vm_memchr(uint64_t buf, uint64_t len, uint64_t c)
+{
+	if(!vm_check(buf, len))
+		return vm_fail(VM_EFAULT);
+
+	const void *p = memchr(reinterpret_cast<const void*>(buf), static_cast<int>(c), len);
+
+	return p ? vm_ok(reinterpret_cast<uintptr_t>(p) - buf) : vm_fail(VM_ENOENT);
+}
+
+uint64_t vm_memmem(uint64_t haystack, uint64_t hlen, uint64_t needle, uint64_t nlen)
+{
+	if(!vm_check(haystack, hlen) || !vm_check(needle, nlen))
+		return vm_fail(VM_EFAULT);
+
+	const void *p = memmem(reinterpret_cast<const void*>(haystack), hlen, reinterpret_cast<const void*>(needle), nlen);
+
+	return p ? vm_ok(reinterpret_cast<uintptr_t>(p) - haystack) : vm_fail(VM_ENOENT);
+}
+
+#if !defined(__ARM_FEATURE_CRC32)
+static const uint32_t *crc32c_table(void)
+{
+	static const auto table = []() {
+		std::array<uint32_t, 256> t;
+		for(uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for(int j = 0; j < 8; j++)
+				crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+			t[i] = crc;
+		}
+		return t;
+	}();
+
+	return table.data();
+}
+#endif
+
+uint64_t vm_crc32c(uint64_t buf, uint64_t len, uint64_t crc)
+{
+	if(!vm_check(buf, len))
+		return vm_fail(VM_EFAULT);
+
+	const unsigned char *p = reinterpret_cast<const unsigned char*>(buf);
+	uint32_t c = ~static_cast<uint32_t>(crc);
+
+#if defined(__ARM_FEATURE_CRC32)
+	for(; len >= 8; p += 8, len -= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		c = __crc32cd(c, v);
+	}
+	for(; len; p++, len--)
+		c = __crc32cb(c, *p);
+#else
+	const uint32_t *table = crc32c_table();
+	for(; len; p++, len--)
+		c = (c >> 8) ^ table[(c ^ *p) & 0xff];
+#endif
+
+	return vm_ok(~c);
+}
+
+/* Reductions are written as plain loops over typed columns, which the compiler
+ * vectorizes with NEON. Results of signed types are returned as int64 bits.
+ * Sums wrap around: elements are sign-extended and added as uint64, which gives
+ * the two's complement result without signed overflow. */
+uint64_t vm_sum(uint64_t col, uint64_t count, uint64_t type)
+{
+	return vm_dispatch(type, [&](auto t) -> uint64_t {
+		using T = decltype(t);
+		using W = typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type;
+		if(!vm_check(col, count, sizeof(T)))
+			return vm_fail(VM_EFAULT);
+		const T *v = reinterpret_cast<const T*>(col);
+		uint64_t sum = 0;
+		for(uint64_t i = 0; i < count; i++)
+			sum += static_cast<uint64_t>(static_cast<W>(v[i]));
+		return vm_ok(sum);
+	});
+}
+
+/* Element-wise min/max keep the loop free of the index tracking of std::min_element */
+template <typename T, typename F>
+static uint64_t vm_reduce(uint64_t col, uint64_t count, F f)
+{
+	if(!count)
+		return vm_fail(VM_EINVAL);
+	if(!vm_check(col, count, sizeof(T)))
+		return vm_fail(VM_EFAULT);
+
+	const T *v = reinterpret_cast<const T*>(col);
+	T r = v[0];
+
+	for(uint64_t i = 1; i < count; i++)
+		r = f(r, v[i]);
+
+	return vm_ok(static_cast<uint64_t>(static_cast<int64_t>(r)));
+}
+
+uint64_t vm_min(uint64_t col, uint64_t count, uint64_t type)
+{
+	return vm_dispatch(type, [&](auto t) -> uint64_t {
+		using T = decltype(t);
+		return vm_reduce<T>(col, count, [](T a, T b) { return std::min(a, b); });
+	});
+}
+
+uint64_t vm_max(uint64_t col, uint64_t count, uint64_t type)
+{
+	return vm_dispatch(type, [&](auto t) -> uint64_t {
+		using T = decltype(t);
+		return vm_reduce<T>(col, count, [](T a, T b) { return std::max(a, b); });
+	});
+}
+
+template <typename T, typename P>
+static uint64_t vm_select(const T *v, uint64_t count, uint32_t *sel, P pred)
+{
+	uint64_t n = 0;
+
+	/* Branch-free, the index is always written and the counter advanced by the predicate,
+	 * so the loop doesn't stall on mispredictions. The store depends on the running count,
+	 * which keeps it scalar. */
+	for(uint64_t i = 0; i < count; i++) {
+		sel[n] = static_cast<uint32_t>(i);
+		n += pred(v[i]) ? 1 : 0;
+	}
+
+	return vm_ok(n);
+}
+
+/* Writes indices of the elements satisfying "element <cmp> value" to sel,
+ * returns the number of selected elements. type_cmp is VM_TYPE_* | VM_CMP_* << 8. */
+uint64_t vm_filter(uint64_t col, uint64_t count, uint64_t type_cmp, uint64_t value, uint64_t sel)
+{
+	const uint64_t type = type_cmp & 0xff;
+	const uint64_t cmp = type_cmp >> 8;
+
+	if(count > std::numeric_limits<uint32_t>::max())
+		return vm_fail(VM_EINVAL);
+	if(!vm_check(sel, count, sizeof(uint32_t)))
+		return vm_fail(VM_EFAULT);
+
+	return vm_dispatch(type, [&](auto t) -> uint64_t {
+		using T = decltype(t);
+		if(!vm_check(col, count, sizeof(T)))
+			return vm_fail(VM_EFAULT);
+		const T *v = reinterpret_cast<const T*>(col);
+		uint32_t *s = reinterpret_cast<uint32_t*>(sel);
+		const T x = static_cast<T>(value);
+		switch(cmp) {
+			case VM_CMP_EQ:	return vm_select(v, count, s, [x](T e) { return e == x; });
+			case VM_CMP_NE:	return vm_select(v, count, s, [x](T e) { return e != x; });
+			case VM_CMP_LT:	return vm_select(v, count, s, [x](T e) { return e < x; });
+			case VM_CMP_LE:	return vm_select(v, count, s, [x](T e) { return e <= x; });
+			case VM_CMP_GT:	return vm_select(v, count, s, [x](T e) { return e > x; });
+			case VM_CMP_GE:	return vm_select(v, count, s, [x](T e) { return e >= x; });
+			default:	return vm_fail(VM_EINVAL);
+		}
+	});
+}
+
+/* Decompresses a raw LZ4 block (without the frame header) */
+uint64_t vm_lz4_decompress(uint64_t src, uint64_t srclen, uint64_t dst, uint64_t dstcap)
+{
+	if(!vm_check(src, srclen) || !vm_check(dst, dstcap))
+		return vm_fail(VM_EFAULT);
+
+	const unsigned char *ip = reinterpret_cast<const unsigned char*>(src);
+	const unsigned char *iend = ip + srclen;
+	unsigned char *const ostart = reinterpret_cast<unsigned char*>(dst);
+	unsigned char *op = ostart;
+	unsigned char *const oend = ostart + dstcap;
+
+	auto read_length = [&](size_t &len) {
+		unsigned char b;
+		do {
+			if(ip >= iend)
+				return false;
+			b = *ip++;
+			len += b;
+		} while(b == 255);
+		return true;
+	};
+
+	while(ip < iend) {
+		const unsigned int token = *ip++;
+		size_t lit = token >> 4;
+
+		if(lit == 15 && !read_length(lit))
+			return vm_fail(VM_EDATA);
+		if(lit > static_cast<size_t>(iend - ip) || lit > static_cast<size_t>(oend - op))
+			return vm_fail(VM_EDATA);
+
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+
+		/* the last sequence holds only literals */
+		if(ip == iend)
+			break;
+
+		if(iend - ip < 2)
+			return vm_fail(VM_EDATA);
+
+		const size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if(offset == 0 || offset > static_cast<size_t>(op - ostart))
+			return vm_fail(VM_EDATA);
+
+		size_t match = token & 15;
+		if(match == 15 && !read_length(match))
+			return vm_fail(VM_EDATA);
+		match += 4;
+
+		if(match > static_cast<size_t>(oend - op))
+			return vm_fail(VM_EDATA);
+
+		/* matches may overlap the output being written */
+		const unsigned char *m = op - offset;
+		for(size_t i = 0; i < match; i++)
+			op[i] = m[i];
+		op += match;
+	}
+
+	return vm_ok(op - ostart);
+}
+
+uint64_t vm_zstd_decompress(uint64_t src, uint64_t srclen, uint64_t dst, uint64_t dstcap)
+{
+	if(!vm_check(src, srclen) || !vm_check(dst, dstcap))
+		return vm_fail(VM_EFAULT);
+
+#ifdef HAVE_ZSTD
+	const size_t ret = ZSTD_decompress(reinterpret_cast<void*>(dst), dstcap, reinterpret_cast<const void*>(src), srclen);
+
+	return ZSTD_isError(ret) ? vm_fail(VM_EDATA) : vm_ok(ret);
+#else
+	return vm_fail(VM_ENOTSUP);
+#endif
+}
@@ -9,7 +9,20 @@
 
 void register_functions(struct ubpf_vm *vm)
 {
-	ubpf_register(vm, 1, "print", (void*)vm_print);
-	ubpf_register(vm, 2, "tflite_apu", (void*)vm_tflite_apu);
-	ubpf_register(vm, 3, "tflite_vta", (void*)vm_tflite_vta);
+	ubpf_register(vm, 1, "print", VM_HELPER(vm_print));
+	ubpf_register(vm, 2, "tflite_apu", VM_HELPER(vm_tflite_apu));
+	ubpf_register(vm, 3, "tflite_vta", VM_HELPER(vm_tflite_vta));
+	ubpf_register(vm, 4, "tflite_apu_batch", VM_HELPER(vm_tflite_apu_batch));
+	ubpf_register(vm, 5, "tflite_vta_batch", VM_HELPER(vm_tflite_vta_batch));
+	ubpf_register(vm, 6, "cancelled", VM_HELPER(vm_cancelled));
+	ubpf_register(vm, 7, "memchr", VM_HELPER(vm_memchr));
+	ubpf_register(vm, 8, "memmem", VM_HELPER(vm_memmem));
+	ubpf_register(vm, 9, "crc32c", VM_HELPER(vm_crc32c));
+	ubpf_register(vm, 10, "sum", VM_HELPER(vm_sum));
+	ubpf_register(vm, 11, "min", VM_HELPER(vm_min));
+	ubpf_register(vm, 12, "max", VM_HELPER(vm_max));
+	ubpf_register(vm, 13, "filter", VM_HELPER(vm_filter));
+	ubpf_register(vm, 14, "lz4_decompress", VM_HELPER(vm_lz4_decompress));
+	ubpf_register(vm, 15, "zstd_decompress", VM_HELPER(vm_zstd_decompress));
+	ubpf_register(vm, 16, "error", VM_HELPER(vm_error));
 }
@@ -11,69 +11,535 @@
 #include "tensorflow/lite/kernels/register.h"
 #include "tensorflow/lite/model.h"
 #include "tensorflow/lite/tools/gen_op_registration.h"
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
 
 #include "vta/tf_driver.h"
 
 #include "vta-delegate.hpp"
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
 
+#include <pthread.h>
+#include <sched.h>
 #include <time.h>
 
 #include <spdlog/spdlog.h>
 
 #define DEBUG
 
-static void tflite_handler(char *model_buf, char *input_buf, char *output_buf, int model_len, int input_len, int output_len, bool with_vta)
+/**
+ * Settings of the CPU execution path, read from the environment:
+ *
+ * * APU_TFLITE_THREADS - number of threads used by TFLite kernels and XNNPACK (default: number of CPU cores)
+ * * APU_TFLITE_XNNPACK - set to 0 to run CPU nodes with built-in kernels instead of XNNPACK (default: 1)
+ */
+struct cpu_exec_config {
+    int num_threads;
+    bool use_xnnpack;
+};
+
+static const cpu_exec_config &get_cpu_exec_config()
 {
-    struct timespec ts[2];
+    static const cpu_exec_config config = []() {
+        cpu_exec_config c;
+        c.num_threads = std::max(1u, std::thread::hardware_concurrency());
+        c.use_xnnpack = true;
+        if (const char *threads = getenv("APU_TFLITE_THREADS"))
+            c.num_threads = std::max(1, atoi(threads));
+        if (const char *xnnpack = getenv("APU_TFLITE_XNNPACK"))
+            c.use_xnnpack = atoi(xnnpack) != 0;
+        spdlog::info("TFLite CPU path: {} threads, XNNPACK {}", c.num_threads, c.use_xnnpack ? "enabled" : "disabled");
+        return c;
+    }();
+    return config;
+}
+
+/**
+ * Lets the calling thread run on all CPU cores until the end of the scope.
+ *
+ * Accelerator slots are pinned to a single core and threads inherit the affinity of the thread creating them,
+ * so without this the TFLite and XNNPACK thread pools created from a slot would all share the core of the slot.
+ */
+class unpinned_scope
+{
+public:
+    explicit unpinned_scope(bool enable)
+    {
+        cpu_set_t all;
+        if (!enable || pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved))
+        {
+            return;
+        }
+        CPU_ZERO(&all);
+        for (unsigned int cpu = 0; cpu < std::thread::hardware_concurrency() && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, &all);
+        }
+        restore = pthread_setaffinity_np(pthread_self(), sizeof(all), &all) == 0;
+    }
+
+    ~unpinned_scope()
+    {
+        if (restore)
+        {
+            pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+        }
+    }
+
+private:
+    cpu_set_t saved;
+    bool restore = false;
+};
+
+/// Alignment of tensor data required by SetCustomAllocationForTensor
+constexpr size_t tensor_alignment = 64;
 
-    std::unique_ptr<tflite::FlatBufferModel> model = tflite::FlatBufferModel::BuildFromBuffer(model_buf, model_len);
+/**
+ * Memory aligned to tensor_alignment.
+ */
+struct aligned_buffer {
+    std::unique_ptr<char, decltype(&free)> data{nullptr, &free}; ///< buffer memory
+    size_t size = 0; ///< buffer size in bytes
+
+    void resize(size_t len)
+    {
+        size = len;
+        data.reset(static_cast<char *>(aligned_alloc(tensor_alignment, (len + tensor_alignment - 1) / tensor_alignment * tensor_alignment)));
+    }
+};
+
+/**
+ * Returns the total size of the given tensors in bytes.
+ */
+static size_t tensors_bytes(tflite::Interpreter *interpreter, const std::vector<int> &tensors)
+{
+    size_t len = 0;
+    for (int tensor : tensors)
+    {
+        len += interpreter->tensor(tensor)->bytes;
+    }
+    return len;
+}
+
+/**
+ * Points the tensors at consecutive regions of the buffer with SetCustomAllocationForTensor.
+ *
+ * If the buffer is too small or any of the regions is not aligned to tensor_alignment, the tensors are
+ * bound to the scratch buffer instead and the data needs to be copied.
+ *
+ * Returns true if the tensors were bound to the buffer.
+ */
+static bool bind_tensors(tflite::Interpreter *interpreter, const std::vector<int> &tensors, char *buf, size_t len, aligned_buffer &scratch)
+{
+    bool direct = buf && tensors_bytes(interpreter, tensors) <= len;
+    size_t offset = 0;
+    for (int tensor : tensors)
+    {
+        direct = direct && reinterpret_cast<uintptr_t>(buf + offset) % tensor_alignment == 0;
+        offset += interpreter->tensor(tensor)->bytes;
+    }
+
+    char *base = direct ? buf : scratch.data.get();
+    offset = 0;
+    for (int tensor : tensors)
+    {
+        const size_t bytes = interpreter->tensor(tensor)->bytes;
+        TfLiteCustomAllocation allocation{base + offset, bytes};
+        interpreter->SetCustomAllocationForTensor(tensor, allocation);
+        offset += bytes;
+    }
+    return direct;
+}
+
+/**
+ * Interpreter prepared for the given model, execution mode and batch size, ready to invoke.
+ */
+struct resident_model {
+    std::vector<char> model_data; ///< copy of the model, FlatBufferModel does not own the buffer
+    std::unique_ptr<tflite::FlatBufferModel> model; ///< model built from model_data
+    tflite::ops::builtin::BuiltinOpResolver resolver; ///< resolver used to build the interpreter
+    std::unique_ptr<tflite::Interpreter> interpreter; ///< interpreter with delegates applied and tensors allocated
+    int batch = 1; ///< number of requests processed by a single Invoke
+    bool bind_inputs = false; ///< input tensors are bound to the input buffer
+    bool bind_outputs = false; ///< output tensors are bound to the output buffer
+    aligned_buffer input_scratch; ///< input tensors are bound to it when the input buffer cannot be used
+    aligned_buffer output_scratch; ///< output tensors are bound to it when the output buffer cannot be used
+    size_t footprint = 0; ///< approximate memory used by the model and its tensors, in bytes
+    std::mutex mutex; ///< serializes invocations of the interpreter
+};
+
+/**
+ * Key of the resident model cache.
+ *
+ * input_len is a part of the key only when the batch size is derived from it.
+ */
+struct resident_model_key {
+    uint64_t hash;
+    int model_len;
+    bool with_vta;
+    int batch;
+    int input_len;
+
+    bool operator<(const resident_model_key &other) const
+    {
+        return std::tie(hash, model_len, with_vta, batch, input_len) <
+            std::tie(other.hash, other.model_len, other.with_vta, other.batch, other.input_len);
+    }
+};
+
+/**
+ * Returns the memory budget of the resident model cache in bytes, read from APU_TFLITE_CACHE_SIZE (default: 64 MiB).
+ *
+ * Setting it to 0 disables the cache, so interpreters are built for each call.
+ */
+static size_t get_model_cache_budget()
+{
+    static const size_t budget = []() {
+        size_t b = 64 << 20;
+        if (const char *size = getenv("APU_TFLITE_CACHE_SIZE"))
+            b = strtoull(size, nullptr, 0);
+        spdlog::info("TFLite resident model cache: {} bytes", b);
+        return b;
+    }();
+    return budget;
+}
+
+/**
+ * Computes FNV-1a hash of the model.
+ */
+static uint64_t model_hash(const char *buf, int len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= static_cast<unsigned char>(buf[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Builds the interpreter for the model, applies delegates and allocates tensors.
+ *
+ * With batch > 1, the batch dimension of all inputs is multiplied by batch.
+ * With batch == 0, the number of requests is derived from input_len.
+ *
+ * Returns nullptr if the model can't be loaded or prepared, or input_len does not match the batched inputs.
+ */
+static std::shared_ptr<resident_model> build_resident_model(const char *model_buf, int model_len, int input_len, bool with_vta, int batch)
+{
+    auto resident = std::make_shared<resident_model>();
+    resident->model_data.assign(model_buf, model_buf + model_len);
+    resident->model = tflite::FlatBufferModel::BuildFromBuffer(resident->model_data.data(), resident->model_data.size());
+    if (!resident->model)
+    {
+        spdlog::error("Failed to load the model");
+        return nullptr;
+    }
 
     // Build the interpreter
-    tflite::ops::builtin::BuiltinOpResolver resolver;
-    std::unique_ptr<tflite::Interpreter> interpreter;
-    tflite::InterpreterBuilder(*model, resolver)(&interpreter);
+    std::unique_ptr<tflite::Interpreter> &interpreter = resident->interpreter;
+    if (tflite::InterpreterBuilder(*resident->model, resident->resolver)(&interpreter) != kTfLiteOk || !interpreter)
+    {
+        spdlog::error("Failed to build the interpreter");
+        return nullptr;
+    }
+
+    const cpu_exec_config &config = get_cpu_exec_config();
+    interpreter->SetNumThreads(config.num_threads);
+
+    if (batch != 1)
+    {
+        size_t request_len = 0;
+        for (unsigned int i = 0; i < interpreter->inputs().size(); i++)
+        {
+            request_len += interpreter->input_tensor(i)->bytes;
+        }
+        if (batch == 0)
+        {
+            batch = request_len ? input_len / request_len : 1;
+        }
+        if (batch <= 0 || batch * request_len != static_cast<size_t>(input_len))
+        {
+            spdlog::error("Input buffer length {} is not a multiple of request length {}", input_len, request_len);
+            return nullptr;
+        }
+        // Resize input tensors to hold all requests
+        for (unsigned int i = 0; i < interpreter->inputs().size(); i++)
+        {
+            auto in = interpreter->input_tensor(i);
+            std::vector<int> dims(in->dims->data, in->dims->data + in->dims->size);
+            dims[0] *= batch;
+            interpreter->ResizeInputTensor(interpreter->inputs()[i], dims);
+        }
+        spdlog::debug("Batching {} requests in a single invocation", batch);
+    }
+    resident->batch = batch;
 
     if(with_vta) {
-        std::unique_ptr<TfLiteDelegate, decltype(&tflite::TfLiteVTADelegateDelete)> delegate(tflite::TfLiteVTADelegateCreate(NULL), &tflite::TfLiteVTADelegateDelete);
-        interpreter->ModifyGraphWithDelegate(std::move(delegate));
+        // offload only the nodes that are estimated to run faster on VTA
+        tflite::VTACostModelOptions costoptions;
+        costoptions.enabled = true;
+        costoptions.calibrate = true;
+        std::unique_ptr<TfLiteDelegate, decltype(&tflite::TfLiteVTADelegateDelete)> delegate(tflite::TfLiteVTADelegateCreate(NULL, &costoptions), &tflite::TfLiteVTADelegateDelete);
+        if (interpreter->ModifyGraphWithDelegate(std::move(delegate)) != kTfLiteOk)
+        {
+            spdlog::error("Failed to apply VTA delegate");
+            return nullptr;
+        }
     }
 
-    // Resize input tensors, if desired.
-    interpreter->AllocateTensors();
+    // XNNPACK is applied after VTA, so it takes only the nodes left on the CPU
+    if (config.use_xnnpack) {
+        TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
+        xnnpack_options.num_threads = config.num_threads;
+#ifdef TFLITE_XNNPACK_DELEGATE_FLAG_QS8
+        xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QS8;
+#endif
+#ifdef TFLITE_XNNPACK_DELEGATE_FLAG_QU8
+        xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QU8;
+#endif
+        std::unique_ptr<TfLiteDelegate, decltype(&TfLiteXNNPackDelegateDelete)> xnnpack(TfLiteXNNPackDelegateCreate(&xnnpack_options), &TfLiteXNNPackDelegateDelete);
+        if (interpreter->ModifyGraphWithDelegate(std::move(xnnpack)) != kTfLiteOk) {
+            spdlog::warn("Failed to apply XNNPACK delegate, using built-in kernels");
+        }
+    }
+
+    if (interpreter->AllocateTensors() != kTfLiteOk)
+    {
+        spdlog::error("Failed to allocate tensors");
+        return nullptr;
+    }
+
+    // Tensors can be bound to the caller's buffers only if each of them occupies a contiguous region,
+    // which is not the case for batched requests with multiple inputs (or outputs)
+    resident->bind_inputs = batch == 1 || interpreter->inputs().size() == 1;
+    resident->bind_outputs = batch == 1 || interpreter->outputs().size() == 1;
+    if (resident->bind_inputs)
+    {
+        resident->input_scratch.resize(tensors_bytes(interpreter.get(), interpreter->inputs()));
+        bind_tensors(interpreter.get(), interpreter->inputs(), nullptr, 0, resident->input_scratch);
+    }
+    if (resident->bind_outputs)
+    {
+        resident->output_scratch.resize(tensors_bytes(interpreter.get(), interpreter->outputs()));
+        bind_tensors(interpreter.get(), interpreter->outputs(), nullptr, 0, resident->output_scratch);
+    }
+    if ((resident->bind_inputs || resident->bind_outputs) && interpreter->AllocateTensors() != kTfLiteOk)
+    {
+        spdlog::error("Failed to allocate tensors bound to scratch buffers");
+        return nullptr;
+    }
+
+    // model buffer and all tensors, delegate-internal buffers are not accounted for
+    resident->footprint = resident->model_data.size();
+    for (size_t i = 0; i < interpreter->tensors_size(); i++)
+    {
+        resident->footprint += interpreter->tensor(i)->bytes;
+    }
+    return resident;
+}
+
+/**
+ * Returns the interpreter for the model from the resident model cache, building it on a miss.
+ *
+ * Least recently used interpreters are dropped when the cache exceeds its memory budget.
+ * Interpreters still in use by other calls stay alive until those calls finish.
+ */
+static std::shared_ptr<resident_model> get_resident_model(const char *model_buf, int model_len, int input_len, bool with_vta, int batch)
+{
+    using lru_list = std::list<std::pair<resident_model_key, std::shared_ptr<resident_model>>>;
+    static std::mutex cache_mutex;
+    static lru_list lru;
+    static std::map<resident_model_key, lru_list::iterator> cache;
+    static size_t cache_size = 0;
+
+    const size_t budget = get_model_cache_budget();
+    if (budget == 0)
+    {
+        return build_resident_model(model_buf, model_len, input_len, with_vta, batch);
+    }
+
+    const resident_model_key key{model_hash(model_buf, model_len), model_len, with_vta, batch, batch == 0 ? input_len : 0};
 
-    size_t offset = 0;
-    for (unsigned int i = 0; i < interpreter->inputs().size(); i++)
     {
-        auto in = interpreter->input_tensor(i);
-        if (offset + in->bytes > input_len)
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto cached = cache.find(key);
+        if (cached != cache.end())
         {
-            spdlog::warn("Input buffer length mismatch: {} != {}", input_len, offset + in->bytes);
+            lru.splice(lru.begin(), lru, cached->second);
+            spdlog::debug("Using resident interpreter for model {:016x}", key.hash);
+            return cached->second->second;
         }
-        std::copy(input_buf + offset, input_buf + offset + in->bytes, interpreter->typed_input_tensor<int8_t>(i));
-        offset += in->bytes;
     }
 
+    // models are built outside of the lock, as building runs delegate preparation
+    auto resident = build_resident_model(model_buf, model_len, input_len, with_vta, batch);
+    if (!resident)
+    {
+        return nullptr;
+    }
+    if (resident->footprint > budget)
+    {
+        spdlog::debug("Model {:016x} ({} bytes) exceeds the resident model cache", key.hash, resident->footprint);
+        return resident;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto cached = cache.find(key);
+    if (cached != cache.end())
+    {
+        // built concurrently by another call
+        lru.splice(lru.begin(), lru, cached->second);
+        return cached->second->second;
+    }
+    while (!lru.empty() && cache_size + resident->footprint > budget)
+    {
+        auto &evicted = lru.back();
+        spdlog::debug("Evicting resident interpreter for model {:016x}", evicted.first.hash);
+        cache_size -= evicted.second->footprint;
+        cache.erase(evicted.first);
+        lru.pop_back();
+    }
+    lru.emplace_front(key, resident);
+    cache[key] = lru.begin();
+    cache_size += resident->footprint;
+    return resident;
+}
+
+/**
+ * Runs the TFLite model on inputs from the input buffer and writes outputs to the output buffer.
+ *
+ * With batch > 1, the batch dimension of all inputs is multiplied by batch, so several requests are
+ * processed by a single Invoke. The input buffer holds inputs of consecutive requests one after another
+ * (all inputs of the first request, then all inputs of the second one, etc.), outputs are written the same way.
+ * With batch == 0, the number of requests is derived from input_len.
+ *
+ * Interpreters are kept resident between calls, so repeated calls with the same model only copy data and invoke.
+ * Input and output tensors are bound directly to the buffers when their regions are aligned to tensor_alignment,
+ * so the data is not copied at all (the host should pad the model to a multiple of tensor_alignment for that).
+ */
+static void tflite_handler(char *model_buf, char *input_buf, char *output_buf, int model_len, int input_len, int output_len, bool with_vta, int batch = 1)
+{
+    struct timespec ts[2];
+
+    // thread pools are created while building the interpreter (XNNPACK) and on the first Invoke (TFLite kernels)
+    unpinned_scope unpinned(get_cpu_exec_config().num_threads > 1);
+
+    vm_set_error(VM_OK);
+
+    std::shared_ptr<resident_model> resident = get_resident_model(model_buf, model_len, input_len, with_vta, batch);
+    if (!resident)
+    {
+        vm_set_error(VM_ETFLITE);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(resident->mutex);
+    tflite::Interpreter *interpreter = resident->interpreter.get();
+    batch = resident->batch;
+
+    // Tensors bound to the caller's buffers are read and written in place, others go through copies
+    bool direct_inputs = false;
+    bool direct_outputs = false;
+    if (resident->bind_inputs)
+    {
+        direct_inputs = bind_tensors(interpreter, interpreter->inputs(), input_buf, input_len, resident->input_scratch);
+    }
+    if (resident->bind_outputs)
+    {
+        direct_outputs = bind_tensors(interpreter, interpreter->outputs(), output_buf, output_len, resident->output_scratch);
+    }
+    if ((resident->bind_inputs || resident->bind_outputs) && interpreter->AllocateTensors() != kTfLiteOk)
+    {
+        spdlog::error("Failed to allocate tensors bound to the job buffers");
+        vm_set_error(VM_ETFLITE);
+        return;
+    }
+    spdlog::debug("Zero-copy inputs: {}, outputs: {}", direct_inputs, direct_outputs);
+
+    if (resident->bind_inputs && !direct_inputs)
+    {
+        const size_t len = resident->input_scratch.size;
+        if (len > static_cast<size_t>(input_len))
+        {
+            spdlog::warn("Input buffer length mismatch: {} != {}", input_len, len);
+        }
+        std::copy(input_buf, input_buf + std::min(len, static_cast<size_t>(input_len)), resident->input_scratch.data.get());
+    }
+    else if (!resident->bind_inputs)
+    {
+        // bytes of all inputs are divided equally between requests
+        size_t offset = 0;
+        for (int request = 0; request < batch; request++)
+        {
+            for (unsigned int i = 0; i < interpreter->inputs().size(); i++)
+            {
+                auto in = interpreter->input_tensor(i);
+                const size_t len = in->bytes / batch;
+                if (offset + len > input_len)
+                {
+                    spdlog::warn("Input buffer length mismatch: {} != {}", input_len, offset + len);
+                }
+                std::copy(input_buf + offset, input_buf + offset + len, interpreter->typed_input_tensor<int8_t>(i) + request * len);
+                offset += len;
+            }
+        }
+    }
+
+    // stopping the accelerator job aborts the invocation between nodes
+    interpreter->SetCancellationFunction(nullptr, [](void *) { return vm_cancel_requested(); });
+
     timespec_get(&ts[0], TIME_UTC);
-    interpreter->Invoke();
+    const TfLiteStatus status = interpreter->Invoke();
     timespec_get(&ts[1], TIME_UTC);
 
+    if (status != kTfLiteOk)
+    {
+        spdlog::warn("Model processing {}", vm_cancel_requested() ? "cancelled" : "failed");
+        vm_set_error(VM_ETFLITE);
+        return;
+    }
+
 #ifdef DEBUG
     const uint64_t duration = (ts[1].tv_sec * 1000000000 + ts[1].tv_nsec) - (ts[0].tv_sec * 1000000000 + ts[0].tv_nsec);
     spdlog::debug("Model processing took {} ns", duration);
 #endif
 
-    offset = 0;
-    for (unsigned int i = 0; i < interpreter->outputs().size(); i++)
+    if (resident->bind_outputs && !direct_outputs)
     {
-        auto out = interpreter->output_tensor(i);
-        if (offset + out->bytes > output_len)
+        const size_t len = resident->output_scratch.size;
+        if (len > static_cast<size_t>(output_len))
         {
-            spdlog::warn("Output buffer length mismatch: {} != {}", output_len, offset + out->bytes);
+            spdlog::warn("Output buffer length mismatch: {} != {}", output_len, len);
+        }
+        std::copy(resident->output_scratch.data.get(), resident->output_scratch.data.get() + std::min(len, static_cast<size_t>(output_len)), output_buf);
+    }
+    else if (!resident->bind_outputs)
+    {
+        size_t offset = 0;
+        for (int request = 0; request < batch; request++)
+        {
+            for (unsigned int i = 0; i < interpreter->outputs().size(); i++)
+            {
+                auto out = interpreter->output_tensor(i);
+                const size_t len = out->bytes / batch;
+                if (offset + len > output_len)
+                {
+                    spdlog::warn("Output buffer length mismatch: {} != {}", output_len, offset + len);
+                }
+                std::copy(interpreter->typed_output_tensor<int8_t>(i) + request * len, interpreter->typed_output_tensor<int8_t>(i) + (request + 1) * len, output_buf + offset);
+                offset += len;
+            }
         }
-        std::copy(interpreter->typed_output_tensor<int8_t>(i), interpreter->typed_output_tensor<int8_t>(i) + out->bytes, output_buf + offset);
-        offset += out->bytes;
     }
 }
 
@@ -92,3 +558,19 @@ void vm_tflite_vta(char *ibuf, char *obuf, int isize, int osize, int model_size)
 
     tflite_handler(model_buf, input_buf, obuf, model_size, isize, osize, true);
 }
+
+void vm_tflite_apu_batch(char *ibuf, char *obuf, int isize, int osize, int model_size)
+{
+    char *model_buf = ibuf;
+    char *input_buf = ibuf+model_size;
+
+    tflite_handler(model_buf, input_buf, obuf, model_size, isize, osize, false, 0);
+}
+
+void vm_tflite_vta_batch(char *ibuf, char *obuf, int isize, int osize, int model_size)
+{
+    char *model_buf = ibuf;
+    char *input_buf = ibuf+model_size;
+
+    tflite_handler(model_buf, input_buf, obuf, model_size, isize, osize, true, 0);
+}
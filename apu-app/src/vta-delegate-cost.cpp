@@ -0,0 +1,246 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <vta-delegate.hpp>
+
+#include "vta/vta_runtime.h"
+#include "vta/hw_spec_const.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <numeric>
+
+namespace tflite
+{
+
+namespace
+{
+
+constexpr double inpbytes = VTA_INP_WIDTH / 8.0;
+constexpr double wgtbytes = VTA_WGT_WIDTH / 8.0;
+constexpr double accbytes = VTA_ACC_WIDTH / 8.0;
+constexpr double outbytes = VTA_OUT_WIDTH / 8.0;
+
+/**
+ * Rounds value up to the multiple of the given block size.
+ */
+int64_t roundUp(int64_t value, int64_t block)
+{
+    return (value + block - 1) / block * block;
+}
+
+/**
+ * Returns the dimension of the tensor, or 1 if tensor has fewer dimensions.
+ */
+int64_t tensorDim(const TfLiteTensor &tensor, int axis)
+{
+    return axis < tensor.dims->size ? tensor.dims->data[axis] : 1;
+}
+
+/**
+ * Returns the number of multiply-accumulates performed by the CONV2D node.
+ *
+ * Output tensor is in NHWC layout, filter tensor is in OHWI layout.
+ *
+ * @param padchannels if true, channels are rounded up to VTA block sizes
+ */
+int64_t conv2DMACs(const TfLiteNode *node, TfLiteContext *context, bool padchannels)
+{
+    const TfLiteTensor &output = context->tensors[node->outputs->data[0]];
+    const TfLiteTensor &filter = context->tensors[node->inputs->data[1]];
+    int64_t outchannels = tensorDim(filter, 0);
+    int64_t inpchannels = tensorDim(filter, 3);
+    if (padchannels)
+    {
+        outchannels = roundUp(outchannels, VTA_BLOCK_OUT);
+        inpchannels = roundUp(inpchannels, VTA_BLOCK_IN);
+    }
+    return tensorDim(output, 0) * tensorDim(output, 1) * tensorDim(output, 2) *
+        outchannels * tensorDim(filter, 1) * tensorDim(filter, 2) * inpchannels;
+}
+
+/**
+ * Values measured by calibrateVTACostParameters.
+ */
+struct MeasuredThroughputs
+{
+    double dmabytesperus = 0.0;
+    double layoutelementsperus = 0.0;
+    double cpumacsperus = 0.0;
+    double cpualuopsperus = 0.0;
+};
+
+/**
+ * Runs the function given number of times and returns the time per run in microseconds.
+ */
+template <typename F>
+double measure(int iterations, F function)
+{
+    auto t1 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        function();
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::micro> time = t2 - t1;
+    return std::max(time.count() / iterations, std::numeric_limits<double>::min());
+}
+
+MeasuredThroughputs measureThroughputs()
+{
+    constexpr size_t buffersize = 1 << 20;
+    constexpr size_t numelements = 1 << 16;
+    constexpr int iterations = 8;
+
+    MeasuredThroughputs measured;
+
+    // host <-> CMA copies
+    auto commcontext = VTADelegateKernel::getCommunicationContext();
+    std::vector<uint8_t> hostbuffer(buffersize, 1);
+    double copytime;
+    {
+        std::lock_guard<std::mutex> lock(VTADelegateKernel::getDeviceMutex());
+        void *vtabuffer = VTABufferAlloc(buffersize);
+        copytime = measure(iterations, [&]()
+        {
+            VTABufferCopy(hostbuffer.data(), 0, vtabuffer, 0, buffersize, VTA_MEMCPY_H2D);
+            VTABufferCopy(vtabuffer, 0, hostbuffer.data(), 0, buffersize, VTA_MEMCPY_D2H);
+        });
+        VTABufferFree(vtabuffer);
+    }
+    measured.dmabytesperus = 2 * buffersize / copytime;
+
+    std::vector<int8_t> a(numelements);
+    std::vector<int8_t> b(numelements);
+    std::vector<int32_t> acc(numelements);
+    std::iota(a.begin(), a.end(), 0);
+    std::iota(b.begin(), b.end(), 3);
+
+    // quantization of inputs, as done by VTA operators before upload
+    QuantizationData qdata;
+    computeQuantizationParameters(0.75, qdata.multiplier, qdata.shift);
+    double layouttime = measure(iterations, [&]()
+    {
+        std::transform(a.cbegin(), a.cend(), acc.begin(), [&qdata](int8_t val) { return simulateRealValue(val, qdata); });
+    });
+    measured.layoutelementsperus = numelements / layouttime;
+
+    // quantized element-wise ADD - two rescales and requantization per element
+    double alutime = measure(iterations, [&]()
+    {
+        for (size_t i = 0; i < numelements; i++)
+        {
+            a[i] = requantizeResults(simulateRealValue(a[i], qdata) + simulateRealValue(b[i], qdata), qdata);
+        }
+    });
+    measured.cpualuopsperus = numelements / alutime;
+
+    // INT8 multiply-accumulate
+    double mactime = measure(iterations, [&]()
+    {
+        for (size_t i = 0; i < numelements; i++)
+        {
+            acc[i] += static_cast<int32_t>(a[i]) * static_cast<int32_t>(b[i]);
+        }
+    });
+    measured.cpumacsperus = numelements / mactime;
+
+    volatile int32_t sink = std::accumulate(acc.begin(), acc.end(), 0);
+    (void)sink;
+
+    spdlog::info(
+        "VTA cost model calibration: DMA {} B/us, layout {} elem/us, CPU {} MAC/us, CPU {} ALU op/us",
+        measured.dmabytesperus,
+        measured.layoutelementsperus,
+        measured.cpumacsperus,
+        measured.cpualuopsperus
+    );
+    return measured;
+}
+
+};
+
+double VTACostModel::cpuCost(const TfLiteRegistration *registration, const TfLiteNode *node, TfLiteContext *context) const
+{
+    switch (registration->builtin_code)
+    {
+        case kTfLiteBuiltinAdd:
+            return NumElements(&context->tensors[node->outputs->data[0]]) / parameters.cpualuopsperus;
+        case kTfLiteBuiltinConv2d:
+            return conv2DMACs(node, context, false) / parameters.cpumacsperus;
+        default:
+            return 0.0;
+    }
+}
+
+double VTACostModel::vtaCost(const TfLiteRegistration *registration, const TfLiteNode *node, TfLiteContext *context) const
+{
+    switch (registration->builtin_code)
+    {
+        case kTfLiteBuiltinAdd:
+        {
+            const TfLiteTensor &input = context->tensors[node->inputs->data[0]];
+            const double numelements = NumElements(&context->tensors[node->outputs->data[0]]);
+            // INT8 inputs are rescaled to the accumulator width on the CPU, outputs are requantized
+            const double layoutelements = (input.type == kTfLiteInt8 ? 2 * numelements : 0.0) + numelements;
+            // two inputs and the zeroed output are uploaded, the output is downloaded
+            const double dmabytes = numelements * (2 * accbytes + 2 * outbytes);
+            return parameters.nodeoverhead +
+                layoutelements / parameters.layoutelementsperus +
+                dmabytes / parameters.dmabytesperus +
+                numelements / parameters.vtaaluopsperus;
+        }
+        case kTfLiteBuiltinConv2d:
+        {
+            const TfLiteTensor &input = context->tensors[node->inputs->data[0]];
+            const TfLiteTensor &filter = context->tensors[node->inputs->data[1]];
+            const TfLiteTensor &output = context->tensors[node->outputs->data[0]];
+            const double inputelements = NumElements(&input);
+            const double filterelements = NumElements(&filter);
+            const double outputelements = NumElements(&output);
+            // input and filter are permuted to VTA layouts, outputs are requantized and permuted back
+            const double layoutelements = inputelements + filterelements + outputelements;
+            const double dmabytes =
+                inputelements * inpbytes +
+                filterelements * wgtbytes +
+                tensorDim(filter, 0) * accbytes +
+                outputelements * outbytes;
+            return parameters.nodeoverhead +
+                layoutelements / parameters.layoutelementsperus +
+                dmabytes / parameters.dmabytesperus +
+                conv2DMACs(node, context, true) / parameters.vtamacsperus;
+        }
+        default:
+            return std::numeric_limits<double>::infinity();
+    }
+}
+
+VTACostParameters calibrateVTACostParameters(const VTACostParameters &base)
+{
+    static std::mutex calibrationmutex;
+    static bool calibrated = false;
+    static MeasuredThroughputs measured;
+
+    std::lock_guard<std::mutex> lock(calibrationmutex);
+    if (!calibrated)
+    {
+        measured = measureThroughputs();
+        calibrated = true;
+    }
+
+    VTACostParameters parameters = base;
+    parameters.dmabytesperus = measured.dmabytesperus;
+    parameters.layoutelementsperus = measured.layoutelementsperus;
+    parameters.cpumacsperus = measured.cpumacsperus;
+    parameters.cpualuopsperus = measured.cpualuopsperus;
+    return parameters;
+}
+
+};
@@ -12,10 +12,13 @@
 #include "vta/hw_spec_const.h"
 #include "tensorflow/lite/kernels/internal/tensor_ctypes.h"
 #include "tensorflow/lite/kernels/internal/quantization_util.h"
+#include "tensorflow/lite/kernels/padding.h"
+#include "tensorflow/lite/c/builtin_op_data.h"
 #include <spdlog/spdlog.h>
 
 #include <algorithm>
 #include <cmath>
+#include <tuple>
 
 #define NUM_THREADS 2
 #define VTA_UOP_GEMM 0
@@ -596,8 +599,8 @@ TfLiteStatus VTAALUOp::aluAdd()
 TfLiteStatus VTAGEMMOp::gemmConv2D()
 {
     // The convolution can be described with the following parameters:
-    // * padding - TODO
-    // * stride - TODO
+    // * padding - zero-padding added around input's height and width (SAME/VALID in TFLite)
+    // * stride - step of the kernel along input's height and width
     // * N - batch size
     // * H - input tensor height
     // * W - input tensor width
@@ -661,11 +664,13 @@ TfLiteStatus VTAGEMMOp::gemmConv2D()
     setDim("Ii", VTA_BLOCK_IN); // input channel inner loop
     setDim("Oi", VTA_BLOCK_OUT); // output channel inner loop
 
-    // FIXME set padding and stride according to TFLite model
-    setDim("paddingH", 0); // height padding
-    setDim("paddingW", 0); // width padding
-    setDim("strideH", 1); // height stride
-    setDim("strideW", 1); // width stride
+    // Padding and stride come from the TFLite node parameters.
+    // The padding is not materialized in DRAM - it is applied by the VTA load unit
+    // (x_pad_before/x_pad_after/y_pad_before/y_pad_after in VTALoadBuffer2D)
+    if (setConvParams() != kTfLiteOk)
+    {
+        return kTfLiteDelegateError;
+    }
 
     // Compute working dimensions for VTA
     // TODO consider dimensions not divisible by below dimensions (TVM adds padding)
@@ -677,7 +682,7 @@ TfLiteStatus VTAGEMMOp::gemmConv2D()
     setDim("Ialigned", dim("Io") * dim("Ii"));
     setDim("Oaligned", dim("Oo") * dim("Oi"));
 
-    setDim("Wpadded", dim("W") + 2 * dim("paddingW"));
+    setDim("Wpadded", dim("W") + dim("paddingW") + dim("paddingWafter"));
 
     std::vector<uint8_t> tmparray(tensorElements({"Naligned", "Ialigned", "H", "W"}));
 
@@ -750,47 +755,40 @@ TfLiteStatus VTAGEMMOp::gemmConv2D()
     // We need to match certain constraints of
     // - inputs' SRAM (input tensors go here)
     // - weights' SRAM (weights go here)
-    // - accumulator SRAM (outputs and bias go here)
+    // - accumulator SRAM (outputs, bias, multipliers and shifts go here)
+    // - micro-op SRAM (GEMM kernel holds micro-ops for all input channels, kernel positions and columns of a tile)
     //
-    // Currently, we will split:
-    // * input tensors along height
-    // * weight tensors along number of kernels / no. output channels
-    // * output tensors along height
-    // * biases along number of kernels / no. output channels
-
-    // compute maximum number of rows that can be fitted at once in SRAM
-    // For now, we should be able to load at least W x Hk x I elements into memory (times NUM_THREADS for latency hiding)
-    // TODO add splitting along width?
-    const int maxinprows = static_cast<int>(std::floor(static_cast<float>(VTA_INP_BUFF_DEPTH) / static_cast<float>(dim("Wpadded"))));
-    // maximum number of output channels depends on how many Wk x Hk x Io kernels we can fit in the WGT buffer
-    // TODO introduce more granularity
-    const int maxoutchannels = static_cast<int>(std::floor(static_cast<float>(VTA_WGT_BUFF_DEPTH) / static_cast<float>(dim("Io") * dim("Wk") * dim("Hk"))));
-    // The ACC SRAM needs to fit several things in it - intermediate outputs, bias, per-channel multipliers and shifts.
-    const int maxoutrows = static_cast<int>(std::floor(static_cast<float>(VTA_ACC_BUFF_DEPTH) / static_cast<float>(maxoutchannels * dim("Wo") + 3 * maxoutchannels)));
-    bool storefailure = false;
-    if (maxinprows == 0)
-    {
-        spdlog::critical("Cannot fit a single input row:  VTA_INP_BUFF_DEPTH={}, tensor to store=[{}+2*{}]", VTA_INP_BUFF_DEPTH, dim("W"), dim("paddingW"));
-        storefailure = true;
-    }
-    if (maxinprows < dim("Hk"))
-    {
-        spdlog::critical("Cannot fit at least {0} input rows to input buffer to correctly compute convolution for kernel height {0}", dim("Hk"));
-        spdlog::critical("VTA_INP_BUFFER_DEPTH={}, minimal tensor to store=[{}*({}+2*{})]", VTA_INP_BUFF_DEPTH, dim("Hk"), dim("W"), dim("paddingW"));
-        storefailure = true;
-    }
-    if (maxoutchannels == 0)
-    {
-        spdlog::critical("Cannot fit a single convolution kernel:  VTA_WGT_BUFF_DEPTH={}, tensor to store=[{}x{}x{}x{}]", VTA_WGT_BUFF_DEPTH, dim("Hk"), dim("Wk"), dim("Oi"), dim("Ii"));
-        storefailure = true;
-    }
-    if (maxoutrows == 0)
-    {
-        spdlog::critical("Cannot fit a single output row:  VTA_ACC_BUFF_DEPTH={}, tensor to store=[{}x{}x{}+{}]", VTA_ACC_BUFF_DEPTH, dim("Oo"), dim("Wo"), dim("Oi"), dim("O"));
-        storefailure = true;
-    }
-    if (storefailure)
+    // The tiling planner splits:
+    // * output tensors along output channels, height and width
+    // * input tensors along height and width (with the halo required by the kernel) and input channels
+    // * weight tensors along output and input channels
+    // * biases along output channels
+    // and selects the order of tile loops that reloads less data from DRAM.
+    VTAConv2DShape shape;
+    shape.No = dim("No");
+    shape.H = dim("H");
+    shape.W = dim("W");
+    shape.Io = dim("Io");
+    shape.Oo = dim("Oo");
+    shape.Hk = dim("Hk");
+    shape.Wk = dim("Wk");
+    shape.Ho = dim("Ho");
+    shape.Wo = dim("Wo");
+    shape.strideH = dim("strideH");
+    shape.strideW = dim("strideW");
+    const VTAConv2DTiling tiling = planConv2DTiling(shape);
+    if (!tiling.valid())
     {
+        spdlog::critical(
+            "Cannot fit a single CONV2D tile:  VTA_INP_BUFF_DEPTH={}, VTA_WGT_BUFF_DEPTH={}, VTA_ACC_BUFF_DEPTH={}, kernel=[{}x{}x{}x{}]",
+            VTA_INP_BUFF_DEPTH,
+            VTA_WGT_BUFF_DEPTH,
+            VTA_ACC_BUFF_DEPTH,
+            dim("Hk"),
+            dim("Wk"),
+            dim("Oi"),
+            dim("Ii")
+        );
         return TfLiteStatus::kTfLiteDelegateError;
     }
 
@@ -811,30 +809,33 @@ TfLiteStatus VTAGEMMOp::gemmConv2D()
     VTABufferCopy(multipliers.data(), 0, multiplierbuf, 0, sizeof(int32_t) * dim("Oaligned"), VTA_MEMCPY_H2D);
     VTABufferCopy(shifts.data(), 0, shiftbuf, 0, sizeof(int32_t) * dim("Oaligned"), VTA_MEMCPY_H2D);
 
-    VTADepPush(cmd, vta::kComputeStage, vta::kLoadStage);
-    VTADepPush(cmd, vta::kStoreStage, vta::kComputeStage);
-    // Sync for finishing the processing
-    // VTADepPush(cmd, vta::kStoreStage, vta::kComputeStage);
-
-    // Sync for fetching the data
-    // VTADepPush(cmd, vta::kStoreStage, vta::kComputeStage);
-
-    // The looping below does not perform computations, only creates commands that
-    // are executed asynchronously
-
-    // Virtual threads for latency hiding
-    // const int vthreads = NUM_THREADS;
-
-    // Maximum number of rows that can be processed is limited by either INP or ACC SRAM
-    const int maxnumrows = std::min(maxinprows, maxoutrows);
-
-    const int numthreads = maxnumrows / NUM_THREADS > 0 ? NUM_THREADS : 1;
-
-    const int rowsperthread = maxnumrows / numthreads;
-
-    const int numrows = dim("Ho");
-
-    const int numoutputchannels = dim("Oo");
+    // Tiles are enumerated in the order selected by the planner.
+    // Each tile is identified by its first batch block, first output channel block, first output row and first output column.
+    // Batch blocks are the innermost tile loop in the weight-stationary order, so the weights are reused across the batch.
+    struct Tile
+    {
+        int batchid;
+        int ochanid;
+        int rowid;
+        int colid;
+    };
+    std::vector<Tile> tiles;
+    if (tiling.order == VTATileOrder::WeightStationary)
+    {
+        for (int ochanid = 0; ochanid < dim("Oo"); ochanid += tiling.ocblocks)
+            for (int rowid = 0; rowid < dim("Ho"); rowid += tiling.rows)
+                for (int colid = 0; colid < dim("Wo"); colid += tiling.cols)
+                    for (int batchid = 0; batchid < dim("No"); batchid += tiling.batches)
+                        tiles.push_back({batchid, ochanid, rowid, colid});
+    }
+    else
+    {
+        for (int batchid = 0; batchid < dim("No"); batchid += tiling.batches)
+            for (int rowid = 0; rowid < dim("Ho"); rowid += tiling.rows)
+                for (int colid = 0; colid < dim("Wo"); colid += tiling.cols)
+                    for (int ochanid = 0; ochanid < dim("Oo"); ochanid += tiling.ocblocks)
+                        tiles.push_back({batchid, ochanid, rowid, colid});
+    }
 
     const int kernelsize = tensorElements({"Hk", "Wk"});
 
@@ -842,47 +843,56 @@ TfLiteStatus VTAGEMMOp::gemmConv2D()
 
     const int singleinputsize = tensorElements({"H", "W", "Io"});
 
-    const int singleinputsizepadded = tensorElements({"H", "Wpadded", "Io"});
-
     const int singleoutputsize = tensorElements({"Ho", "Wo", "Oo"});
     const int singleoutputchannelsize = tensorElements({"Ho", "Wo"});
 
-    const int singleinputchannelsize = tensorElements({"H", "Wpadded"});
+    // input in DRAM is not padded, padding is introduced only in INP SRAM
+    const int singleinputchannelsize = tensorElements({"H", "W"});
+
+    // ACC holds biases, multipliers and shifts for tiling.ocblocks channels blocks, followed by outputs
+    const int biasmultiplieraccshift = 3 * tiling.ocblocks;
+
+    VTADepPush(cmd, vta::kComputeStage, vta::kLoadStage);
+    VTADepPush(cmd, vta::kStoreStage, vta::kComputeStage);
 
-    const int biasmultiplieraccshift = 3 * maxoutchannels;
+    // The looping below does not perform computations, only creates commands that
+    // are executed asynchronously
 
-    // let's iterate over samples
-    for (int No = 0; No < dim("No"); No++)
+    // parts of tensors that are currently held in SRAMs, used to skip redundant loads
+    int loadedbias = -1;
+    std::tuple<int, int> loadedwgt = {-1, -1};
+    std::tuple<int, int, int, int> loadedinp = {-1, -1, -1, -1};
+    for (const auto &tile : tiles)
     {
-        VTADepPush(cmd, vta::kComputeStage, vta::kLoadStage);
-        int outdatashift = 0;
-        // let's compute output channel per output channel
-        for (int ochanid = 0; ochanid < numoutputchannels; ochanid++) // += maxoutchannels
+        // tiles at the end of the tensor can be smaller
+        const int currbatches = std::min(dim("No") - tile.batchid, tiling.batches);
+        const int curroutchannels = std::min(dim("Oo") - tile.ochanid, tiling.ocblocks);
+        const int rowstoprocess = std::min(dim("Ho") - tile.rowid, tiling.rows);
+        const int colstoprocess = std::min(dim("Wo") - tile.colid, tiling.cols);
+        // first input row and column (in unpadded coordinates) and the input window required by the tile
+        const int inrowstart = tile.rowid * dim("strideH") - dim("paddingH");
+        const int incolstart = tile.colid * dim("strideW") - dim("paddingW");
+        const int inrows = (rowstoprocess - 1) * dim("strideH") + dim("Hk");
+        const int incols = (colstoprocess - 1) * dim("strideW") + dim("Wk");
+        // padding parameters - rows and columns outside of the input tensor are zero-filled by the load unit
+        const int ypadbefore = std::max(0, -inrowstart);
+        const int ypadafter = std::max(0, inrowstart + inrows - dim("H"));
+        const int xpadbefore = std::max(0, -incolstart);
+        const int xpadafter = std::max(0, incolstart + incols - dim("W"));
+        const int rowstoload = inrows - ypadbefore - ypadafter;
+        const int colstoload = incols - xpadbefore - xpadafter;
+        // outputs of a single batch block for a single output channel block in ACC
+        const int outputtilesize = rowstoprocess * colstoprocess;
+
+        // wait for the store of the previous tile to release the OUT SRAM
+        VTADepPop(cmd, vta::kStoreStage, vta::kComputeStage);
+        if (loadedbias != tile.ochanid)
         {
-            // compute number of output kernels that will be loaded to WGT SRAM
-            int curroutchannels = std::min(numoutputchannels - ochanid, maxoutchannels);
-            // pop kernel dependency TODO
-            // copy weights to WGT SRAM
-            VTADepPop(cmd, vta::kComputeStage, vta::kLoadStage);
-            VTALoadBuffer2D(
-                cmd,                                    // cmd
-                wgtbuf,                                 // src_dram_addr
-                ochanid * kernelparamsperoutputchannel, // src_elem_offset
-                curroutchannels * kernelsize,           // x_size
-                dim("Io"),                              // y_size
-                1,                                      // x_stride
-                0,                                      // x_pad_before
-                0,                                      // y_pad_before
-                0,                                      // x_pad_after
-                0,                                      // y_pad_after
-                biasmultiplieraccshift,                 //dst_sram_index
-                VTA_MEM_ID_WGT                          // dst_memory_type
-            );
-            // copy bias, multiplier and shift to ACC SRAM (we store it in 0-index of ACC)
+            // copy bias, multiplier and shift to ACC SRAM (bias is stored in 0-index of ACC)
             VTALoadBuffer2D(
                 cmd,             // cmd
                 biasbuf,         // src_dram_addr
-                ochanid,         // src_elem_offset
+                tile.ochanid,    // src_elem_offset
                 curroutchannels, // x_size
                 1,               // y_size
                 1,               // x_stride
@@ -896,7 +906,7 @@ TfLiteStatus VTAGEMMOp::gemmConv2D()
             VTALoadBuffer2D(
                 cmd,             // cmd
                 multiplierbuf,   // src_dram_addr
-                ochanid,         // src_elem_offset
+                tile.ochanid,    // src_elem_offset
                 curroutchannels, // x_size
                 1,               // y_size
                 1,               // x_stride
@@ -904,215 +914,226 @@ TfLiteStatus VTAGEMMOp::gemmConv2D()
                 0,               // y_pad_before
                 0,               // x_pad_after
                 0,               // y_pad_after
-                maxoutchannels,  //dst_sram_index
+                tiling.ocblocks, //dst_sram_index
                 VTA_MEM_ID_ACC   // dst_memory_type
             );
             VTALoadBuffer2D(
-                cmd,                // cmd
-                shiftbuf,           // src_dram_addr
-                ochanid,            // src_elem_offset
-                curroutchannels,    // x_size
-                1,                  // y_size
-                1,                  // x_stride
-                0,                  // x_pad_before
-                0,                  // y_pad_before
-                0,                  // x_pad_after
-                0,                  // y_pad_after
-                maxoutchannels * 2, //dst_sram_index
-                VTA_MEM_ID_ACC      // dst_memory_type
+                cmd,                 // cmd
+                shiftbuf,            // src_dram_addr
+                tile.ochanid,        // src_elem_offset
+                curroutchannels,     // x_size
+                1,                   // y_size
+                1,                   // x_stride
+                0,                   // x_pad_before
+                0,                   // y_pad_before
+                0,                   // x_pad_after
+                0,                   // y_pad_after
+                tiling.ocblocks * 2, //dst_sram_index
+                VTA_MEM_ID_ACC       // dst_memory_type
             );
-            for (int rowid = 0; rowid < numrows; rowid += rowsperthread)
+            loadedbias = tile.ochanid;
+        }
+        // reset the ACC for CONV2D operation
+        // outputs are stored in ACC in [output channel block][batch block][row][column] order
+        auto gemmreset = [biasmultiplieraccshift, currbatches, rowstoprocess, colstoprocess, curroutchannels, outputtilesize](void *signature) -> int {
+            VTAUopLoopBegin(curroutchannels, currbatches * outputtilesize, 0, 0);
+            VTAUopLoopBegin(rowstoprocess, colstoprocess, 0, 0);
+            for (int batch = 0; batch < currbatches; batch++)
             {
-                VTADepPush(cmd, vta::kStoreStage, vta::kComputeStage);
-                // compute input loading parameters
-                // padding parameters
-                int ypadbefore = std::max(0, dim("paddingH") - rowid);
-                int ypadafter = std::max(0, std::min(dim("paddingH"), rowid + rowsperthread - numrows));
-                // TODO verify the end
-                int rowstoprocess = std::min(numrows - rowid, rowsperthread - ypadbefore - ypadafter);
-                // reset the ACC for CONV2D operation TODO add push
-                VTADepPop(cmd, vta::kStoreStage, vta::kComputeStage);
-                auto gemmreset = [biasmultiplieraccshift, rowstoprocess, curroutchannels, Wo=dim("Wo")](void *signature) -> int {
-                    VTAUopLoopBegin(curroutchannels, rowstoprocess * Wo, 0, 0);
-                    VTAUopLoopBegin(rowstoprocess, Wo, 0, 0);
-                    for (int wo = 0; wo < Wo; wo++)
+                for (int wo = 0; wo < colstoprocess; wo++)
+                {
+                    VTAUopPush(
+                        VTA_UOP_GEMM,                                         // mode
+                        1,                                                    // reset_out
+                        biasmultiplieraccshift + batch * outputtilesize + wo, // dst_index
+                        0,                                                    // src_index
+                        0,                                                    // wgt_index
+                        0,                                                    // opcode
+                        0,                                                    // use_imm
+                        0                                                     // imm_val
+                    );
+                }
+            }
+            VTAUopLoopEnd();
+            VTAUopLoopEnd();
+            return 0;
+        };
+        void *reset = nullptr;
+        VTAPushGEMMOp(
+            &reset,
+            gemmreset,
+            nullptr,
+            0
+        );
+        for (int ichanid = 0; ichanid < dim("Io"); ichanid += tiling.icblocks)
+        {
+            const int currinchannels = std::min(dim("Io") - ichanid, tiling.icblocks);
+            // input tile of a single batch block for a single input channel block in INP
+            const int inputtilesize = inrows * incols;
+            // wait for the previous GEMM to release INP and WGT SRAMs
+            VTADepPop(cmd, vta::kComputeStage, vta::kLoadStage);
+            if (loadedwgt != std::make_tuple(tile.ochanid, ichanid))
+            {
+                // kernels for consecutive output channels are kernelparamsperoutputchannel apart (Oo Io Hk Wk layout)
+                VTALoadBuffer2D(
+                    cmd,                                                                // cmd
+                    wgtbuf,                                                             // src_dram_addr
+                    tile.ochanid * kernelparamsperoutputchannel + ichanid * kernelsize, // src_elem_offset
+                    currinchannels * kernelsize,                                        // x_size
+                    curroutchannels,                                                    // y_size
+                    kernelparamsperoutputchannel,                                       // x_stride
+                    0,                                                                  // x_pad_before
+                    0,                                                                  // y_pad_before
+                    0,                                                                  // x_pad_after
+                    0,                                                                  // y_pad_after
+                    0,                                                                  //dst_sram_index
+                    VTA_MEM_ID_WGT                                                      // dst_memory_type
+                );
+                loadedwgt = std::make_tuple(tile.ochanid, ichanid);
+            }
+            if (loadedinp != std::make_tuple(tile.batchid, tile.rowid, tile.colid, ichanid))
+            {
+                // inputs are stored in INP in [batch block][input channel block][row][column] order
+                for (int batch = 0; batch < currbatches; batch++)
+                {
+                    for (int icblock = 0; icblock < currinchannels; icblock++)
                     {
-                        VTAUopPush(
-                            VTA_UOP_GEMM,                // mode
-                            1,                           // reset_out
-                            // till curroutchannels we have bias
-                            biasmultiplieraccshift + wo, // dst_index
-                            0,                           // src_index
-                            0,                           // wgt_index
-                            0,                           // opcode
-                            0,                           // use_imm
-                            0                            // imm_val
+                        VTALoadBuffer2D(
+                            cmd,                                                // cmd
+                            inpbuf,                                             // src_dram_addr
+                            (tile.batchid + batch) * singleinputsize +
+                                (ichanid + icblock) * singleinputchannelsize +
+                                std::max(0, inrowstart) * dim("W") +
+                                std::max(0, incolstart),                        // src_elem_offset
+                            colstoload,                                         // x_size
+                            rowstoload,                                         // y_size
+                            dim("W"),                                           // x_stride
+                            xpadbefore,                                         // x_pad_before
+                            ypadbefore,                                         // y_pad_before
+                            xpadafter,                                          // x_pad_after
+                            ypadafter,                                          // y_pad_after
+                            (batch * currinchannels + icblock) * inputtilesize, // dst_sram_index
+                            VTA_MEM_ID_INP                                      // dst_memory_type
                         );
                     }
-                    VTAUopLoopEnd();
-                    VTAUopLoopEnd();
-                    return 0;
-                };
-                void *map = nullptr;
-                VTAPushGEMMOp(
-                    &map,
-                    gemmreset,
-                    nullptr,
-                    0
-                );
-                for (int ichanid = 0; ichanid < dim("Io"); ichanid++)
+                }
+                loadedinp = std::make_tuple(tile.batchid, tile.rowid, tile.colid, ichanid);
+            }
+            VTADepPush(cmd, vta::kLoadStage, vta::kComputeStage);
+            // compute CONV2D on given input channels for all output channels and batch blocks of the tile
+            VTADepPop(cmd, vta::kLoadStage, vta::kComputeStage);
+            // Strides are expressed with uop loop factors and indices:
+            // * consecutive output rows read input rows strideH apart (src_factor of the row loop),
+            // * consecutive output columns read input columns strideW apart (src_index).
+            // The weights loaded for the output channel block are shared by all batch blocks of the tile.
+            auto gemmcomp = [biasmultiplieraccshift, currbatches, curroutchannels, currinchannels, rowstoprocess, colstoprocess, incols, inputtilesize, outputtilesize, Hk=dim("Hk"), Wk=dim("Wk"), strideH=dim("strideH"), strideW=dim("strideW")](void *signature) -> int {
+                VTAUopLoopBegin(curroutchannels, currbatches * outputtilesize, 0, currinchannels * Hk * Wk);
+                VTAUopLoopBegin(rowstoprocess, colstoprocess, incols * strideH, 0);
+                for (int batch = 0; batch < currbatches; batch++)
                 {
-                    VTADepPush(cmd, vta::kComputeStage, vta::kLoadStage);
-                    VTADepPop(cmd, vta::kComputeStage, vta::kLoadStage);
-                    VTALoadBuffer2D(
-                        cmd,                                                                        // cmd
-                        inpbuf,                                                                     // src_dram_addr
-                        No * singleinputsize + ichanid * singleinputchannelsize + rowid * dim("W"), // src_elem_offset
-                        dim("W"),                                                                   // x_size
-                        rowstoprocess,                                                              // y_size
-                        dim("strideW"),                                                             // x_stride
-                        dim("paddingW"),                                                            // x_pad_before
-                        ypadbefore,                                                                 // y_pad_before
-                        dim("paddingW"),                                                            // x_pad_after
-                        ypadafter,                                                                  // x_pad_after
-                        0,                                                                          // dst_sram_index
-                        VTA_MEM_ID_INP                                                              // dst_memory_type
-                    );
-                    VTADepPush(cmd, vta::kLoadStage, vta::kComputeStage);
-                    // compute CONV2D on a given input channels for all available output channels on given rows
-                    VTADepPop(cmd, vta::kLoadStage, vta::kComputeStage);
-                    auto gemmcomp = [biasmultiplieraccshift, curroutchannels, rowstoprocess, Oo=dim("Oo"), Wo=dim("Wo"), rowid, Hk=dim("Hk"), Wk=dim("Wk"), Wpadded=dim("Wpadded")](void *signature) -> int {
-                        VTAUopLoopBegin(curroutchannels, rowstoprocess * Wo, 0, Hk * Wk);
-                        VTAUopLoopBegin(rowstoprocess, Wo, Wpadded, 0);
+                    for (int icblock = 0; icblock < currinchannels; icblock++)
+                    {
                         for (int hk = 0; hk < Hk; hk++)
                         {
                             for (int wk = 0; wk < Wk; wk++)
                             {
-                                for (int wo; wo < Wo; wo++)
+                                for (int wo = 0; wo < colstoprocess; wo++)
                                 {
                                     VTAUopPush(
-                                        VTA_UOP_GEMM,                // mode
-                                        0,                           // reset_out
-                                        biasmultiplieraccshift + wo, // dst_index
-                                        hk * Wpadded + wo + wk,      // src_index
-                                        hk * Wk + wk,                // wgt_index
-                                        0,                           // opcode
-                                        0,                           // use_imm
-                                        0                            // imm_val
+                                        VTA_UOP_GEMM,                                                                         // mode
+                                        0,                                                                                    // reset_out
+                                        biasmultiplieraccshift + batch * outputtilesize + wo,                                 // dst_index
+                                        (batch * currinchannels + icblock) * inputtilesize + hk * incols + wo * strideW + wk, // src_index
+                                        (icblock * Hk + hk) * Wk + wk,                                                        // wgt_index
+                                        0,                                                                                    // opcode
+                                        0,                                                                                    // use_imm
+                                        0                                                                                     // imm_val
                                     );
                                 }
                             }
                         }
-                        VTAUopLoopEnd();
-                        VTAUopLoopEnd();
-                        return 0;
-                    };
-                    void *map = nullptr;
-                    VTAPushGEMMOp(
-                        &map,
-                        gemmcomp,
-                        nullptr,
-                        0
-                    );
-                }
-                // add bias and requantize the outputs
-                auto addbiasfun = [biasmultiplieraccshift, rowstoprocess, curroutchannels, Wo=dim("Wo")](void *signature) -> int {
-                    VTAUopLoopBegin(curroutchannels, rowstoprocess * Wo, 1, 0);
-                    VTAUopLoopBegin(rowstoprocess, Wo, 0, 0);
-                    for (int wo = 0; wo < Wo; wo++)
-                    {
-                        VTAUopPush(
-                            VTA_UOP_ALU,                 // mode
-                            0,                           // reset_out
-                            biasmultiplieraccshift + wo, // dst_index
-                            0,                           // src_index
-                            0,                           // wgt_index
-                            VTA_ALU_OPCODE_ADD,          // opcode
-                            0,                           // use_imm
-                            0                            // imm_val
-                        );
                     }
-                    VTAUopLoopEnd();
-                    VTAUopLoopEnd();
-                    return 0;
-                };
-                void *addbias = nullptr;
-                VTAPushGEMMOp(
-                    &addbias,
-                    addbiasfun,
-                    nullptr,
-                    0
-                );
-                auto multfun = [biasmultiplieraccshift, rowstoprocess, curroutchannels, Wo=dim("Wo"), Oo=dim("Oo")](void *signature) -> int {
-                    VTAUopLoopBegin(curroutchannels, rowstoprocess * Wo, 1, 0);
-                    VTAUopLoopBegin(rowstoprocess, Wo, 0, 0);
-                    for (int wo = 0; wo < Wo; wo++)
-                    {
-                        VTAUopPush(
-                            VTA_UOP_ALU,                 // mode
-                            0,                           // reset_out
-                            biasmultiplieraccshift + wo, // dst_index
-                            Oo,                          // src_index
-                            0,                           // wgt_index
-                            VTA_ALU_OPCODE_MUL,          // opcode
-                            0,                           // use_imm
-                            0                            // imm_val
-                        );
-                    }
-                    VTAUopLoopEnd();
-                    VTAUopLoopEnd();
-                    return 0;
-                };
-                void *mult = nullptr;
-                VTAPushGEMMOp(
-                    &mult,
-                    multfun,
-                    nullptr,
-                    0
-                );
-                auto shrfun = [biasmultiplieraccshift, rowstoprocess, curroutchannels, Wo=dim("Wo"), Oo=dim("Oo")](void *signature) -> int {
-                    VTAUopLoopBegin(curroutchannels, rowstoprocess * Wo, 1, 0);
-                    VTAUopLoopBegin(rowstoprocess, Wo, 0, 0);
-                    for (int wo = 0; wo < Wo; wo++)
+                }
+                VTAUopLoopEnd();
+                VTAUopLoopEnd();
+                return 0;
+            };
+            void *map = nullptr;
+            VTAPushGEMMOp(
+                &map,
+                gemmcomp,
+                nullptr,
+                0
+            );
+            VTADepPush(cmd, vta::kComputeStage, vta::kLoadStage);
+        }
+        // add bias and requantize the outputs
+        // each ALU operation takes its per-channel operand from the start of ACC (bias, multipliers, shifts)
+        const std::vector<std::pair<int, int>> aluops = {
+            {VTA_ALU_OPCODE_ADD, 0},
+            {VTA_ALU_OPCODE_MUL, tiling.ocblocks},
+            {VTA_ALU_OPCODE_SHR, tiling.ocblocks * 2}
+        };
+        for (const auto &aluop : aluops)
+        {
+            auto alufun = [biasmultiplieraccshift, currbatches, rowstoprocess, colstoprocess, curroutchannels, outputtilesize, opcode=aluop.first, srcshift=aluop.second](void *signature) -> int {
+                VTAUopLoopBegin(curroutchannels, currbatches * outputtilesize, 1, 0);
+                VTAUopLoopBegin(rowstoprocess, colstoprocess, 0, 0);
+                for (int batch = 0; batch < currbatches; batch++)
+                {
+                    for (int wo = 0; wo < colstoprocess; wo++)
                     {
                         VTAUopPush(
-                            VTA_UOP_ALU,                 // mode
-                            0,                           // reset_out
-                            biasmultiplieraccshift + wo, // dst_index
-                            Oo * 2,                      // src_index
-                            0,                           // wgt_index
-                            VTA_ALU_OPCODE_SHR,          // opcode
-                            0,                           // use_imm
-                            0                            // imm_val
+                            VTA_UOP_ALU,                                          // mode
+                            0,                                                    // reset_out
+                            biasmultiplieraccshift + batch * outputtilesize + wo, // dst_index
+                            srcshift,                                             // src_index
+                            0,                                                    // wgt_index
+                            opcode,                                               // opcode
+                            0,                                                    // use_imm
+                            0                                                     // imm_val
                         );
                     }
-                    VTAUopLoopEnd();
-                    VTAUopLoopEnd();
-                    return 0;
-                };
-                void *shr = nullptr;
-                VTAPushGEMMOp(
-                    &shr,
-                    shrfun,
-                    nullptr,
-                    0
-                );
+                }
+                VTAUopLoopEnd();
+                VTAUopLoopEnd();
+                return 0;
+            };
+            void *alu = nullptr;
+            VTAPushALUOp(
+                &alu,
+                alufun,
+                nullptr,
+                0
+            );
+        }
+        VTADepPush(cmd, vta::kComputeStage, vta::kStoreStage);
 
-                // store the current results in DRAM
-                VTADepPop(cmd, vta::kComputeStage, vta::kStoreStage);
+        // store the current results in DRAM, one 2D block per output channel block and batch block
+        VTADepPop(cmd, vta::kComputeStage, vta::kStoreStage);
+        for (int ocblock = 0; ocblock < curroutchannels; ocblock++)
+        {
+            for (int batch = 0; batch < currbatches; batch++)
+            {
                 VTAStoreBuffer2D(
-                    cmd,                                                                           // command handle
-                    biasmultiplieraccshift,                                                        // src_sram_index
-                    VTA_MEM_ID_OUT,                                                                // src_memory_type
-                    outbuf,                                                                        // dst_dram_addr
-                    No * singleoutputsize + ochanid * singleoutputchannelsize + rowid * dim("Wo"), // dst_elem_offset
-                    curroutchannels * rowstoprocess * dim("Wo"),                                   // FIXME x_size?
-                    1,                                                                             // y_size
-                    1                                                                              // x_stride
+                    cmd,                                                                       // command handle
+                    biasmultiplieraccshift + (ocblock * currbatches + batch) * outputtilesize, // src_sram_index
+                    VTA_MEM_ID_OUT,                                                            // src_memory_type
+                    outbuf,                                                                    // dst_dram_addr
+                    (tile.batchid + batch) * singleoutputsize +
+                        (tile.ochanid + ocblock) * singleoutputchannelsize +
+                        tile.rowid * dim("Wo") +
+                        tile.colid,                                                            // dst_elem_offset
+                    colstoprocess,                                                             // x_size
+                    rowstoprocess,                                                             // y_size
+                    dim("Wo")                                                                  // x_stride
                 );
             }
         }
+        VTADepPush(cmd, vta::kStoreStage, vta::kComputeStage);
     }
+    VTADepPop(cmd, vta::kComputeStage, vta::kLoadStage);
+    VTADepPop(cmd, vta::kStoreStage, vta::kComputeStage);
 
     VTASynchronize(cmd, 1000000);
     VTABufferCopy(outbuf, 0, outarray.data(), 0, outelemsfull, VTA_MEMCPY_D2H);
@@ -1135,6 +1156,62 @@ TfLiteStatus VTAGEMMOp::gemmConv2D()
     return kTfLiteOk;
 }
 
+TfLiteStatus VTAGEMMOp::setConvParams()
+{
+    // defaults used when the block is tested outside of TFLite (no node)
+    setDim("paddingH", 0);
+    setDim("paddingW", 0);
+    setDim("paddingHafter", 0);
+    setDim("paddingWafter", 0);
+    setDim("strideH", 1);
+    setDim("strideW", 1);
+
+    if (!node || !node->builtin_data)
+    {
+        return kTfLiteOk;
+    }
+
+    const auto *params = reinterpret_cast<const TfLiteConvParams *>(node->builtin_data);
+
+    if (params->dilation_height_factor != 1 || params->dilation_width_factor != 1)
+    {
+        spdlog::error("Dilated CONV2D is not supported:  dilation=[{}x{}]", params->dilation_height_factor, params->dilation_width_factor);
+        return kTfLiteDelegateError;
+    }
+
+    int outheight = 0;
+    int outwidth = 0;
+    // TFLite's SAME padding can be asymmetric, the offset is added at the end of given axis
+    const TfLitePaddingValues padding = ComputePaddingHeightWidth(
+        params->stride_height,
+        params->stride_width,
+        1,
+        1,
+        dim("H"),
+        dim("W"),
+        dim("Hk"),
+        dim("Wk"),
+        params->padding,
+        &outheight,
+        &outwidth
+    );
+
+    if (outheight != dim("Ho") || outwidth != dim("Wo"))
+    {
+        spdlog::error("CONV2D output dimensions mismatch:  computed=[{}x{}] tensor=[{}x{}]", outheight, outwidth, dim("Ho"), dim("Wo"));
+        return kTfLiteDelegateError;
+    }
+
+    setDim("paddingH", padding.height);
+    setDim("paddingW", padding.width);
+    setDim("paddingHafter", padding.height + padding.height_offset);
+    setDim("paddingWafter", padding.width + padding.width_offset);
+    setDim("strideH", params->stride_height);
+    setDim("strideW", params->stride_width);
+
+    return kTfLiteOk;
+}
+
 void VTAGEMMOp::padData(
     const std::vector<std::string> &srclayout,
     const std::vector<std::string> &dstlayout,
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <vta-delegate.hpp>
+
+#include "vta/hw_spec_const.h"
+#include <spdlog/spdlog.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <tuple>
+
+namespace tflite
+{
+
+namespace
+{
+
+/// Cost of issuing DMA and micro-op instructions for a single accumulation step, in bytes of DRAM traffic
+constexpr int64_t stepoverhead = 64;
+
+/// Part of the micro-op SRAM that can be used by the GEMM kernel, the rest is left for reset and ALU kernels
+constexpr int maxgemmuops = VTA_UOP_BUFF_DEPTH / 2;
+
+/// Maximum extent of the micro-op loop
+constexpr int maxloopextent = (1 << VTA_LOOP_ITER_WIDTH) - 1;
+
+int divCeil(int value, int divisor)
+{
+    return (value + divisor - 1) / divisor;
+}
+
+/**
+ * Returns the smallest tile sizes for each possible number of tiles along the dimension.
+ *
+ * Only those sizes matter for DRAM traffic, larger tiles with the same number of tiles
+ * only waste SRAM.
+ */
+std::set<int> tileSizeCandidates(int size)
+{
+    std::set<int> candidates;
+    for (int numtiles = 1; numtiles <= size; numtiles++)
+    {
+        candidates.insert(divCeil(size, numtiles));
+    }
+    return candidates;
+}
+
+};
+
+bool VTAConv2DShape::operator<(const VTAConv2DShape &other) const
+{
+    return std::tie(No, H, W, Io, Oo, Hk, Wk, Ho, Wo, strideH, strideW) <
+        std::tie(other.No, other.H, other.W, other.Io, other.Oo, other.Hk, other.Wk, other.Ho, other.Wo, other.strideH, other.strideW);
+}
+
+bool conv2DTilingFits(const VTAConv2DShape &shape, const VTAConv2DTiling &tiling)
+{
+    if (tiling.ocblocks <= 0 || tiling.icblocks <= 0 || tiling.rows <= 0 || tiling.cols <= 0 || tiling.batches <= 0)
+    {
+        return false;
+    }
+    const int64_t inrows = static_cast<int64_t>(tiling.rows - 1) * shape.strideH + shape.Hk;
+    const int64_t incols = static_cast<int64_t>(tiling.cols - 1) * shape.strideW + shape.Wk;
+    const int64_t kernelsize = static_cast<int64_t>(shape.Hk) * shape.Wk;
+    // input tile with the halo required by the kernel
+    if (tiling.batches * tiling.icblocks * inrows * incols > VTA_INP_BUFF_DEPTH)
+    {
+        return false;
+    }
+    if (tiling.ocblocks * tiling.icblocks * kernelsize > VTA_WGT_BUFF_DEPTH)
+    {
+        return false;
+    }
+    // bias, multipliers and shifts are stored in ACC next to the outputs
+    if (3 * tiling.ocblocks + static_cast<int64_t>(tiling.batches) * tiling.ocblocks * tiling.rows * tiling.cols > VTA_ACC_BUFF_DEPTH)
+    {
+        return false;
+    }
+    if (tiling.batches * tiling.icblocks * kernelsize * tiling.cols > maxgemmuops)
+    {
+        return false;
+    }
+    return tiling.ocblocks <= maxloopextent && tiling.rows <= maxloopextent;
+}
+
+int64_t conv2DTilingTraffic(const VTAConv2DShape &shape, const VTAConv2DTiling &tiling)
+{
+    const int64_t ocsteps = divCeil(shape.Oo, tiling.ocblocks);
+    const int64_t icsteps = divCeil(shape.Io, tiling.icblocks);
+    const int64_t rowtiles = divCeil(shape.Ho, tiling.rows);
+    const int64_t coltiles = divCeil(shape.Wo, tiling.cols);
+    const int64_t batchtiles = divCeil(shape.No, tiling.batches);
+    const int64_t spatialtiles = rowtiles * coltiles;
+
+    // each tile loads (rows - 1) * stride + kernel size input rows (and columns)
+    const int64_t inprows = static_cast<int64_t>(shape.Ho - rowtiles) * shape.strideH + rowtiles * shape.Hk;
+    const int64_t inpcols = static_cast<int64_t>(shape.Wo - coltiles) * shape.strideW + coltiles * shape.Wk;
+
+    const int64_t inpbytes = static_cast<int64_t>(shape.No) * shape.Io * inprows * inpcols * VTA_INP_MATRIX_WIDTH / 8;
+    const int64_t wgtbytes = static_cast<int64_t>(shape.Oo) * shape.Io * shape.Hk * shape.Wk * VTA_WGT_MATRIX_WIDTH / 8;
+    const int64_t accbytes = 3 * static_cast<int64_t>(shape.Oo) * VTA_ACC_MATRIX_WIDTH / 8;
+
+    int64_t traffic = 0;
+    if (tiling.order == VTATileOrder::WeightStationary)
+    {
+        // weights stay in SRAM across spatial and batch tiles only if the whole input channel range fits
+        traffic += icsteps == 1 ? wgtbytes : wgtbytes * spatialtiles * batchtiles;
+        traffic += inpbytes * ocsteps;
+        traffic += accbytes;
+    }
+    else
+    {
+        // inputs stay in SRAM across output channel tiles only if the whole input channel range fits
+        traffic += icsteps == 1 ? inpbytes : inpbytes * ocsteps;
+        traffic += wgtbytes * spatialtiles * batchtiles;
+        traffic += accbytes * spatialtiles * batchtiles;
+    }
+    traffic += stepoverhead * ocsteps * icsteps * spatialtiles * batchtiles;
+    return traffic;
+}
+
+VTAConv2DTiling planConv2DTiling(const VTAConv2DShape &shape)
+{
+    static std::mutex cachemutex;
+    static std::map<VTAConv2DShape, VTAConv2DTiling> cache;
+
+    std::lock_guard<std::mutex> lock(cachemutex);
+    auto cached = cache.find(shape);
+    if (cached != cache.end())
+    {
+        return cached->second;
+    }
+
+    VTAConv2DTiling best;
+    const auto occandidates = tileSizeCandidates(shape.Oo);
+    const auto iccandidates = tileSizeCandidates(shape.Io);
+    const auto rowcandidates = tileSizeCandidates(shape.Ho);
+    const auto colcandidates = tileSizeCandidates(shape.Wo);
+    const auto batchcandidates = tileSizeCandidates(shape.No);
+    for (int ocblocks : occandidates)
+    {
+        for (int icblocks : iccandidates)
+        {
+            for (int cols : colcandidates)
+            {
+                for (int rows : rowcandidates)
+                {
+                    for (int batches : batchcandidates)
+                    {
+                        VTAConv2DTiling tiling;
+                        tiling.ocblocks = ocblocks;
+                        tiling.icblocks = icblocks;
+                        tiling.rows = rows;
+                        tiling.cols = cols;
+                        tiling.batches = batches;
+                        if (!conv2DTilingFits(shape, tiling))
+                        {
+                            continue;
+                        }
+                        for (auto order : {VTATileOrder::WeightStationary, VTATileOrder::InputStationary})
+                        {
+                            tiling.order = order;
+                            tiling.dramtraffic = conv2DTilingTraffic(shape, tiling);
+                            if (!best.valid() || tiling.dramtraffic < best.dramtraffic)
+                            {
+                                best = tiling;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (best.valid())
+    {
+        spdlog::debug(
+            "CONV2D tiling for [{}x{}x{}x{}] -> [{}x{}x{}x{}]:  batch={} oc={} ic={} rows={} cols={} {} ({} B from DRAM)",
+            shape.No, shape.Io, shape.H, shape.W,
+            shape.No, shape.Oo, shape.Ho, shape.Wo,
+            best.batches, best.ocblocks, best.icblocks, best.rows, best.cols,
+            best.order == VTATileOrder::WeightStationary ? "weight-stationary" : "input-stationary",
+            best.dramtraffic
+        );
+    }
+    cache[shape] = best;
+    return best;
+}
+
+};
@@ -11,6 +11,7 @@
 #include <cassert>
 #include "vta/hw_spec_const.h"
 #include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/c/builtin_op_data.h"
 #include <limits>
 #include <spdlog/spdlog.h>
 #include <algorithm>
@@ -81,7 +82,7 @@ void computeQuantizationParameters(double scale, int16_t &multiplier, int16_t &s
     shift = static_cast<int16_t>(shift32);
 }
 
-bool VTADelegate::IsNodeSupportedByDelegate(
+bool VTADelegate::isNodeCompatible(
         const TfLiteRegistration *registration,
         const TfLiteNode *node,
         TfLiteContext *context) const
@@ -89,8 +90,27 @@ bool VTADelegate::IsNodeSupportedByDelegate(
     switch (registration->builtin_code)
     {
         case kTfLiteBuiltinAdd:
-        // case kTfLiteBuiltinConv2d: // FIXME uncomment once the CONV2D implementation is ready
             break;
+        case kTfLiteBuiltinConv2d:
+        {
+            // VTA computes neither dilated convolutions nor fused activations
+            const auto *params = reinterpret_cast<const TfLiteConvParams *>(node->builtin_data);
+            if (!params)
+            {
+                return false;
+            }
+            if (params->dilation_height_factor != 1 || params->dilation_width_factor != 1)
+            {
+                spdlog::warn("Skipped dilated CONV2D:  dilation=[{}x{}]", params->dilation_height_factor, params->dilation_width_factor);
+                return false;
+            }
+            if (params->activation != kTfLiteActNone)
+            {
+                spdlog::warn("Skipped CONV2D with fused activation {}", params->activation);
+                return false;
+            }
+            break;
+        }
         default:
             spdlog::warn("Skipped builtin code {}", registration->builtin_code);
             return false;
@@ -115,8 +135,122 @@ bool VTADelegate::IsNodeSupportedByDelegate(
     return true;
 }
 
+bool VTADelegate::IsNodeSupportedByDelegate(
+        const TfLiteRegistration *registration,
+        const TfLiteNode *node,
+        TfLiteContext *context) const
+{
+    if (!isNodeCompatible(registration, node, context))
+    {
+        return false;
+    }
+    if (costoptions.enabled && offloadnodes.find(node) == offloadnodes.end())
+    {
+        spdlog::debug("Builtin code {} left on CPU by the cost model", registration->builtin_code);
+        return false;
+    }
+    return true;
+}
+
 TfLiteStatus VTADelegate::Initialize(TfLiteContext *context)
 {
+    if (!costoptions.enabled)
+    {
+        return kTfLiteOk;
+    }
+    return selectNodesToOffload(context);
+}
+
+TfLiteStatus VTADelegate::selectNodesToOffload(TfLiteContext *context)
+{
+    VTACostModel model(
+        costoptions.calibrate ?
+            calibrateVTACostParameters(costoptions.parameters) :
+            costoptions.parameters
+    );
+
+    offloadnodes.clear();
+
+    TfLiteIntArray *plan = nullptr;
+    TF_LITE_ENSURE_STATUS(context->GetExecutionPlan(context, &plan));
+
+    // Candidate partitions are the runs of compatible nodes in the execution plan.
+    // Within a run, a node that is slower on VTA is still kept in the partition
+    // if splitting the partition around it would cost more than running it on VTA.
+    std::vector<const TfLiteNode *> segment;
+    std::vector<const TfLiteNode *> pending;
+    double segmentgain = 0.0;
+    double pendingloss = 0.0;
+    int numpartitions = 0;
+
+    auto closesegment = [&]()
+    {
+        const bool largeenough = options.min_nodes_per_partition <= 0 ||
+            static_cast<int>(segment.size()) >= options.min_nodes_per_partition;
+        const double gain = segmentgain - model.partitionCost();
+        if (!segment.empty())
+        {
+            if (largeenough && gain > 0.0)
+            {
+                offloadnodes.insert(segment.begin(), segment.end());
+                numpartitions++;
+            }
+            spdlog::debug(
+                "Partition of {} nodes, estimated gain {} us: {}",
+                segment.size(),
+                gain,
+                largeenough && gain > 0.0 ? "offloaded" : "left on CPU"
+            );
+        }
+        segment.clear();
+        pending.clear();
+        segmentgain = 0.0;
+        pendingloss = 0.0;
+    };
+
+    for (int i = 0; i < plan->size; i++)
+    {
+        TfLiteNode *node = nullptr;
+        TfLiteRegistration *registration = nullptr;
+        TF_LITE_ENSURE_STATUS(context->GetNodeAndRegistration(context, plan->data[i], &node, &registration));
+        if (!isNodeCompatible(registration, node, context))
+        {
+            closesegment();
+            continue;
+        }
+        const double cpucost = model.cpuCost(registration, node, context);
+        const double vtacost = model.vtaCost(registration, node, context);
+        const double gain = cpucost - vtacost;
+        spdlog::debug("Node {} ({}): CPU {} us, VTA {} us", plan->data[i], registration->builtin_code, cpucost, vtacost);
+        if (gain <= 0.0)
+        {
+            if (!segment.empty())
+            {
+                pending.push_back(node);
+                pendingloss -= gain;
+            }
+            continue;
+        }
+        if (!pending.empty())
+        {
+            if (pendingloss < model.partitionCost())
+            {
+                segment.insert(segment.end(), pending.begin(), pending.end());
+                segmentgain -= pendingloss;
+            }
+            else
+            {
+                closesegment();
+            }
+            pending.clear();
+            pendingloss = 0.0;
+        }
+        segment.push_back(node);
+        segmentgain += gain;
+    }
+    closesegment();
+
+    spdlog::info("Cost model selected {} nodes in {} partitions for VTA", offloadnodes.size(), numpartitions);
     return kTfLiteOk;
 }
 
@@ -146,10 +280,7 @@ VTAOp::~VTAOp()
 TfLiteStatus VTADelegateKernel::Init(TfLiteContext* context, const TfLiteDelegateParams* params)
 {
     this->context = context;
-    if (commcontext == nullptr)
-    {
-        commcontext = std::make_shared<CommunicationContext>();
-    }
+    commcontext = getCommunicationContext();
     // NOTE During Init, only tensors with parameters are allocated by the TensorFlow Lite.
     // This means that tensors for inputs, outputs and intermediate data are not allocated.
     // During Invoke, additionaly non-intermediate inputs and outputs are allocated (tensors
@@ -250,6 +381,20 @@ TfLiteStatus VTADelegateKernel::Init(TfLiteContext* context, const TfLiteDelegat
     return kTfLiteOk;
 }
 
+std::shared_ptr<CommunicationContext> VTADelegateKernel::getCommunicationContext()
+{
+    // interpreters of concurrent accelerator jobs may get here at the same time,
+    // initialization of the function-local static is thread-safe
+    static std::shared_ptr<CommunicationContext> shared = std::make_shared<CommunicationContext>();
+    return shared;
+}
+
+std::mutex &VTADelegateKernel::getDeviceMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
 TfLiteStatus VTADelegateKernel::Prepare(TfLiteContext* context, TfLiteNode* node)
 {
     // NOTE the Prepare function also have only parameters allocated, as in Init function.
@@ -309,6 +454,9 @@ TfLiteStatus VTADelegateKernel::Eval(TfLiteContext* context, TfLiteNode* node)
 
     spdlog::debug("Inferring...");
 
+    // interpreters of concurrent accelerator jobs take turns on the device
+    std::lock_guard<std::mutex> lock(getDeviceMutex());
+
     for (auto &op: ops)
     {
         TfLiteStatus ret = op->compute();
@@ -327,10 +475,11 @@ tflite::SimpleDelegateInterface::Options TfLiteVTADelegateOptionsDefault() {
             return options;
 }
 
-TfLiteDelegate *TfLiteVTADelegateCreate(const SimpleDelegateInterface::Options *options) {
+TfLiteDelegate *TfLiteVTADelegateCreate(const SimpleDelegateInterface::Options *options, const VTACostModelOptions *costoptions) {
   std::unique_ptr<tflite::VTADelegate> custom(
       new tflite::VTADelegate(
-          options ? *options : TfLiteVTADelegateOptionsDefault()));
+          options ? *options : TfLiteVTADelegateOptionsDefault(),
+          costoptions ? *costoptions : VTACostModelOptions()));
   return tflite::TfLiteDelegateFactory::CreateSimpleDelegate(std::move(custom));
 }
 
@@ -340,7 +489,34 @@ void TfLiteVTADelegateDelete(TfLiteDelegate* delegate) {
 
 TfLiteDelegate *CreateVTADelegateFromOptions(char **options_keys, char **options_values, size_t num_options)
 {
-    return TfLiteVTADelegateCreate(NULL);
+    SimpleDelegateInterface::Options options = TfLiteVTADelegateOptionsDefault();
+    VTACostModelOptions costoptions;
+    for (size_t i = 0; i < num_options; i++)
+    {
+        const std::string key = options_keys[i];
+        const std::string value = options_values[i];
+        if (key == "max_delegated_partitions")
+        {
+            options.max_delegated_partitions = std::stoi(value);
+        }
+        else if (key == "min_nodes_per_partition")
+        {
+            options.min_nodes_per_partition = std::stoi(value);
+        }
+        else if (key == "cost_model")
+        {
+            costoptions.enabled = value == "true" || value == "1";
+        }
+        else if (key == "calibrate")
+        {
+            costoptions.calibrate = value == "true" || value == "1";
+        }
+        else
+        {
+            spdlog::warn("Unknown VTA delegate option:  {}", key);
+        }
+    }
+    return TfLiteVTADelegateCreate(&options, &costoptions);
 }
 
 TfLiteDelegate *tflite_plugin_create_delegate(char** options_keys, char** options_values, size_t num_options, void (*report_error)(const char*))
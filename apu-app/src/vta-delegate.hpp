@@ -8,7 +8,9 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <vector>
+#include <unordered_set>
 #include "tensorflow/lite/delegates/utils/simple_delegate.h"
 #include "vta/hw_spec_const.h"
 #include "tensorflow/lite/builtin_ops.h"
@@ -42,6 +44,96 @@ class CommunicationContext
         ~CommunicationContext();
 };
 
+/**
+ * Throughput and overhead figures used by the VTA cost model.
+ *
+ * All times are expressed in microseconds, throughputs in units per microsecond.
+ * Default values are rough estimates for Zynq UltraScale+ with VTA running at 100 MHz,
+ * they can be refined with calibrateVTACostParameters.
+ */
+struct VTACostParameters
+{
+    double partitionoverhead = 300.0; ///< fixed cost of a delegated partition (kernel invocation, instruction queue flush, synchronization)
+    double nodeoverhead = 50.0; ///< fixed cost of a single delegated node (CMA buffer allocations, micro-op kernel creation)
+    double dmabytesperus = 500.0; ///< throughput of copying data between host memory and CMA buffers
+    double layoutelementsperus = 200.0; ///< CPU throughput of layout transforms and (re)quantization of tensor elements
+    double vtamacsperus = 12800.0; ///< GEMM core throughput in multiply-accumulates
+    double vtaaluopsperus = 800.0; ///< ALU core throughput in element-wise operations
+    double cpumacsperus = 2000.0; ///< CPU throughput in INT8 multiply-accumulates
+    double cpualuopsperus = 200.0; ///< CPU throughput in quantized element-wise operations
+};
+
+/**
+ * Settings for the cost-model-driven partitioning in VTADelegate.
+ */
+struct VTACostModelOptions
+{
+    bool enabled = false; ///< if false, every compatible node is delegated
+    bool calibrate = false; ///< if true, parameters are measured once per process before the first partitioning
+    VTACostParameters parameters; ///< initial cost model parameters
+};
+
+/**
+ * Estimates execution times of TFLite nodes on the CPU and on the VTA accelerator.
+ *
+ * The VTA estimate includes the data movement the VTA operators perform for each
+ * invocation - layout transforms and quantization done on the CPU, copies to and from
+ * CMA buffers and the computations on the accelerator.
+ */
+class VTACostModel
+{
+public:
+    /**
+     * Constructor for the cost model.
+     *
+     * @param parameters throughput and overhead figures
+     */
+    explicit VTACostModel(const VTACostParameters &parameters) : parameters(parameters) {}
+
+    /**
+     * Estimates execution time of the node using TFLite CPU kernels.
+     *
+     * @param registration node registration structure
+     * @param node node to estimate
+     * @param context TFLite context with tensors of the node
+     * @return estimated time in microseconds
+     */
+    double cpuCost(const TfLiteRegistration *registration, const TfLiteNode *node, TfLiteContext *context) const;
+
+    /**
+     * Estimates execution time of the node delegated to VTA.
+     *
+     * The fixed cost of the partition the node belongs to is not included.
+     *
+     * @param registration node registration structure
+     * @param node node to estimate
+     * @param context TFLite context with tensors of the node
+     * @return estimated time in microseconds, infinity for operations not implemented on VTA
+     */
+    double vtaCost(const TfLiteRegistration *registration, const TfLiteNode *node, TfLiteContext *context) const;
+
+    /**
+     * Returns the fixed cost of a single delegated partition.
+     *
+     * @return time in microseconds
+     */
+    double partitionCost() const { return parameters.partitionoverhead; }
+
+private:
+    const VTACostParameters parameters; ///< throughput and overhead figures
+};
+
+/**
+ * Measures CMA copy throughput and CPU throughputs of layout transforms and TFLite kernels.
+ *
+ * Measurements are performed once per process, subsequent calls return cached results.
+ * VTA compute throughputs are taken from the base parameters.
+ *
+ * @param base parameters used for values that are not measured
+ * @return calibrated parameters
+ */
+VTACostParameters calibrateVTACostParameters(const VTACostParameters &base);
+
 /**
  * A TensorFlow Lite delegate for VTA accelerator.
  *
@@ -62,8 +154,12 @@ public:
      * * min_nodes_per_partition - the minimum number of nodes allowed in a delegated graph, values <=0 means unlimited.
      *
      * @param options delegate options
+     * @param costoptions settings for cost-model-driven partitioning
      */
-    explicit VTADelegate(const SimpleDelegateInterface::Options &options) : options(options)
+    explicit VTADelegate(
+        const SimpleDelegateInterface::Options &options,
+        const VTACostModelOptions &costoptions = VTACostModelOptions()
+    ) : options(options), costoptions(costoptions)
     {
         spdlog::cfg::load_env_levels();
     }
@@ -83,6 +179,10 @@ public:
      *
      * It can be used for setting up the accelerator, or for retrieving some TFLite settings from the context.
      *
+     * If the cost model is enabled, it walks the execution plan, groups compatible nodes
+     * into partitions and selects only those partitions that are estimated to run faster
+     * on VTA than on the CPU, including the fixed cost of each partition.
+     *
      * @param context context containing TFLite tensors
      * @return the initialization status
      */
@@ -109,7 +209,27 @@ public:
      */
     SimpleDelegateInterface::Options DelegateOptions() const override {return options;};
 private:
+    /**
+     * Checks if the VTA delegate implements the operation and data types of the node.
+     *
+     * @param registration node registration structure
+     * @param node node to check
+     * @param context TFLite context containing tensors
+     * @return true if the node can be executed on VTA
+     */
+    bool isNodeCompatible(const TfLiteRegistration *registration, const TfLiteNode *node, TfLiteContext *context) const;
+
+    /**
+     * Selects nodes to offload based on the cost model.
+     *
+     * @param context TFLite context with the execution plan
+     * @return status of the selection
+     */
+    TfLiteStatus selectNodesToOffload(TfLiteContext *context);
+
     const SimpleDelegateInterface::Options options; ///< delegate's options
+    const VTACostModelOptions costoptions; ///< cost model settings
+    std::unordered_set<const TfLiteNode *> offloadnodes; ///< nodes accepted by the cost model
 };
 
 class VTAOp;
@@ -152,10 +272,28 @@ public:
      */
     TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) override;
 
+    /**
+     * Returns the communication context with VTA, creating it on first use.
+     *
+     * @return shared communication context
+     */
+    static std::shared_ptr<CommunicationContext> getCommunicationContext();
+
+    /**
+     * Returns the mutex serializing the use of the VTA device.
+     *
+     * The VTA runtime keeps a single instruction queue for the process and the device runs one
+     * instruction stream at a time, so the whole staging, run and readback of delegated operations
+     * has to be done by one interpreter at a time.
+     *
+     * @return device-wide mutex
+     */
+    static std::mutex &getDeviceMutex();
+
     TfLiteContext *context = nullptr; ///< TFLite context for the delegate
 private:
     std::vector<std::shared_ptr<VTAOp>> ops; ///< operations executed in the delegate
-    inline static std::shared_ptr<CommunicationContext> commcontext = nullptr; ///< communication context with the VTA hardware
+    std::shared_ptr<CommunicationContext> commcontext; ///< communication context with the VTA hardware
 };
 
 /**
@@ -300,6 +438,97 @@ class VTAALUOp : public VTAOp
         QuantizationData outputquant; ///< output quantization parameters
 };
 
+/**
+ * Shape of a CONV2D layer, with channels expressed in VTA blocks.
+ */
+struct VTAConv2DShape
+{
+    int No = 1; ///< number of batch blocks
+    int H = 0; ///< input height
+    int W = 0; ///< input width
+    int Io = 0; ///< number of input channel blocks
+    int Oo = 0; ///< number of output channel blocks
+    int Hk = 0; ///< kernel height
+    int Wk = 0; ///< kernel width
+    int Ho = 0; ///< output height
+    int Wo = 0; ///< output width
+    int strideH = 1; ///< stride along height
+    int strideW = 1; ///< stride along width
+
+    /**
+     * Orders shapes, used for caching tilings.
+     */
+    bool operator<(const VTAConv2DShape &other) const;
+};
+
+/**
+ * Order of tile loops in CONV2D schedule.
+ */
+enum class VTATileOrder
+{
+    WeightStationary, ///< output channel tiles are outer loop, weights stay in WGT SRAM across spatial tiles
+    InputStationary ///< spatial tiles are outer loop, inputs stay in INP SRAM across output channel tiles
+};
+
+/**
+ * Tiling of CONV2D layer for VTA SRAMs.
+ *
+ * Each tile computes rows x cols output pixels for ocblocks output channel blocks
+ * and batches batch blocks, accumulating the results over input channels in steps of icblocks.
+ * All batch blocks of a tile share the weights loaded to WGT SRAM.
+ */
+struct VTAConv2DTiling
+{
+    int ocblocks = 0; ///< output channel blocks per tile
+    int icblocks = 0; ///< input channel blocks per accumulation step
+    int rows = 0; ///< output rows per tile
+    int cols = 0; ///< output columns per tile
+    int batches = 1; ///< batch blocks per tile
+    VTATileOrder order = VTATileOrder::WeightStationary; ///< order of tile loops
+    int64_t dramtraffic = 0; ///< estimated number of bytes loaded from DRAM
+
+    /**
+     * Tells if the tiling was found.
+     *
+     * @return true if tiling fits in VTA SRAMs
+     */
+    bool valid() const { return ocblocks > 0; }
+};
+
+/**
+ * Checks if tiles of given size fit in INP, WGT, ACC and micro-op SRAMs.
+ *
+ * @param shape shape of the layer
+ * @param tiling tiling to check
+ * @return true if tiling fits in VTA SRAMs
+ */
+bool conv2DTilingFits(const VTAConv2DShape &shape, const VTAConv2DTiling &tiling);
+
+/**
+ * Estimates the number of bytes loaded from DRAM by the schedule.
+ *
+ * It accounts for input halo rows/columns, reloads of weights for each spatial tile
+ * and batch tile, and reloads of inputs for each output channel tile, unless the given
+ * order keeps them resident in SRAM.
+ *
+ * @param shape shape of the layer
+ * @param tiling tiling to evaluate
+ * @return estimated DRAM traffic in bytes
+ */
+int64_t conv2DTilingTraffic(const VTAConv2DShape &shape, const VTAConv2DTiling &tiling);
+
+/**
+ * Searches for the tiling with the lowest DRAM traffic.
+ *
+ * The search covers tile sizes along batch, output height, output width, input channel blocks
+ * and output channel blocks, and both tile loop orders.
+ * Results are cached per layer shape.
+ *
+ * @param shape shape of the layer
+ * @return best tiling, invalid if even the smallest tile does not fit in SRAMs
+ */
+VTAConv2DTiling planConv2DTiling(const VTAConv2DShape &shape);
+
 /**
  * Wrapper for GEMM operations on VTA.
  */
@@ -405,6 +634,15 @@ class VTAGEMMOp : public VTAOp
          */
         TfLiteStatus gemmConv2D();
 
+        /**
+         * Sets padding and stride dimensions based on TfLiteConvParams from node's builtin_data.
+         *
+         * Requires H, W, Hk, Wk, Ho and Wo dimensions to be set.
+         *
+         * @return kTfLiteOk if parameters are supported by the VTA implementation
+         */
+        TfLiteStatus setConvParams();
+
         /**
          * Map holding dimensions for GEMM data
          * CONV2D:
@@ -425,8 +663,10 @@ class VTAGEMMOp : public VTAOp
          *         Io - outer input channels (I / VTA_BLOCK_IN)
          *         Oo - outer output channels (O / VTA_BLOCK_OUT)
          *     Walking dimensions
-         *         paddingH - height padding
-         *         paddingW - width padding
+         *         paddingH - height padding (before first row)
+         *         paddingW - width padding (before first column)
+         *         paddingHafter - height padding (after last row)
+         *         paddingWafter - width padding (after last column)
          *         strideH - stride along height axis
          *         strideW - stride along width axis
          */
@@ -450,9 +690,10 @@ tflite::SimpleDelegateInterface::Options TfLiteVTADelegateOptionsDefault();
  * Creates a VTA delegate.
  *
  * @param options settings for the delegate
+ * @param costoptions settings for cost-model-driven partitioning, nullptr delegates all compatible nodes
  * @return pointer to the created delegate
  */
-TfLiteDelegate *TfLiteVTADelegateCreate(const SimpleDelegateInterface::Options *options);
+TfLiteDelegate *TfLiteVTADelegateCreate(const SimpleDelegateInterface::Options *options, const VTACostModelOptions *costoptions = nullptr);
 
 /**
  * Deletes a VTA delegate.
@@ -464,6 +705,13 @@ void TfLiteVTADelegateDelete(TfLiteDelegate *delegate);
 /**
  * Creates a VTA Delegate.
  *
+ * Supported options:
+ *
+ * * max_delegated_partitions - maximum number of delegated partitions
+ * * min_nodes_per_partition - minimum number of nodes in a delegated partition
+ * * cost_model - enables cost-model-driven partitioning ("true"/"false")
+ * * calibrate - measures cost model parameters at startup ("true"/"false")
+ *
  * @param options_keys list of options' names
  * @param options_values list of options' values
  * @param num_options number of options
@@ -170,10 +170,22 @@ void VTADeviceFree(VTADeviceHandle handle) {
   delete static_cast<VTADevice*>(handle);
 }
 
+// Accumulated per thread, so accelerator jobs see only their own VTA time
+static thread_local uint64_t vta_busy_ns = 0;
+
+uint64_t VTADeviceBusyTime(void) {
+  return vta_busy_ns;
+}
+
 int VTADeviceRun(VTADeviceHandle handle,
                  vta_phy_addr_t insn_phy_addr,
                  uint32_t insn_count,
                  uint32_t wait_cycles) {
-  return static_cast<VTADevice*>(handle)->Run(
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  int ret = static_cast<VTADevice*>(handle)->Run(
       insn_phy_addr, insn_count, wait_cycles);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  vta_busy_ns += (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+  return ret;
 }
@@ -51,6 +51,9 @@ void VTAUnmapRegister(void *vta);
 void VTAWriteMappedReg(void* base_addr, uint32_t offset, uint32_t val);
 uint32_t VTAReadMappedReg(void* base_addr, uint32_t offset);
 
+/*! \brief Returns the time in ns the VTA spent running instructions issued by the calling thread */
+uint64_t VTADeviceBusyTime(void);
+
 /*! \brief VTA configuration register start value */
 #define VTA_START 0x1
 /*! \brief VTA configuration register auto-restart value */
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+
+#include "vta-delegate.hpp"
+
+#define ITERATIONS 16
+
+/**
+ * ADD model invoked repeatedly, with the VTA delegate or on the CPU only.
+ */
+class AddJob
+{
+    public:
+        AddJob(const char *path, bool withvta)
+        {
+            model = tflite::FlatBufferModel::BuildFromFile(path);
+            tflite::InterpreterBuilder(*model, resolver)(&interpreter);
+            if (withvta)
+            {
+                std::unique_ptr<TfLiteDelegate, decltype(&tflite::TfLiteVTADelegateDelete)> delegate(tflite::TfLiteVTADelegateCreate(NULL), &tflite::TfLiteVTADelegateDelete);
+                EXPECT_EQ(interpreter->ModifyGraphWithDelegate(std::move(delegate)), kTfLiteOk);
+            }
+            EXPECT_EQ(interpreter->AllocateTensors(), kTfLiteOk);
+        }
+
+        /**
+         * Runs the model on inputs generated from the seed and returns the output.
+         */
+        std::vector<int8_t> run(unsigned int seed)
+        {
+            const size_t size = interpreter->input_tensor(0)->bytes;
+            int8_t *input1 = interpreter->typed_input_tensor<int8_t>(0);
+            int8_t *input2 = interpreter->typed_input_tensor<int8_t>(1);
+            for (size_t i = 0; i < size; i++)
+            {
+                input1[i] = static_cast<int8_t>(rand_r(&seed) % 256 - 128);
+                input2[i] = static_cast<int8_t>(rand_r(&seed) % 256 - 128);
+            }
+            EXPECT_EQ(interpreter->Invoke(), kTfLiteOk);
+            int8_t *out = interpreter->typed_output_tensor<int8_t>(0);
+            return std::vector<int8_t>(out, out + size);
+        }
+
+    private:
+        std::unique_ptr<tflite::FlatBufferModel> model;
+        tflite::ops::builtin::BuiltinOpResolver resolver;
+        std::unique_ptr<tflite::Interpreter> interpreter;
+};
+
+/**
+ * Runs the model with the VTA delegate on ITERATIONS inputs and compares the results with the CPU.
+ */
+static void runAndCompare(const char *path, unsigned int seed)
+{
+    AddJob cpu(path, false);
+    AddJob vta(path, true);
+
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        std::vector<int8_t> expected = cpu.run(seed + i);
+        std::vector<int8_t> result = vta.run(seed + i);
+        ASSERT_EQ(expected.size(), result.size());
+        for (size_t e = 0; e < expected.size(); e++)
+        {
+            ASSERT_NEAR(expected[e], result[e], 1) << "  File=" << path << "  Iteration=" << i << "  Elem=" << e;
+        }
+    }
+}
+
+TEST(VTAConcurrencyTests, TwoDelegatedJobs)
+{
+    // accelerator slots run jobs in parallel, each with its own interpreter sharing the single VTA device
+    std::thread first(runAndCompare, "./test-models/add/add-4096.tflite", 1);
+    std::thread second(runAndCompare, "./test-models/add/add-8192.tflite", 1000);
+
+    first.join();
+    second.join();
+}
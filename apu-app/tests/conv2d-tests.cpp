@@ -9,6 +9,7 @@
 #include <filesystem>
 #include <regex>
 #include <chrono>
+#include <cstdlib>
 
 #include "tensorflow/lite/interpreter.h"
 #include "tensorflow/lite/kernels/register.h"
@@ -19,6 +20,69 @@
 #include "vta-delegate.hpp"
 
 #define NUM_MODELS 97
+#define SINGLE_CONV2D_MODEL "./test-models/conv2d/conv2d-is4_ic1_oc1_ks3_s1_p0.tflite"
+
+/**
+ * Checks whether any node in the execution plan is a VTA delegate kernel.
+ */
+static bool hasDelegatedNode(tflite::Interpreter *interpreter)
+{
+    for (int nodeid : interpreter->execution_plan())
+    {
+        if (interpreter->node_and_registration(nodeid)->second.builtin_code == kTfLiteBuiltinDelegate)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Runs the model on random inputs generated from the seed, with or without the VTA delegate.
+ */
+static std::vector<int8_t> runConv2D(const char *path, bool withvta, unsigned int seed)
+{
+    std::unique_ptr<tflite::FlatBufferModel> model = tflite::FlatBufferModel::BuildFromFile(path);
+
+    tflite::ops::builtin::BuiltinOpResolver resolver;
+    std::unique_ptr<tflite::Interpreter> interpreter;
+
+    tflite::InterpreterBuilder(*model, resolver)(&interpreter);
+
+    if (withvta)
+    {
+        std::unique_ptr<TfLiteDelegate, decltype(&tflite::TfLiteVTADelegateDelete)> delegate(tflite::TfLiteVTADelegateCreate(NULL), &tflite::TfLiteVTADelegateDelete);
+        EXPECT_EQ(interpreter->ModifyGraphWithDelegate(std::move(delegate)), kTfLiteOk);
+        EXPECT_TRUE(hasDelegatedNode(interpreter.get()));
+    }
+
+    EXPECT_EQ(interpreter->AllocateTensors(), kTfLiteOk);
+
+    const size_t inputsize = interpreter->input_tensor(0)->bytes;
+    int8_t *input = interpreter->typed_input_tensor<int8_t>(0);
+    for (size_t i = 0; i < inputsize; i++)
+    {
+        input[i] = static_cast<int8_t>(rand_r(&seed) % 256 - 128);
+    }
+
+    EXPECT_EQ(interpreter->Invoke(), kTfLiteOk);
+
+    const size_t outputsize = interpreter->output_tensor(0)->bytes;
+    int8_t *out = interpreter->typed_output_tensor<int8_t>(0);
+    return std::vector<int8_t>(out, out + outputsize);
+}
+
+TEST(VTAConv2DDelegationTests, DelegatedConv2DMatchesCPU)
+{
+    const std::vector<int8_t> expected = runConv2D(SINGLE_CONV2D_MODEL, false, 42);
+    const std::vector<int8_t> result = runConv2D(SINGLE_CONV2D_MODEL, true, 42);
+
+    ASSERT_EQ(expected.size(), result.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        EXPECT_NEAR(expected[i], result[i], 1) << "  Elem=" << i;
+    }
+}
 
 class VTAConv2DTest : public ::testing::TestWithParam<int>
 {
@@ -114,7 +178,10 @@ TEST_P(VTAConv2DTest, Conv2DTestDelegate)
 
     tflite::InterpreterBuilder(*model, resolver)(&interpreter);
 
-    interpreter->ModifyGraphWithDelegate(std::move(delegate));
+    ASSERT_EQ(interpreter->ModifyGraphWithDelegate(std::move(delegate)), kTfLiteOk);
+
+    // the comparison with TFLite is only meaningful if the convolution actually runs on VTA
+    ASSERT_TRUE(hasDelegatedNode(interpreter.get())) << "CONV2D not delegated in " << modelfiles[GetParam()] << std::endl;
 
     interpreter->AllocateTensors();
 
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+
+#include "vta-delegate.hpp"
+
+#define ADD_MODEL "./test-models/add/add-16.tflite"
+
+/**
+ * Builds the interpreter for ADD_MODEL with VTA delegate and returns the builtin code of the first node in the execution plan.
+ */
+static int firstNodeBuiltinCode(const tflite::VTACostModelOptions &costoptions)
+{
+    std::unique_ptr<tflite::FlatBufferModel> model = tflite::FlatBufferModel::BuildFromFile(ADD_MODEL);
+
+    tflite::ops::builtin::BuiltinOpResolver resolver;
+    std::unique_ptr<tflite::Interpreter> interpreter;
+
+    tflite::InterpreterBuilder(*model, resolver)(&interpreter);
+
+    std::unique_ptr<TfLiteDelegate, decltype(&tflite::TfLiteVTADelegateDelete)> delegate(tflite::TfLiteVTADelegateCreate(NULL, &costoptions), &tflite::TfLiteVTADelegateDelete);
+    EXPECT_EQ(interpreter->ModifyGraphWithDelegate(std::move(delegate)), kTfLiteOk);
+
+    EXPECT_EQ(interpreter->AllocateTensors(), kTfLiteOk);
+    EXPECT_EQ(interpreter->Invoke(), kTfLiteOk);
+
+    return interpreter->node_and_registration(interpreter->execution_plan()[0])->second.builtin_code;
+}
+
+TEST(VTACostModelTests, SmallAddStaysOnCPU)
+{
+    tflite::VTACostModelOptions costoptions;
+    costoptions.enabled = true;
+
+    ASSERT_EQ(firstNodeBuiltinCode(costoptions), kTfLiteBuiltinAdd);
+}
+
+TEST(VTACostModelTests, CheapVTAIsDelegated)
+{
+    tflite::VTACostModelOptions costoptions;
+    costoptions.enabled = true;
+    costoptions.parameters.partitionoverhead = 0.0;
+    costoptions.parameters.nodeoverhead = 0.0;
+    costoptions.parameters.cpualuopsperus = 1e-3;
+
+    ASSERT_EQ(firstNodeBuiltinCode(costoptions), kTfLiteBuiltinDelegate);
+}
+
+TEST(VTACostModelTests, TransferCostKeepsAddOnCPU)
+{
+    // same as CheapVTAIsDelegated, except that copies to and from CMA buffers cost more than the CPU computation
+    tflite::VTACostModelOptions costoptions;
+    costoptions.enabled = true;
+    costoptions.parameters.partitionoverhead = 0.0;
+    costoptions.parameters.nodeoverhead = 0.0;
+    costoptions.parameters.cpualuopsperus = 1e-3;
+    costoptions.parameters.dmabytesperus = 1e-3;
+
+    ASSERT_EQ(firstNodeBuiltinCode(costoptions), kTfLiteBuiltinAdd);
+}
+
+TEST(VTACostModelTests, PartitionOverheadKeepsAddOnCPU)
+{
+    // the node alone is faster on VTA, but not by enough to pay for a separate partition
+    tflite::VTACostModelOptions costoptions;
+    costoptions.enabled = true;
+    costoptions.parameters.partitionoverhead = 1e12;
+    costoptions.parameters.nodeoverhead = 0.0;
+    costoptions.parameters.cpualuopsperus = 1e-3;
+
+    ASSERT_EQ(firstNodeBuiltinCode(costoptions), kTfLiteBuiltinAdd);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <vta-delegate.hpp>
+
+#include <gtest/gtest.h>
+
+static tflite::VTAConv2DShape convShape(int size, int io, int oo, int kernel, int stride)
+{
+    tflite::VTAConv2DShape shape;
+    shape.H = size;
+    shape.W = size;
+    shape.Io = io;
+    shape.Oo = oo;
+    shape.Hk = kernel;
+    shape.Wk = kernel;
+    shape.Ho = (size - kernel) / stride + 1;
+    shape.Wo = (size - kernel) / stride + 1;
+    shape.strideH = stride;
+    shape.strideW = stride;
+    return shape;
+}
+
+TEST(VTATiling, WideFeatureMapIsSplitAlongWidth)
+{
+    // a single padded input row does not fit into INP SRAM
+    auto shape = convShape(VTA_INP_BUFF_DEPTH + 2, 1, 1, 3, 1);
+    auto tiling = tflite::planConv2DTiling(shape);
+
+    ASSERT_TRUE(tiling.valid());
+    ASSERT_TRUE(tflite::conv2DTilingFits(shape, tiling));
+    ASSERT_LT(tiling.cols, shape.Wo);
+}
+
+TEST(VTATiling, ResidentWeightsAreLoadedOnce)
+{
+    auto shape = convShape(56, 4, 4, 3, 1);
+    auto tiling = tflite::planConv2DTiling(shape);
+
+    ASSERT_TRUE(tiling.valid());
+    ASSERT_TRUE(tflite::conv2DTilingFits(shape, tiling));
+
+    // all weights fit into WGT SRAM, so they should not be reloaded per spatial tile
+    ASSERT_EQ(tiling.icblocks, shape.Io);
+    ASSERT_EQ(tiling.ocblocks, shape.Oo);
+
+    // the plan should not be worse than the row-by-row schedule
+    tflite::VTAConv2DTiling rowbyrow;
+    rowbyrow.ocblocks = 1;
+    rowbyrow.icblocks = 1;
+    rowbyrow.rows = 1;
+    rowbyrow.cols = shape.Wo;
+    ASSERT_TRUE(tflite::conv2DTilingFits(shape, rowbyrow));
+    ASSERT_LE(tiling.dramtraffic, tflite::conv2DTilingTraffic(shape, rowbyrow));
+}
+
+TEST(VTATiling, StridedTilesFit)
+{
+    auto shape = convShape(225, 8, 16, 3, 2);
+    auto tiling = tflite::planConv2DTiling(shape);
+
+    ASSERT_TRUE(tiling.valid());
+    ASSERT_TRUE(tflite::conv2DTilingFits(shape, tiling));
+}
+
+TEST(VTATiling, WeightsAreSharedAcrossBatch)
+{
+    auto single = convShape(28, 4, 8, 3, 1);
+    auto batched = single;
+    batched.No = 8;
+
+    auto singletiling = tflite::planConv2DTiling(single);
+    auto batchedtiling = tflite::planConv2DTiling(batched);
+
+    ASSERT_TRUE(batchedtiling.valid());
+    ASSERT_TRUE(tflite::conv2DTilingFits(batched, batchedtiling));
+    // only activations should scale with the batch, weights are loaded once
+    ASSERT_LT(batchedtiling.dramtraffic, batched.No * singletiling.dramtraffic);
+}
+
+TEST(VTATiling, CachedTilingIsReused)
+{
+    auto shape = convShape(28, 2, 3, 5, 1);
+    auto first = tflite::planConv2DTiling(shape);
+    auto second = tflite::planConv2DTiling(shape);
+
+    ASSERT_EQ(first.ocblocks, second.ocblocks);
+    ASSERT_EQ(first.icblocks, second.icblocks);
+    ASSERT_EQ(first.rows, second.rows);
+    ASSERT_EQ(first.cols, second.cols);
+    ASSERT_EQ(first.order, second.order);
+}
+
+TEST(VTATiling, OversizedKernelIsRejected)
+{
+    // a single kernel block does not fit into WGT SRAM
+    auto shape = convShape(64, 1, 1, 33, 1);
+    auto tiling = tflite::planConv2DTiling(shape);
+
+    ASSERT_FALSE(tiling.valid());
+}
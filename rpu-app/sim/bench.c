@@ -0,0 +1,933 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Synthetic NVMe host driving the simulated controller, reports IOPS and completion latency */
+
+#include "sim.h"
+
+#include <zephyr.h>
+
+#include "tc.h"
+#include "cmd.h"
+#include "blk.h"
+#include "rpmsg.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <getopt.h>
+
+#define HOST_PAGE_SIZE		4096
+#define PRP_ENTRIES		(HOST_PAGE_SIZE / sizeof(uint64_t))
+
+#define ADM_QUEUE_SIZE		32
+#define IO_QUEUE_SIZE		256
+
+#define NSID			1
+
+typedef struct host_queue {
+	uint64_t sq;
+	uint64_t cq;
+	uint16_t size;
+	uint16_t sq_tail;
+	uint16_t cq_head;
+	bool phase;
+	uint32_t sq_db;
+	uint32_t cq_db;
+	int db_idx;		/* SQ entry in the shadow doorbell buffer, the CQ one follows */
+	uint16_t sq_db_last;
+	uint16_t cq_db_last;
+} host_queue_t;
+
+typedef struct host_cmd {
+	uint64_t buf;
+	uint64_t prp_list;
+	uint32_t lba;
+	uint8_t opc;
+	uint64_t submit_ns;
+} host_cmd_t;
+
+/* IO queue pair, the queue ID is also used as the interrupt vector */
+typedef struct host_io_queue {
+	host_queue_t q;
+	uint16_t qid;
+	host_cmd_t *cmds;
+	uint16_t *free_cids;
+	int free_cnt;
+	uint64_t completed;
+	uint32_t *latencies;
+	bool reap_scheduled;
+} host_io_queue_t;
+
+static struct {
+	int qd;
+	uint32_t bs;
+	int read_pct;
+	uint64_t ios;
+	bool verify;
+	unsigned int seed;
+	int queues;
+	int qprio[IO_QUEUES];
+	bool wrr;
+	int arb_burst;
+	int arb_weight[NVME_QPRIO_LEVELS];
+	bool cmb;
+	bool dbbuf;
+	int tier;
+	uint32_t cache_size;
+	uint32_t cache_line;
+	uint64_t working_set;
+	uint32_t apu_ns;
+	uint32_t apu_mbps;
+} opts = {
+	.qd = 32,
+	.queues = 1,
+	.bs = 4096,
+	.read_pct = 100,
+	.ios = 100000,
+	.tier = NVME_BLK_TIER_NONE,
+	.cache_size = SIM_RAMDISK_SIZE,
+	.cache_line = NVME_BLK_CACHE_LINE_SIZE,
+	.apu_ns = 20000,
+	.apu_mbps = 1000,
+};
+
+static host_queue_t adm_q;
+static host_io_queue_t io_qs[IO_QUEUES];
+
+static uint64_t submitted, completed, errors, mismatches;
+static uint64_t reads_done, writes_done;
+static uint32_t *latencies;
+
+static uint64_t cmb_base, cmb_size, cmb_used;
+
+static uint64_t dbbuf_shadow, dbbuf_eventidx;
+static uint64_t mmio_doorbells;
+
+static uint64_t ns_blocks;
+
+static uint8_t *apu_store;
+static uint64_t apu_free_ns;
+static uint64_t apu_reqs;
+
+static inline uint8_t pattern(uint64_t off)
+{
+	return (uint8_t)((off ^ (off >> 9) * 31) & 0xff);
+}
+
+static void fill_pattern(uint8_t *buf, uint64_t off, uint32_t len)
+{
+	for(uint32_t i = 0; i < len; i++)
+		buf[i] = pattern(off + i);
+}
+
+static bool check_pattern(const uint8_t *buf, uint64_t off, uint32_t len)
+{
+	for(uint32_t i = 0; i < len; i++)
+		if(buf[i] != pattern(off + i))
+			return false;
+	return true;
+}
+
+/* Allocates from the Controller Memory Buffer if it is used, falls back to host memory */
+static uint64_t cmb_alloc(uint64_t size, uint64_t align)
+{
+	uint64_t off = (cmb_used + align - 1) / align * align;
+
+	if(!cmb_size || off + size > cmb_size)
+		return sim_host_alloc(size, align);
+
+	cmb_used = off + size;
+	return cmb_base + off;
+}
+
+static void queue_init(host_queue_t *q, uint16_t qid, uint16_t size, uint32_t sq_db, uint32_t cq_db)
+{
+	q->sq = cmb_alloc(size * NVME_TC_SQ_ENTRY_SIZE, HOST_PAGE_SIZE);
+	q->cq = sim_host_alloc(size * NVME_TC_CQ_ENTRY_SIZE, HOST_PAGE_SIZE);
+	q->size = size;
+	q->sq_tail = 0;
+	q->cq_head = 0;
+	q->phase = true;
+	q->sq_db = sq_db;
+	q->cq_db = cq_db;
+	q->db_idx = qid * 2;
+	q->sq_db_last = 0;
+	q->cq_db_last = 0;
+}
+
+/* Same check as the Linux driver, the MMIO doorbell is only needed if the update passes EventIdx */
+static bool dbbuf_need_event(uint16_t event_idx, uint16_t new_idx, uint16_t old)
+{
+	return (uint16_t)(new_idx - event_idx - 1) < (uint16_t)(new_idx - old);
+}
+
+static void ring_doorbell(host_queue_t *q, uint32_t reg, int db_idx, uint16_t *last, uint16_t val)
+{
+	const uint16_t old = *last;
+
+	*last = val;
+
+	if(dbbuf_shadow && q != &adm_q) {
+		uint32_t *shadow = sim_host_ptr(dbbuf_shadow);
+		uint32_t *eventidx = sim_host_ptr(dbbuf_eventidx);
+
+		shadow[db_idx] = val;
+		if(!dbbuf_need_event(eventidx[db_idx], val, old))
+			return;
+	}
+
+	sim_host_write32(reg, val);
+	mmio_doorbells++;
+}
+
+static void queue_ring_sq(host_queue_t *q)
+{
+	ring_doorbell(q, q->sq_db, q->db_idx, &q->sq_db_last, q->sq_tail);
+}
+
+static void queue_ring_cq(host_queue_t *q)
+{
+	ring_doorbell(q, q->cq_db, q->db_idx + 1, &q->cq_db_last, q->cq_head);
+}
+
+static void queue_push(host_queue_t *q, const uint32_t *sqe)
+{
+	memcpy(sim_host_ptr(q->sq + q->sq_tail * NVME_TC_SQ_ENTRY_SIZE), sqe, NVME_TC_SQ_ENTRY_SIZE);
+	q->sq_tail = (q->sq_tail + 1) % q->size;
+}
+
+/* Returns the next completion or NULL, the caller rings the head doorbell */
+static nvme_cq_entry_t *queue_pop(host_queue_t *q)
+{
+	nvme_cq_entry_t *cqe = sim_host_ptr(q->cq + q->cq_head * NVME_TC_CQ_ENTRY_SIZE);
+
+	if(cqe->p != q->phase)
+		return NULL;
+
+	q->cq_head = (q->cq_head + 1) % q->size;
+	if(q->cq_head == 0)
+		q->phase = !q->phase;
+
+	return cqe;
+}
+
+static bool queue_pending(void *arg)
+{
+	host_queue_t *q = arg;
+	nvme_cq_entry_t *cqe = sim_host_ptr(q->cq + q->cq_head * NVME_TC_CQ_ENTRY_SIZE);
+
+	return cqe->p == q->phase;
+}
+
+/* Submits a single command and runs the simulation until it completes */
+static nvme_cq_entry_t sync_cmd(host_queue_t *q, uint32_t *sqe)
+{
+	nvme_cq_entry_t cqe;
+
+	queue_push(q, sqe);
+	queue_ring_sq(q);
+
+	if(!sim_run(queue_pending, q)) {
+		fprintf(stderr, "Command 0x%02x did not complete\n", sqe[0] & 0xff);
+		exit(1);
+	}
+
+	cqe = *queue_pop(q);
+	queue_ring_cq(q);
+
+	return cqe;
+}
+
+static nvme_cq_entry_t admin_cmd(uint32_t *sqe)
+{
+	return sync_cmd(&adm_q, sqe);
+}
+
+static void sqe_init(uint32_t *sqe, uint8_t opc, uint16_t cid, uint64_t prp1, uint64_t prp2)
+{
+	nvme_sq_entry_base_t *base = (nvme_sq_entry_base_t*)sqe;
+
+	memset(sqe, 0, NVME_TC_SQ_ENTRY_SIZE);
+	base->cdw0.opc = opc;
+	base->cdw0.cid = cid;
+	base->nsid = NSID;
+	base->dptr.prp.prp1 = prp1;
+	base->dptr.prp.prp2 = prp2;
+}
+
+static bool controller_ready(void *arg)
+{
+	return sim_host_read32(NVME_TC_REG_CSTS) & NVME_TC_REG_CSTS_RDY;
+}
+
+static void controller_init(void)
+{
+	uint32_t sqe[NVME_TC_SQ_ENTRY_SIZE/4];
+	uint32_t aqa = 0, cc = 0;
+	nvme_cq_entry_t cqe;
+
+	queue_init(&adm_q, ADM_QUEUE_ID, ADM_QUEUE_SIZE, NVME_TC_REG_ADM_TAIL, NVME_TC_REG_ADM_HEAD);
+
+	NVME_TC_SET_FIELD(aqa, ADM_QUEUE_SIZE - 1, AQA_ASQS);
+	NVME_TC_SET_FIELD(aqa, ADM_QUEUE_SIZE - 1, AQA_ACQS);
+	sim_host_write32(NVME_TC_REG_AQA, aqa);
+	sim_host_write32(NVME_TC_REG_ASQ_0, adm_q.sq & 0xffffffff);
+	sim_host_write32(NVME_TC_REG_ASQ_1, adm_q.sq >> 32);
+	sim_host_write32(NVME_TC_REG_ACQ_0, adm_q.cq & 0xffffffff);
+	sim_host_write32(NVME_TC_REG_ACQ_1, adm_q.cq >> 32);
+
+	NVME_TC_SET_FIELD(cc, 6, CC_IOSQES); // 64 bytes
+	NVME_TC_SET_FIELD(cc, 4, CC_IOCQES); // 16 bytes
+	if(opts.wrr)
+		NVME_TC_SET_FIELD(cc, NVME_TC_AMS_WRR, CC_AMS);
+	cc |= NVME_TC_REG_CC_EN;
+	sim_host_write32(NVME_TC_REG_CC, cc);
+
+	if(!sim_run(controller_ready, NULL)) {
+		fprintf(stderr, "Controller did not become ready\n");
+		exit(1);
+	}
+
+	if(opts.cmb) {
+		const uint32_t cmbloc = sim_host_read32(NVME_TC_REG_CMBLOC);
+		const uint32_t cmbsz = sim_host_read32(NVME_TC_REG_CMBSZ);
+		const uint64_t szu = 4096ULL << (4 * ((cmbsz >> NVME_TC_CMBSZ_SZU_SHIFT) & 0xf));
+
+		if(!(cmbsz & NVME_TC_CMBSZ_SQS) || !(cmbsz & NVME_TC_CMBSZ_LISTS)) {
+			fprintf(stderr, "Controller Memory Buffer does not support SQs and PRP lists\n");
+			exit(1);
+		}
+
+		/* The BAR is assigned by the host, tell the controller where it is */
+		cmb_base = SIM_CMB_BUS_BASE + (cmbloc >> NVME_TC_CMBLOC_OFST_SHIFT) * szu;
+		cmb_size = (cmbsz >> NVME_TC_CMBSZ_SZ_SHIFT) * szu;
+		sim_host_write32(NVME_TC_REG_CMBMSC_0, (cmb_base & 0xffffffff) | NVME_TC_CMBMSC_CRE | NVME_TC_CMBMSC_CMSE);
+		sim_host_write32(NVME_TC_REG_CMBMSC_1, cmb_base >> 32);
+	}
+
+	const uint64_t ident = sim_host_alloc(HOST_PAGE_SIZE, HOST_PAGE_SIZE);
+	sqe_init(sqe, NVME_ADM_CMD_IDENTIFY, 0, ident, 0);
+	sqe[10] = 1; // CNS: controller
+	cqe = admin_cmd(sqe);
+	if(cqe.sc || *(uint16_t*)sim_host_ptr(ident) != 0x1b96) {
+		fprintf(stderr, "Identify Controller failed\n");
+		exit(1);
+	}
+
+	sqe_init(sqe, NVME_ADM_CMD_IDENTIFY, 0, ident, 0);
+	sqe[10] = 0; // CNS: namespace
+	cqe = admin_cmd(sqe);
+	ns_blocks = *(uint64_t*)sim_host_ptr(ident); // NSZE
+	if(cqe.sc || !ns_blocks) {
+		fprintf(stderr, "Identify Namespace failed\n");
+		exit(1);
+	}
+
+	sqe_init(sqe, NVME_ADM_CMD_SET_FEATURES, 1, 0, 0);
+	sqe[10] = 0x07; // Number of Queues
+	sqe[11] = ((opts.queues - 1) << 16) | (opts.queues - 1);
+	cqe = admin_cmd(sqe);
+	if((cqe.cdw0 & 0xffff) + 1 < opts.queues) {
+		fprintf(stderr, "Controller allocated only %d IO queues\n", (cqe.cdw0 & 0xffff) + 1);
+		exit(1);
+	}
+
+	if(opts.wrr) {
+		sqe_init(sqe, NVME_ADM_CMD_SET_FEATURES, 1, 0, 0);
+		sqe[10] = 0x01; // Arbitration
+		sqe[11] = (opts.arb_weight[NVME_QPRIO_HIGH] << 24) | (opts.arb_weight[NVME_QPRIO_MEDIUM] << 16) |
+			(opts.arb_weight[NVME_QPRIO_LOW] << 8) | opts.arb_burst;
+		admin_cmd(sqe);
+	}
+
+	/* Configured before the IO queues are created so the zeroed shadow doorbells match their initial state */
+	if(opts.dbbuf) {
+		dbbuf_shadow = sim_host_alloc(HOST_PAGE_SIZE, HOST_PAGE_SIZE);
+		dbbuf_eventidx = sim_host_alloc(HOST_PAGE_SIZE, HOST_PAGE_SIZE);
+		memset(sim_host_ptr(dbbuf_shadow), 0, HOST_PAGE_SIZE);
+		memset(sim_host_ptr(dbbuf_eventidx), 0, HOST_PAGE_SIZE);
+
+		sqe_init(sqe, NVME_ADM_CMD_DBBUF_CONFIG, 1, dbbuf_shadow, dbbuf_eventidx);
+		cqe = admin_cmd(sqe);
+		if(cqe.sc) {
+			fprintf(stderr, "Doorbell Buffer Config failed\n");
+			exit(1);
+		}
+	}
+
+	for(int i = 0; i < opts.queues; i++) {
+		host_io_queue_t *io_q = &io_qs[i];
+
+		queue_init(&io_q->q, io_q->qid, IO_QUEUE_SIZE, NVME_TC_REG_IO_TAIL(i), NVME_TC_REG_IO_HEAD(i));
+
+		sqe_init(sqe, NVME_ADM_CMD_CREATE_IO_CQ, 2, io_q->q.cq, 0);
+		sqe[10] = ((IO_QUEUE_SIZE - 1) << 16) | io_q->qid;
+		sqe[11] = (io_q->qid << 16) | 0x3; // IV, IEN, PC
+		admin_cmd(sqe);
+
+		sqe_init(sqe, NVME_ADM_CMD_CREATE_IO_SQ, 3, io_q->q.sq, 0);
+		sqe[10] = ((IO_QUEUE_SIZE - 1) << 16) | io_q->qid;
+		sqe[11] = (io_q->qid << 16) | (opts.qprio[i] << 1) | 0x1; // CQID, QPRIO, PC
+		admin_cmd(sqe);
+	}
+}
+
+/* Reads len bytes of a log page from off, in a single page buffer */
+static void get_log(uint8_t lid, uint64_t buf, uint32_t len, uint64_t off)
+{
+	uint32_t sqe[NVME_TC_SQ_ENTRY_SIZE/4];
+	const uint32_t numd = len / 4 - 1;
+
+	sqe_init(sqe, NVME_ADM_CMD_GET_LOG, 4, buf, 0);
+	sqe[10] = ((numd & 0xffff) << 16) | lid;
+	sqe[11] = numd >> 16;
+	sqe[12] = off & 0xffffffff;
+	sqe[13] = off >> 32;
+
+	if(admin_cmd(sqe).sc) {
+		fprintf(stderr, "Get Log Page 0x%02x failed\n", lid);
+		exit(1);
+	}
+}
+
+static uint64_t read_u64(const uint8_t *ptr)
+{
+	uint64_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+	return val;
+}
+
+/* Compares the controller statistics with what the host has seen, returns false on a mismatch */
+static bool check_stats(void)
+{
+	static const char *op_names[NVME_STATS_OPS] = { "read", "write", "flush", "io other", "admin" };
+	const uint64_t buf = sim_host_alloc(HOST_PAGE_SIZE, HOST_PAGE_SIZE);
+	const uint8_t *log = sim_host_ptr(buf);
+	uint8_t perf[NVME_STATS_LOG_SIZE];
+	const uint32_t split = 64; // Read in two pieces to exercise the offset
+
+	get_log(0x02, buf, 512, 0);
+	const uint64_t host_reads = read_u64(log + 64), host_writes = read_u64(log + 80);
+	const uint64_t units_read = read_u64(log + 32), units_written = read_u64(log + 48);
+
+	get_log(0xc2, buf, split, 0);
+	memcpy(perf, log, split);
+	get_log(0xc2, buf, (NVME_STATS_LOG_SIZE - split + 3) & ~3, split);
+	memcpy(perf + split, log, NVME_STATS_LOG_SIZE - split);
+
+	const nvme_stats_hdr_t *hdr = (nvme_stats_hdr_t*)perf;
+	const nvme_stats_op_t *ops = (nvme_stats_op_t*)(perf + sizeof(*hdr) + QUEUES*sizeof(nvme_stats_queue_t));
+
+	printf("smart: data units read %llu, written %llu, host reads %llu, writes %llu\n",
+		(unsigned long long)units_read, (unsigned long long)units_written,
+		(unsigned long long)host_reads, (unsigned long long)host_writes);
+	printf("controller busy: %.3f ms of %llu ms\n", hdr->busy_us / 1e3, (unsigned long long)hdr->uptime_ms);
+	for(int op = 0; op < NVME_STATS_OPS; op++) {
+		if(ops[op].cmds)
+			printf("controller latency %s: %llu cmds, avg %.2f us, max %u us\n", op_names[op],
+				(unsigned long long)ops[op].cmds, (double)ops[op].lat_sum_us / ops[op].cmds, ops[op].lat_max_us);
+	}
+
+	const uint64_t expect_read = (reads_done * opts.bs + 512*1000 - 1) / (512*1000);
+	const uint64_t expect_written = (writes_done * opts.bs + 512*1000 - 1) / (512*1000);
+
+	return hdr->magic == NVME_STATS_MAGIC && host_reads == reads_done && host_writes == writes_done &&
+		units_read == expect_read && units_written == expect_written &&
+		ops[NVME_STATS_OP_READ].cmds == reads_done && ops[NVME_STATS_OP_WRITE].cmds == writes_done;
+}
+
+/* Fills the PRP list chain for all pages of buf past the first one, returns the PRP2 value */
+static uint64_t build_prps(host_cmd_t *cmd)
+{
+	const uint32_t pages = (opts.bs + HOST_PAGE_SIZE - 1) / HOST_PAGE_SIZE;
+
+	if(pages == 1)
+		return 0;
+	if(pages == 2)
+		return cmd->buf + HOST_PAGE_SIZE;
+
+	uint64_t list = cmd->prp_list;
+	uint64_t *entries = sim_host_ptr(list);
+	uint32_t e = 0;
+
+	for(uint32_t page = 1; page < pages; page++) {
+		if(e == PRP_ENTRIES - 1 && page != pages - 1) { // Chain to the next list page
+			entries[e] = list + HOST_PAGE_SIZE;
+			list += HOST_PAGE_SIZE;
+			entries = sim_host_ptr(list);
+			e = 0;
+		}
+		entries[e++] = cmd->buf + (uint64_t)page * HOST_PAGE_SIZE;
+	}
+
+	return cmd->prp_list;
+}
+
+static void submit_io(host_io_queue_t *io_q)
+{
+	uint32_t sqe[NVME_TC_SQ_ENTRY_SIZE/4];
+	const uint16_t cid = io_q->free_cids[--io_q->free_cnt];
+	host_cmd_t *cmd = &io_q->cmds[cid];
+	const uint32_t nlb = opts.bs / BLK_SIZE;
+	const uint64_t blocks = opts.working_set ? MIN(opts.working_set / BLK_SIZE, ns_blocks) : ns_blocks;
+
+	cmd->lba = (rand_r(&opts.seed) % (blocks / nlb)) * nlb;
+	cmd->opc = ((rand_r(&opts.seed) % 100) < opts.read_pct) ? NVME_IO_CMD_READ : NVME_IO_CMD_WRITE;
+	cmd->submit_ns = sim_now();
+
+	if(opts.verify && cmd->opc == NVME_IO_CMD_WRITE)
+		fill_pattern(sim_host_ptr(cmd->buf), (uint64_t)cmd->lba * BLK_SIZE, opts.bs);
+
+	sqe_init(sqe, cmd->opc, cid, cmd->buf, build_prps(cmd));
+	sqe[10] = cmd->lba;
+	sqe[12] = nlb - 1;
+
+	queue_push(&io_q->q, sqe);
+	submitted++;
+}
+
+static void reap_cb(void *arg)
+{
+	host_io_queue_t *io_q = arg;
+	nvme_cq_entry_t *cqe;
+	int reaped = 0;
+
+	io_q->reap_scheduled = false;
+
+	while((cqe = queue_pop(&io_q->q))) {
+		host_cmd_t *cmd = &io_q->cmds[cqe->cid];
+
+		if(cqe->sc || cqe->sct)
+			errors++;
+		else if(cmd->opc == NVME_IO_CMD_READ)
+			reads_done++;
+		else
+			writes_done++;
+
+		if(opts.verify && cmd->opc == NVME_IO_CMD_READ &&
+				!check_pattern(sim_host_ptr(cmd->buf), (uint64_t)cmd->lba * BLK_SIZE, opts.bs))
+			mismatches++;
+
+		latencies[completed++] = io_q->latencies[io_q->completed++] = sim_now() - cmd->submit_ns;
+		io_q->free_cids[io_q->free_cnt++] = cqe->cid;
+		reaped++;
+	}
+
+	if(!reaped)
+		return;
+
+	queue_ring_cq(&io_q->q);
+
+	while(io_q->free_cnt && submitted < opts.ios)
+		submit_io(io_q);
+	queue_ring_sq(&io_q->q);
+}
+
+static void msi_handler(uint32_t vectors)
+{
+	for(int i = 0; i < opts.queues; i++) {
+		host_io_queue_t *io_q = &io_qs[i];
+
+		if((vectors & (1 << io_q->qid)) && !io_q->reap_scheduled) {
+			io_q->reap_scheduled = true;
+			sim_schedule(sim_config.host_ns, reap_cb, io_q);
+		}
+	}
+}
+
+static bool all_completed(void *arg)
+{
+	return completed == opts.ios;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint32_t *lat, uint64_t count, double p)
+{
+	uint64_t idx = (uint64_t)(p * (count - 1));
+	return lat[idx] / 1000.0;
+}
+
+static double average_us(const uint32_t *lat, uint64_t count)
+{
+	double sum = 0.0;
+
+	for(uint64_t i = 0; i < count; i++)
+		sum += lat[i];
+	return sum / count / 1000.0;
+}
+
+typedef struct apu_req {
+	uint32_t id;
+	nvme_blk_req_t *req;
+	uint8_t *buf;
+	uint32_t lba;
+	uint32_t nlb;
+} apu_req_t;
+
+static void apu_done_cb(void *arg)
+{
+	apu_req_t *r = arg;
+
+	if(r->id == RPMSG_BLK_READ)
+		memcpy(r->buf, apu_store + (uint64_t)r->lba * BLK_SIZE, r->nlb * BLK_SIZE);
+	else if(r->id == RPMSG_BLK_WRITE)
+		memcpy(apu_store + (uint64_t)r->lba * BLK_SIZE, r->buf, r->nlb * BLK_SIZE);
+
+	nvme_blk_apu_done(r->req, 0);
+	free(r);
+}
+
+/* APU serving the block tier, it handles one request at a time. Blocks are copied when the request
+ * completes, the cache does not touch the line in the meantime. Vendor commands are not modelled. */
+static int apu_rpmsg(const void *data, int len)
+{
+	const nvme_rpmsg_payload_t *msg = data;
+	apu_req_t *r;
+
+	if(msg->id != RPMSG_BLK_READ && msg->id != RPMSG_BLK_WRITE && msg->id != RPMSG_BLK_FLUSH) {
+		fprintf(stderr, "Dropping rpmsg message 0x%x, only block requests are modelled\n", msg->id);
+		return -1;
+	}
+
+	r = malloc(sizeof(*r));
+	r->id = msg->id;
+	r->req = (nvme_blk_req_t*)(uintptr_t)msg->priv;
+	r->buf = (uint8_t*)(uintptr_t)msg->buf;
+	r->lba = msg->data[0];
+	r->nlb = msg->data[1];
+
+	apu_free_ns = MAX(apu_free_ns, sim_now()) + opts.apu_ns + (uint64_t)msg->buf_len * 1000 / opts.apu_mbps;
+	sim_schedule(apu_free_ns - sim_now(), apu_done_cb, r);
+	apu_reqs++;
+
+	return len;
+}
+
+/* Memory holding the namespace after a flush */
+static uint8_t *slow_tier(void)
+{
+	switch(opts.tier) {
+		case NVME_BLK_TIER_DDR:
+			return sim_ddr;
+		case NVME_BLK_TIER_APU:
+			return apu_store;
+		default:
+			return sim_ramdisk;
+	}
+}
+
+/* Flushes the namespace and checks that the slowest tier holds all data written, returns false on a mismatch */
+static bool check_flush(void)
+{
+	uint32_t sqe[NVME_TC_SQ_ENTRY_SIZE/4];
+	host_io_queue_t *io_q = &io_qs[0];
+	nvme_cq_entry_t cqe;
+
+	// Reaped here instead of by the completion handler
+	sim_host_set_msi_handler(NULL);
+
+	sqe_init(sqe, NVME_IO_CMD_FLUSH, 0, 0, 0);
+	cqe = sync_cmd(&io_q->q, sqe);
+	if(cqe.sc || cqe.sct) {
+		printf("flush failed with status 0x%x\n", cqe.sc);
+		return false;
+	}
+
+	return check_pattern(slow_tier(), 0, ns_blocks * BLK_SIZE);
+}
+
+static void print_cache_stats(void)
+{
+	nvme_blk_cache_stats_t stats;
+
+	if(nvme_blk_cache_get_stats(nvme_blk_dev(), &stats))
+		return;
+
+	printf("cache: %u lines, hits %llu, misses %llu (%.1f%% hit), evictions %llu, writebacks %llu, %u dirty",
+		stats.lines, (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+		stats.hits + stats.misses ? 100.0 * stats.hits / (stats.hits + stats.misses) : 0.0,
+		(unsigned long long)stats.evictions, (unsigned long long)stats.writebacks, stats.dirty);
+	if(opts.tier == NVME_BLK_TIER_APU)
+		printf(", %llu apu requests", (unsigned long long)apu_reqs);
+	printf("\n");
+}
+
+/* Parses a comma separated list of at most max integers, returns the number of values */
+static int parse_list(const char *str, int *vals, int max)
+{
+	int n = 0;
+	char *end;
+
+	while(n < max) {
+		vals[n++] = strtol(str, &end, 0);
+		if(*end != ',')
+			break;
+		str = end + 1;
+	}
+	return *end ? -1 : n;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+		"  --qd N              queue depth of each IO queue (default 32, max %d)\n"
+		"  --bs BYTES          transfer size, multiple of %d (default 4096)\n"
+		"  --read-pct N        percentage of reads (default 100)\n"
+		"  --ios N             number of IOs to complete (default 100000)\n"
+		"  --verify            check read data against a known pattern\n"
+		"  --seed N            random seed\n"
+		"  --queues N          number of IO queues (default 1, max %d)\n"
+		"  --qprio P,P,...     QPRIO of each IO queue (0 urgent to 3 low), selects Weighted Round Robin\n"
+		"  --arb-weights H,M,L 0's based High, Medium and Low priority weights (default 0,0,0)\n"
+		"  --arb-burst N       Arbitration Burst, 2^N commands, 7 for no limit (default 0)\n"
+		"  --cmb               place IO SQs and PRP lists in the Controller Memory Buffer\n"
+		"  --dbbuf             use shadow doorbells set up with Doorbell Buffer Config\n"
+		"  --tier T            slow block tier cached by the ramdisk: none, ddr or apu (default none)\n"
+		"  --cache-size BYTES  ramdisk memory used by the cache (default %d)\n"
+		"  --cache-line BYTES  cache line size (default %d)\n"
+		"  --working-set BYTES limit IOs to the start of the namespace\n"
+		"  --apu-latency-ns N  APU handling time of a block request\n"
+		"  --apu-mbps N        APU copy bandwidth in MB/s\n"
+		"  --dma-latency-ns N  DMA setup latency per transfer\n"
+		"  --dma-mbps N        DMA bandwidth per direction in MB/s\n"
+		"  --isr-ns N          firmware cost of an ISR run\n"
+		"  --work-ns N         firmware cost of a work item\n"
+		"  --mmio-ns N         firmware cost of a device register access\n"
+		"  --doorbell-ns N     host register write latency\n"
+		"  --msi-ns N          completion interrupt latency\n"
+		"  --host-ns N         host completion handling cost\n"
+		"  -v                  increase firmware log verbosity\n",
+		name, IO_QUEUE_SIZE - 1, BLK_SIZE, IO_QUEUES, SIM_RAMDISK_SIZE, NVME_BLK_CACHE_LINE_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "qd", required_argument, NULL, 'q' },
+		{ "bs", required_argument, NULL, 'b' },
+		{ "read-pct", required_argument, NULL, 'r' },
+		{ "ios", required_argument, NULL, 'n' },
+		{ "verify", no_argument, NULL, 'V' },
+		{ "seed", required_argument, NULL, 's' },
+		{ "queues", required_argument, NULL, 'Q' },
+		{ "qprio", required_argument, NULL, 'P' },
+		{ "arb-weights", required_argument, NULL, 'W' },
+		{ "arb-burst", required_argument, NULL, 'B' },
+		{ "cmb", no_argument, NULL, 'C' },
+		{ "dbbuf", no_argument, NULL, 'D' },
+		{ "tier", required_argument, NULL, 'T' },
+		{ "cache-size", required_argument, NULL, 'S' },
+		{ "cache-line", required_argument, NULL, 'L' },
+		{ "working-set", required_argument, NULL, 'w' },
+		{ "apu-latency-ns", required_argument, NULL, 9 },
+		{ "apu-mbps", required_argument, NULL, 10 },
+		{ "dma-latency-ns", required_argument, NULL, 1 },
+		{ "dma-mbps", required_argument, NULL, 2 },
+		{ "isr-ns", required_argument, NULL, 3 },
+		{ "work-ns", required_argument, NULL, 4 },
+		{ "mmio-ns", required_argument, NULL, 5 },
+		{ "doorbell-ns", required_argument, NULL, 6 },
+		{ "msi-ns", required_argument, NULL, 7 },
+		{ "host-ns", required_argument, NULL, 8 },
+		{ "help", no_argument, NULL, 'h' },
+		{ 0 },
+	};
+	int opt;
+	bool args_valid = true;
+
+	while((opt = getopt_long(argc, argv, "vh", long_opts, NULL)) != -1) {
+		switch(opt) {
+			case 'q': opts.qd = atoi(optarg); break;
+			case 'b': opts.bs = strtoul(optarg, NULL, 0); break;
+			case 'r': opts.read_pct = atoi(optarg); break;
+			case 'n': opts.ios = strtoull(optarg, NULL, 0); break;
+			case 'V': opts.verify = true; break;
+			case 's': opts.seed = strtoul(optarg, NULL, 0); break;
+			case 'Q': opts.queues = atoi(optarg); break;
+			case 'P':
+				opts.wrr = true;
+				args_valid &= parse_list(optarg, opts.qprio, IO_QUEUES) > 0;
+				break;
+			case 'W':
+				args_valid &= parse_list(optarg, &opts.arb_weight[NVME_QPRIO_HIGH], 3) == 3;
+				break;
+			case 'B': opts.arb_burst = atoi(optarg); break;
+			case 'C': opts.cmb = true; break;
+			case 'D': opts.dbbuf = true; break;
+			case 'T':
+				if(!strcmp(optarg, "none"))
+					opts.tier = NVME_BLK_TIER_NONE;
+				else if(!strcmp(optarg, "ddr"))
+					opts.tier = NVME_BLK_TIER_DDR;
+				else if(!strcmp(optarg, "apu"))
+					opts.tier = NVME_BLK_TIER_APU;
+				else
+					args_valid = false;
+				break;
+			case 'S': opts.cache_size = strtoul(optarg, NULL, 0); break;
+			case 'L': opts.cache_line = strtoul(optarg, NULL, 0); break;
+			case 'w': opts.working_set = strtoull(optarg, NULL, 0); break;
+			case 1: sim_config.dma_latency_ns = strtoul(optarg, NULL, 0); break;
+			case 2: sim_config.dma_mbps = strtoul(optarg, NULL, 0); break;
+			case 3: sim_config.isr_ns = strtoul(optarg, NULL, 0); break;
+			case 4: sim_config.work_ns = strtoul(optarg, NULL, 0); break;
+			case 5: sim_config.mmio_ns = strtoul(optarg, NULL, 0); break;
+			case 6: sim_config.doorbell_ns = strtoul(optarg, NULL, 0); break;
+			case 7: sim_config.msi_ns = strtoul(optarg, NULL, 0); break;
+			case 8: sim_config.host_ns = strtoul(optarg, NULL, 0); break;
+			case 9: opts.apu_ns = strtoul(optarg, NULL, 0); break;
+			case 10: opts.apu_mbps = strtoul(optarg, NULL, 0); break;
+			case 'v': sim_config.log_level++; break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	for(int i = 0; i < IO_QUEUES; i++)
+		args_valid &= opts.qprio[i] >= NVME_QPRIO_URGENT && opts.qprio[i] <= NVME_QPRIO_LOW;
+	for(int i = NVME_QPRIO_HIGH; i < NVME_QPRIO_LEVELS; i++)
+		args_valid &= opts.arb_weight[i] >= 0 && opts.arb_weight[i] <= 0xff;
+
+	if(!args_valid || opts.queues < 1 || opts.queues > IO_QUEUES || opts.arb_burst < 0 || opts.arb_burst > 7 ||
+			opts.qd < 1 || opts.qd >= IO_QUEUE_SIZE || opts.bs == 0 || opts.bs % BLK_SIZE ||
+			opts.bs > NVME_BUFFER_SIZE || opts.ios == 0 || sim_config.dma_mbps == 0 || opts.apu_mbps == 0 ||
+			opts.cache_size > SIM_RAMDISK_SIZE || (opts.working_set && opts.working_set < opts.bs)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	sim_init();
+
+	/* Same order as init() in main.c, with the tiers chosen here and without rpmsg */
+	const nvme_blk_config_t blk_cfg = {
+		.tier = opts.tier,
+		.fast_base = (mem_addr_t)sim_ramdisk,
+		.fast_size = (opts.tier == NVME_BLK_TIER_NONE) ? SIM_RAMDISK_SIZE : opts.cache_size,
+		.cache_line_size = opts.cache_line,
+		.slow_base = (mem_addr_t)sim_ddr,
+		.slow_size = SIM_DDR_SIZE,
+	};
+	void *dma_priv = nvme_dma_init();
+	nvme_tc_priv_t *tc = nvme_tc_init(dma_priv);
+	static struct k_mem_pool buffer_pool = { .max_size = NVME_BUFFER_SIZE };
+	tc->buffer_pool = &buffer_pool;
+	if(nvme_blk_setup(tc, &blk_cfg)) {
+		fprintf(stderr, "Failed to set up the block device\n");
+		return 1;
+	}
+	nvme_dma_irq_init();
+	nvme_tc_irq_init();
+
+	if(opts.tier == NVME_BLK_TIER_APU) {
+		apu_store = malloc(SIM_DDR_SIZE);
+		sim_set_rpmsg_handler(apu_rpmsg);
+		nvme_blk_apu_set_count(SIM_DDR_SIZE / BLK_SIZE); // Announced by the APU once it is up
+	}
+
+	if(opts.verify)
+		fill_pattern(slow_tier(), 0, nvme_blk_count() * BLK_SIZE);
+
+	for(int q = 0; q < opts.queues; q++)
+		io_qs[q].qid = q + 1;
+
+	sim_host_set_msi_handler(msi_handler);
+	controller_init();
+
+	const uint32_t pages = (opts.bs + HOST_PAGE_SIZE - 1) / HOST_PAGE_SIZE;
+	const uint32_t list_pages = pages / (PRP_ENTRIES - 1) + 1;
+
+	latencies = calloc(opts.ios, sizeof(*latencies));
+	for(int q = 0; q < opts.queues; q++) {
+		host_io_queue_t *io_q = &io_qs[q];
+
+		io_q->cmds = calloc(opts.qd, sizeof(*io_q->cmds));
+		io_q->free_cids = calloc(opts.qd, sizeof(*io_q->free_cids));
+		io_q->latencies = calloc(opts.ios, sizeof(*io_q->latencies));
+		for(int i = 0; i < opts.qd; i++) {
+			io_q->cmds[i].buf = sim_host_alloc(opts.bs, HOST_PAGE_SIZE);
+			io_q->cmds[i].prp_list = cmb_alloc((uint64_t)list_pages * HOST_PAGE_SIZE, HOST_PAGE_SIZE);
+			io_q->free_cids[io_q->free_cnt++] = opts.qd - 1 - i;
+		}
+	}
+
+	const uint64_t start_ns = sim_now();
+	const sim_stats_t start_stats = sim_stats;
+	const uint64_t start_doorbells = mmio_doorbells;
+
+	for(int q = 0; q < opts.queues; q++) {
+		host_io_queue_t *io_q = &io_qs[q];
+
+		while(io_q->free_cnt && submitted < opts.ios)
+			submit_io(io_q);
+		queue_ring_sq(&io_q->q);
+	}
+
+	if(!sim_run(all_completed, NULL)) {
+		fprintf(stderr, "Simulation stalled with %llu of %llu IOs completed\n",
+			(unsigned long long)completed, (unsigned long long)opts.ios);
+		return 1;
+	}
+
+	const double elapsed_s = (sim_now() - start_ns) / 1e9;
+	const double lat_avg = average_us(latencies, completed);
+
+	qsort(latencies, completed, sizeof(*latencies), cmp_u32);
+
+	printf("queues: %d, qd: %d, bs: %u, reads: %d%%, ios: %llu\n", opts.queues, opts.qd, opts.bs, opts.read_pct,
+		(unsigned long long)completed);
+	printf("simulated time: %.3f ms\n", elapsed_s * 1e3);
+	printf("iops: %.0f\n", completed / elapsed_s);
+	printf("bandwidth: %.1f MB/s\n", completed * (double)opts.bs / elapsed_s / 1e6);
+	printf("latency us: avg %.2f, p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+		lat_avg, percentile_us(latencies, completed, 0.5), percentile_us(latencies, completed, 0.99),
+		percentile_us(latencies, completed, 0.999), latencies[completed - 1] / 1000.0);
+	for(int q = 0; opts.queues > 1 && q < opts.queues; q++) {
+		host_io_queue_t *io_q = &io_qs[q];
+
+		if(!io_q->completed)
+			continue;
+
+		const double avg = average_us(io_q->latencies, io_q->completed);
+
+		qsort(io_q->latencies, io_q->completed, sizeof(*io_q->latencies), cmp_u32);
+		printf("queue %d (qprio %d): iops %.0f, latency us: avg %.2f, p50 %.2f, p99 %.2f\n", io_q->qid,
+			opts.qprio[q], io_q->completed / elapsed_s, avg, percentile_us(io_q->latencies, io_q->completed, 0.5),
+			percentile_us(io_q->latencies, io_q->completed, 0.99));
+	}
+	printf("firmware: cpu %.1f%%, per io: %.2f isr, %.2f work items, %.1f mmio, %.2f dma\n",
+		(sim_stats.cpu_busy_ns - start_stats.cpu_busy_ns) / 1e9 / elapsed_s * 100.0,
+		(double)(sim_stats.isr_runs - start_stats.isr_runs) / completed,
+		(double)(sim_stats.work_items - start_stats.work_items) / completed,
+		(double)(sim_stats.mmio_accesses - start_stats.mmio_accesses) / completed,
+		(double)(sim_stats.dma_xfers - start_stats.dma_xfers) / completed);
+	printf("host: %.2f mmio doorbells per io\n", (double)(mmio_doorbells - start_doorbells) / completed);
+	print_cache_stats();
+
+	if(opts.verify && !check_stats()) {
+		printf("controller statistics do not match the host\n");
+		return 1;
+	}
+
+	if(opts.verify && !check_flush()) {
+		printf("flushed data does not match the host\n");
+		return 1;
+	}
+
+	if(errors || mismatches) {
+		printf("errors: %llu, data mismatches: %llu\n", (unsigned long long)errors, (unsigned long long)mismatches);
+		return 1;
+	}
+
+	return 0;
+}
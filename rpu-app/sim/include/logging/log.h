@@ -0,0 +1,25 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SIM_LOGGING_LOG_H
+#define SIM_LOGGING_LOG_H
+
+#include "sim.h"
+
+#define LOG_LEVEL_ERR	1
+#define LOG_LEVEL_WRN	2
+#define LOG_LEVEL_INF	3
+#define LOG_LEVEL_DBG	4
+
+#define LOG_MODULE_DECLARE(name, level)	extern int sim_log_level
+
+#define LOG_ERR(...)	sim_log(LOG_LEVEL_ERR, __func__, __VA_ARGS__)
+#define LOG_WRN(...)	sim_log(LOG_LEVEL_WRN, __func__, __VA_ARGS__)
+#define LOG_INF(...)	sim_log(LOG_LEVEL_INF, __func__, __VA_ARGS__)
+#define LOG_DBG(...)	sim_log(LOG_LEVEL_DBG, __func__, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Messages sent over rpmsg go to the handler installed with sim_set_rpmsg_handler, if any */
+
+#ifndef SIM_OPENAMP_OPEN_AMP_H
+#define SIM_OPENAMP_OPEN_AMP_H
+
+#include <stdint.h>
+
+typedef uint32_t u32_t;
+
+struct rpmsg_device;
+
+struct rpmsg_endpoint {
+	uint32_t addr;
+};
+
+int rpmsg_send(struct rpmsg_endpoint *ept, const void *data, int len);
+
+#endif
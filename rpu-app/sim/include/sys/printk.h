@@ -0,0 +1,15 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SIM_SYS_PRINTK_H
+#define SIM_SYS_PRINTK_H
+
+#include <stdio.h>
+
+#define printk printf
+
+#endif
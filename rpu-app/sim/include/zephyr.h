@@ -0,0 +1,229 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Minimal subset of the Zephyr kernel API used by the controller sources, backed by the simulator */
+
+#ifndef SIM_ZEPHYR_H
+#define SIM_ZEPHYR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sim.h"
+
+typedef uintptr_t mem_addr_t;
+
+#define __aligned(x)	__attribute__((__aligned__(x)))
+#define CONTAINER_OF(ptr, type, field)	((type *)(((char *)(ptr)) - offsetof(type, field)))
+#define MIN(a, b)	(((a) < (b)) ? (a) : (b))
+#define MAX(a, b)	(((a) > (b)) ? (a) : (b))
+#define __DMB()		__sync_synchronize()
+
+#define CONFIG_BOARD	"sim"
+
+/* Device tree */
+
+#define DT_INST_0_NVME_TC_BASE_ADDRESS		((mem_addr_t)sim_tc_regs)
+#define DT_INST_0_NVME_TC_IRQ_0			SIM_IRQ_TC
+#define DT_INST_0_NVME_TC_IRQ_0_PRIORITY	0
+#define DT_INST_0_NVME_TC_IRQ_0_FLAGS		0
+
+#define DT_INST_0_NVME_DMA_BASE_ADDRESS		((mem_addr_t)sim_dma_regs)
+#define DT_INST_0_NVME_DMA_IRQ_0		SIM_IRQ_DMA
+#define DT_INST_0_NVME_DMA_IRQ_0_PRIORITY	0
+#define DT_INST_0_NVME_DMA_IRQ_0_FLAGS		0
+
+#define DT_INST_1_MMIO_SRAM_BASE_ADDRESS	((mem_addr_t)sim_ramdisk)
+#define DT_INST_1_MMIO_SRAM_SIZE		SIM_RAMDISK_SIZE
+#define DT_MMIO_SRAM_A0100000_BASE_ADDRESS	((mem_addr_t)sim_cmb)
+#define DT_MMIO_SRAM_A0100000_SIZE		SIM_CMB_SIZE
+#define DT_MMIO_SRAM_40000000_BASE_ADDRESS	((mem_addr_t)sim_ddr)
+#define DT_MMIO_SRAM_40000000_SIZE		SIM_DDR_SIZE
+
+/* Register access, device ranges are routed to the register models */
+
+static inline uint32_t sys_read32(mem_addr_t addr)
+{
+	if(sim_is_mmio(addr))
+		return sim_mmio_read32(addr);
+	return *(volatile uint32_t*)addr;
+}
+
+static inline void sys_write32(uint32_t data, mem_addr_t addr)
+{
+	if(sim_is_mmio(addr))
+		sim_mmio_write32(data, addr);
+	else
+		*(volatile uint32_t*)addr = data;
+}
+
+static inline void sys_write16(uint16_t data, mem_addr_t addr)
+{
+	*(volatile uint16_t*)addr = data;
+}
+
+static inline void sys_write8(uint8_t data, mem_addr_t addr)
+{
+	*(volatile uint8_t*)addr = data;
+}
+
+/* Interrupts are only delivered between ISRs and work items, so locking is a no-op */
+
+#define IRQ_CONNECT(irq, prio, isr, arg, flags)	sim_irq_connect((irq), (void (*)(void*))(isr), (void*)(arg))
+
+static inline void irq_enable(unsigned int irq)
+{
+	sim_irq_enable(irq);
+}
+
+static inline unsigned int irq_lock(void)
+{
+	return 0;
+}
+
+static inline void irq_unlock(unsigned int key)
+{
+	(void)key;
+}
+
+/* Atomics */
+
+typedef int atomic_t;
+typedef atomic_t atomic_val_t;
+
+#define ATOMIC_INIT(i)	(i)
+
+static inline atomic_val_t atomic_get(const atomic_t *target)
+{
+	return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_set(atomic_t *target, atomic_val_t value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_clear(atomic_t *target)
+{
+	return atomic_set(target, 0);
+}
+
+static inline atomic_val_t atomic_inc(atomic_t *target)
+{
+	return __atomic_fetch_add(target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_dec(atomic_t *target)
+{
+	return __atomic_fetch_sub(target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_or(atomic_t *target, atomic_val_t value)
+{
+	return __atomic_fetch_or(target, value, __ATOMIC_SEQ_CST);
+}
+
+/* Timing */
+
+static inline uint32_t k_cycle_get_32(void)
+{
+	return (uint32_t)sim_cycles();
+}
+
+static inline int sys_clock_hw_cycles_per_sec(void)
+{
+	return SIM_CPU_HZ;
+}
+
+static inline int64_t k_uptime_get(void)
+{
+	return sim_cycles() / (SIM_CPU_HZ / 1000);
+}
+
+/* Memory */
+
+#define K_NO_WAIT	0
+#define K_FOREVER	(-1)
+
+struct k_mem_slab {
+	char *buffer;
+	size_t block_size;
+	uint32_t num_blocks;
+	char *free_list;
+	uint32_t num_used;
+};
+
+int k_mem_slab_init(struct k_mem_slab *slab, void *buffer, size_t block_size, uint32_t num_blocks);
+int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem, int32_t timeout);
+void k_mem_slab_free(struct k_mem_slab *slab, void **mem);
+
+struct k_mem_pool {
+	size_t max_size;
+};
+
+struct k_mem_block {
+	void *data;
+	size_t size;
+};
+
+int k_mem_pool_alloc(struct k_mem_pool *pool, struct k_mem_block *block, size_t size, int32_t timeout);
+void k_mem_pool_free(struct k_mem_block *block);
+
+static inline void *k_malloc(size_t size)
+{
+	return malloc(size);
+}
+
+static inline void k_free(void *ptr)
+{
+	free(ptr);
+}
+
+/* FIFOs, items reserve their first word for the list link */
+
+struct k_fifo {
+	void *head;
+	void *tail;
+};
+
+void k_fifo_init(struct k_fifo *fifo);
+void k_fifo_put(struct k_fifo *fifo, void *data);
+void *k_fifo_get(struct k_fifo *fifo, int32_t timeout);
+void *k_fifo_peek_head(struct k_fifo *fifo);
+
+/* Threads and work queues, all work queue threads are cooperative */
+
+typedef char k_thread_stack_t;
+
+#define K_THREAD_STACK_DEFINE(sym, size)	static k_thread_stack_t sym[1]
+#define K_THREAD_STACK_SIZEOF(sym)		sizeof(sym)
+#define K_PRIO_COOP(x)				(-16 + (x))
+
+struct k_work;
+typedef void (*k_work_handler_t)(struct k_work *work);
+
+struct k_work {
+	void *_reserved;
+	k_work_handler_t handler;
+	atomic_t pending;
+};
+
+struct k_work_q {
+	struct k_fifo queue;
+	int prio;
+	struct k_work_q *next;
+};
+
+void k_work_init(struct k_work *work, k_work_handler_t handler);
+void k_work_q_start(struct k_work_q *work_q, k_thread_stack_t *stack, size_t stack_size, int prio);
+void k_work_submit_to_queue(struct k_work_q *work_q, struct k_work *work);
+
+#endif
@@ -0,0 +1,562 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Discrete event model of the target controller, PCIe DMA engine and the RPU running the firmware.
+ *
+ * Firmware code runs natively, one ISR or work item at a time, and is charged a configurable cost
+ * in simulated time. Interrupts are only taken between ISRs and work items, as if every work item
+ * ran with interrupts locked. This is coarser than the hardware but keeps ordering deterministic. */
+
+#include "sim.h"
+
+#include <zephyr.h>
+#include <openamp/open_amp.h>
+#include <logging/log.h>
+
+#include "tc.h"
+#include "dma.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+
+sim_config_t sim_config = {
+	.dma_latency_ns = 1000,
+	.dma_mbps = 2000,
+	.isr_ns = 400,
+	.work_ns = 1500,
+	.mmio_ns = 40,
+	.doorbell_ns = 300,
+	.msi_ns = 1000,
+	.host_ns = 500,
+	.host_mem_size = 512*1024*1024,
+	.log_level = LOG_LEVEL_WRN,
+};
+
+sim_stats_t sim_stats;
+
+uint32_t sim_tc_regs[SIM_TC_REGS_SIZE/4];
+uint32_t sim_dma_regs[SIM_DMA_REGS_SIZE/4];
+uint8_t __aligned(4096) sim_ramdisk[SIM_RAMDISK_SIZE];
+uint8_t __aligned(4096) sim_cmb[SIM_CMB_SIZE];
+uint8_t __aligned(4096) sim_ddr[SIM_DDR_SIZE];
+
+/* Events */
+
+typedef struct sim_event {
+	uint64_t time;
+	uint64_t seq;
+	sim_event_cb *cb;
+	void *arg;
+} sim_event_t;
+
+static sim_event_t *events;
+static size_t events_len, events_cap;
+static uint64_t events_seq;
+
+static uint64_t now_ns;
+static uint64_t cpu_free_ns;
+static uint64_t item_mmio_base;
+
+static bool event_before(const sim_event_t *a, const sim_event_t *b)
+{
+	return (a->time < b->time) || (a->time == b->time && a->seq < b->seq);
+}
+
+void sim_schedule(uint64_t delay_ns, sim_event_cb *cb, void *arg)
+{
+	if(events_len == events_cap) {
+		events_cap = events_cap ? events_cap * 2 : 1024;
+		events = realloc(events, events_cap * sizeof(*events));
+	}
+
+	size_t i = events_len++;
+	sim_event_t ev = { now_ns + delay_ns, events_seq++, cb, arg };
+
+	while(i > 0 && event_before(&ev, &events[(i - 1) / 2])) {
+		events[i] = events[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	events[i] = ev;
+}
+
+static sim_event_t pop_event(void)
+{
+	sim_event_t top = events[0];
+	sim_event_t last = events[--events_len];
+	size_t i = 0;
+
+	while(2 * i + 1 < events_len) {
+		size_t c = 2 * i + 1;
+		if(c + 1 < events_len && event_before(&events[c + 1], &events[c]))
+			c++;
+		if(!event_before(&events[c], &last))
+			break;
+		events[i] = events[c];
+		i = c;
+	}
+	if(events_len)
+		events[i] = last;
+
+	return top;
+}
+
+uint64_t sim_now(void)
+{
+	return now_ns;
+}
+
+uint64_t sim_cycles(void)
+{
+	return now_ns * (SIM_CPU_HZ / 1000000) / 1000;
+}
+
+/* Time the firmware item being run has spent so far, register side effects are delayed by it */
+static uint64_t item_elapsed(void)
+{
+	return (sim_stats.mmio_accesses - item_mmio_base) * sim_config.mmio_ns;
+}
+
+void sim_log(int level, const char *func, const char *fmt, ...)
+{
+	static const char *names[] = { "", "err", "wrn", "inf", "dbg" };
+	va_list args;
+
+	if(level > sim_config.log_level)
+		return;
+
+	fprintf(stderr, "[%12.3f us] <%s> %s: ", now_ns / 1000.0, names[level], func);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+}
+
+/* Interrupts */
+
+static struct {
+	void (*isr)(void*);
+	void *arg;
+	bool enabled;
+} irqs[SIM_IRQS];
+
+void sim_irq_connect(unsigned int irq, void (*isr)(void*), void *arg)
+{
+	irqs[irq].isr = isr;
+	irqs[irq].arg = arg;
+}
+
+void sim_irq_enable(unsigned int irq)
+{
+	irqs[irq].enabled = true;
+}
+
+/* Target controller registers, host writes are reported to the firmware through the IRQ_STA/IRQ_DAT FIFO */
+
+#define TC_WRITE_FIFO_SIZE	4096
+
+static uint32_t tc_writes[TC_WRITE_FIFO_SIZE];
+static uint32_t tc_writes_head, tc_writes_tail;
+
+static void (*msi_handler)(uint32_t vectors);
+
+typedef struct host_write {
+	uint32_t reg;
+	uint32_t data;
+} host_write_t;
+
+static void host_write_cb(void *arg)
+{
+	host_write_t *w = arg;
+
+	sim_tc_regs[w->reg / 4] = w->data;
+	if(tc_writes_tail - tc_writes_head == TC_WRITE_FIFO_SIZE)
+		sim_log(LOG_LEVEL_ERR, __func__, "Host write FIFO overflow!");
+	else
+		tc_writes[tc_writes_tail++ % TC_WRITE_FIFO_SIZE] = w->reg / 4;
+	free(w);
+}
+
+void sim_host_write32(uint32_t reg, uint32_t data)
+{
+	host_write_t *w = malloc(sizeof(*w));
+
+	w->reg = reg;
+	w->data = data;
+	sim_schedule(sim_config.doorbell_ns, host_write_cb, w);
+}
+
+uint32_t sim_host_read32(uint32_t reg)
+{
+	return sim_tc_regs[reg / 4];
+}
+
+void sim_host_set_msi_handler(void (*handler)(uint32_t vectors))
+{
+	msi_handler = handler;
+}
+
+static void msi_cb(void *arg)
+{
+	if(msi_handler)
+		msi_handler((uint32_t)(uintptr_t)arg);
+}
+
+static uint32_t tc_read(uint32_t off)
+{
+	if(off == NVME_TC_REG_IRQ_STA)
+		return tc_writes_tail != tc_writes_head;
+
+	if(off == NVME_TC_REG_IRQ_DAT) {
+		if(tc_writes_tail == tc_writes_head)
+			return 0;
+		return tc_writes[tc_writes_head++ % TC_WRITE_FIFO_SIZE];
+	}
+
+	return sim_tc_regs[off / 4];
+}
+
+static void tc_write(uint32_t data, uint32_t off)
+{
+	if(off == NVME_TC_REG_IRQ_HOST) {
+		sim_stats.msis++;
+		sim_schedule(item_elapsed() + sim_config.msi_ns, msi_cb, (void*)(uintptr_t)data);
+		return;
+	}
+
+	sim_tc_regs[off / 4] = data;
+}
+
+/* DMA engine, one transfer in flight per channel, status is cleared on read */
+
+static uint8_t *host_mem;
+static uint64_t host_mem_used;
+
+void *sim_host_ptr(uint64_t host_addr)
+{
+	if(host_addr - SIM_CMB_BUS_BASE < SIM_CMB_SIZE)
+		return sim_cmb + (host_addr - SIM_CMB_BUS_BASE);
+
+	if(host_addr < SIM_HOST_MEM_BASE || host_addr - SIM_HOST_MEM_BASE >= sim_config.host_mem_size) {
+		sim_log(LOG_LEVEL_ERR, __func__, "Host address out of range! (0x%llx)", (unsigned long long)host_addr);
+		abort();
+	}
+	return host_mem + (host_addr - SIM_HOST_MEM_BASE);
+}
+
+uint64_t sim_host_alloc(uint64_t size, uint64_t align)
+{
+	uint64_t off = (host_mem_used + align - 1) / align * align;
+
+	if(off + size > sim_config.host_mem_size) {
+		sim_log(LOG_LEVEL_ERR, __func__, "Out of host memory!");
+		abort();
+	}
+	host_mem_used = off + size;
+	return SIM_HOST_MEM_BASE + off;
+}
+
+static void dma_done_cb(void *arg)
+{
+	const uint32_t base = (uint32_t)(uintptr_t)arg;
+	const uint64_t host_addr = ((uint64_t)sim_dma_regs[(base + NVME_DMA_REG_PCIE_ADDRH) / 4] << 32) |
+		sim_dma_regs[(base + NVME_DMA_REG_PCIE_ADDRL) / 4];
+	void *local = (void*)(uintptr_t)sim_dma_regs[(base + NVME_DMA_REG_AXI_ADDRL) / 4];
+	const uint32_t len = sim_dma_regs[(base + NVME_DMA_REG_LEN) / 4];
+
+	if(base == NVME_DMA_REG_READ_BASE)
+		memcpy(local, sim_host_ptr(host_addr), len);
+	else
+		memcpy(sim_host_ptr(host_addr), local, len);
+
+	sim_stats.dma_xfers++;
+	sim_stats.dma_bytes += len;
+	sim_dma_regs[(base + NVME_DMA_REG_STATUS) / 4] = NVME_DMA_REG_STATUS_VALID | sim_dma_regs[(base + NVME_DMA_REG_TAG) / 4];
+}
+
+static uint32_t dma_read(uint32_t off)
+{
+	uint32_t val = sim_dma_regs[off / 4];
+
+	if(off == NVME_DMA_REG_READ_BASE + NVME_DMA_REG_STATUS || off == NVME_DMA_REG_WRITE_BASE + NVME_DMA_REG_STATUS)
+		sim_dma_regs[off / 4] = 0;
+
+	return val;
+}
+
+static void dma_write(uint32_t data, uint32_t off)
+{
+	sim_dma_regs[off / 4] = data;
+
+	if(off == NVME_DMA_REG_READ_BASE + NVME_DMA_REG_TAG || off == NVME_DMA_REG_WRITE_BASE + NVME_DMA_REG_TAG) {
+		const uint32_t base = off - NVME_DMA_REG_TAG;
+		const uint64_t len = sim_dma_regs[(base + NVME_DMA_REG_LEN) / 4];
+		const uint64_t delay = sim_config.dma_latency_ns + len * 1000 / sim_config.dma_mbps;
+
+		sim_schedule(item_elapsed() + delay, dma_done_cb, (void*)(uintptr_t)base);
+	}
+}
+
+static bool irq_pending(unsigned int irq)
+{
+	if(irq == SIM_IRQ_TC)
+		return tc_writes_tail != tc_writes_head;
+
+	return (sim_dma_regs[(NVME_DMA_REG_READ_BASE + NVME_DMA_REG_STATUS) / 4] |
+		sim_dma_regs[(NVME_DMA_REG_WRITE_BASE + NVME_DMA_REG_STATUS) / 4]) & NVME_DMA_REG_STATUS_VALID;
+}
+
+/* CMB accesses are plain memory but cost the same as register accesses */
+bool sim_is_mmio(uintptr_t addr)
+{
+	return (addr - (uintptr_t)sim_tc_regs < SIM_TC_REGS_SIZE) || (addr - (uintptr_t)sim_dma_regs < SIM_DMA_REGS_SIZE) ||
+		(addr - (uintptr_t)sim_cmb < SIM_CMB_SIZE);
+}
+
+uint32_t sim_mmio_read32(uintptr_t addr)
+{
+	sim_stats.mmio_accesses++;
+	if(addr - (uintptr_t)sim_tc_regs < SIM_TC_REGS_SIZE)
+		return tc_read(addr - (uintptr_t)sim_tc_regs);
+	if(addr - (uintptr_t)sim_cmb < SIM_CMB_SIZE)
+		return *(uint32_t*)addr;
+	return dma_read(addr - (uintptr_t)sim_dma_regs);
+}
+
+void sim_mmio_write32(uint32_t data, uintptr_t addr)
+{
+	sim_stats.mmio_accesses++;
+	if(addr - (uintptr_t)sim_tc_regs < SIM_TC_REGS_SIZE)
+		tc_write(data, addr - (uintptr_t)sim_tc_regs);
+	else if(addr - (uintptr_t)sim_cmb < SIM_CMB_SIZE)
+		*(uint32_t*)addr = data;
+	else
+		dma_write(data, addr - (uintptr_t)sim_dma_regs);
+}
+
+/* Kernel objects */
+
+int k_mem_slab_init(struct k_mem_slab *slab, void *buffer, size_t block_size, uint32_t num_blocks)
+{
+	slab->buffer = buffer;
+	slab->block_size = block_size;
+	slab->num_blocks = num_blocks;
+	slab->num_used = 0;
+	slab->free_list = NULL;
+
+	for(uint32_t i = 0; i < num_blocks; i++) {
+		char *block = slab->buffer + i * block_size;
+		*(char**)block = slab->free_list;
+		slab->free_list = block;
+	}
+
+	return 0;
+}
+
+int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem, int32_t timeout)
+{
+	if(!slab->free_list) {
+		*mem = NULL;
+		return -ENOMEM;
+	}
+
+	*mem = slab->free_list;
+	slab->free_list = *(char**)slab->free_list;
+	slab->num_used++;
+	return 0;
+}
+
+void k_mem_slab_free(struct k_mem_slab *slab, void **mem)
+{
+	*(char**)*mem = slab->free_list;
+	slab->free_list = *mem;
+	slab->num_used--;
+}
+
+int k_mem_pool_alloc(struct k_mem_pool *pool, struct k_mem_block *block, size_t size, int32_t timeout)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_32BIT
+	flags |= MAP_32BIT;
+#endif
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+	if(size > pool->max_size || data == MAP_FAILED)
+		return -ENOMEM;
+
+	if((uintptr_t)data + size > UINT32_MAX) {
+		munmap(data, size);
+		return -ENOMEM;
+	}
+
+	block->data = data;
+	block->size = size;
+	return 0;
+}
+
+void k_mem_pool_free(struct k_mem_block *block)
+{
+	munmap(block->data, block->size);
+	block->data = NULL;
+}
+
+void k_fifo_init(struct k_fifo *fifo)
+{
+	fifo->head = fifo->tail = NULL;
+}
+
+void k_fifo_put(struct k_fifo *fifo, void *data)
+{
+	*(void**)data = NULL;
+	if(fifo->tail)
+		*(void**)fifo->tail = data;
+	else
+		fifo->head = data;
+	fifo->tail = data;
+}
+
+void *k_fifo_get(struct k_fifo *fifo, int32_t timeout)
+{
+	void *data = fifo->head;
+
+	if(data) {
+		fifo->head = *(void**)data;
+		if(!fifo->head)
+			fifo->tail = NULL;
+	}
+	return data;
+}
+
+void *k_fifo_peek_head(struct k_fifo *fifo)
+{
+	return fifo->head;
+}
+
+static struct k_work_q *work_queues;
+
+void k_work_init(struct k_work *work, k_work_handler_t handler)
+{
+	work->_reserved = NULL;
+	work->handler = handler;
+	work->pending = 0;
+}
+
+void k_work_q_start(struct k_work_q *work_q, k_thread_stack_t *stack, size_t stack_size, int prio)
+{
+	struct k_work_q **q = &work_queues;
+
+	k_fifo_init(&work_q->queue);
+	work_q->prio = prio;
+
+	while(*q && (*q)->prio <= prio)
+		q = &(*q)->next;
+	work_q->next = *q;
+	*q = work_q;
+}
+
+void k_work_submit_to_queue(struct k_work_q *work_q, struct k_work *work)
+{
+	if(!atomic_set(&work->pending, 1))
+		k_fifo_put(&work_q->queue, work);
+}
+
+static int (*rpmsg_handler)(const void *data, int len);
+
+void sim_set_rpmsg_handler(int (*handler)(const void *data, int len))
+{
+	rpmsg_handler = handler;
+}
+
+int rpmsg_send(struct rpmsg_endpoint *ept, const void *data, int len)
+{
+	if(rpmsg_handler)
+		return rpmsg_handler(data, len);
+
+	sim_log(LOG_LEVEL_WRN, __func__, "APU is not simulated, dropping rpmsg message");
+	return -1;
+}
+
+/* Scheduler */
+
+static void charge(uint64_t base_ns)
+{
+	const uint64_t cost = base_ns + item_elapsed();
+
+	sim_stats.cpu_busy_ns += cost;
+	cpu_free_ns = now_ns + cost;
+}
+
+static bool run_firmware(void)
+{
+	item_mmio_base = sim_stats.mmio_accesses;
+
+	for(unsigned int irq = 0; irq < SIM_IRQS; irq++) {
+		if(irqs[irq].enabled && irq_pending(irq)) {
+			irqs[irq].isr(irqs[irq].arg);
+			sim_stats.isr_runs++;
+			charge(sim_config.isr_ns);
+			return true;
+		}
+	}
+
+	for(struct k_work_q *q = work_queues; q; q = q->next) {
+		struct k_work *work = k_fifo_get(&q->queue, K_NO_WAIT);
+		if(work) {
+			atomic_clear(&work->pending);
+			work->handler(work);
+			sim_stats.work_items++;
+			charge(sim_config.work_ns);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool sim_run(bool (*done)(void *arg), void *arg)
+{
+	while(!done(arg)) {
+		const uint64_t cpu_at = (cpu_free_ns > now_ns) ? cpu_free_ns : now_ns;
+
+		/* Deliver everything that happened while the CPU was busy first */
+		if(events_len && events[0].time <= cpu_at) {
+			sim_event_t ev = pop_event();
+			now_ns = (ev.time > now_ns) ? ev.time : now_ns;
+			ev.cb(ev.arg);
+			continue;
+		}
+
+		now_ns = cpu_at;
+		if(run_firmware())
+			continue;
+
+		if(!events_len)
+			return false;
+
+		sim_event_t ev = pop_event();
+		now_ns = ev.time;
+		ev.cb(ev.arg);
+	}
+
+	return true;
+}
+
+void sim_init(void)
+{
+	/* The firmware keeps local addresses in 32-bit fields */
+	if((uintptr_t)sim_ramdisk + SIM_RAMDISK_SIZE > UINT32_MAX || (uintptr_t)sim_cmb + SIM_CMB_SIZE > UINT32_MAX ||
+			(uintptr_t)sim_ddr + SIM_DDR_SIZE > UINT32_MAX || (uintptr_t)sim_tc_regs > UINT32_MAX) {
+		fprintf(stderr, "Simulator must be linked as a non-PIE executable below 4 GiB\n");
+		exit(1);
+	}
+
+	host_mem = calloc(1, sim_config.host_mem_size);
+	if(!host_mem) {
+		fprintf(stderr, "Failed to allocate host memory\n");
+		exit(1);
+	}
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_CPU_HZ		500000000
+
+#define SIM_IRQ_TC		0
+#define SIM_IRQ_DMA		1
+#define SIM_IRQS		2
+
+#define SIM_TC_REGS_SIZE	0x10000
+#define SIM_DMA_REGS_SIZE	0x1000
+#define SIM_RAMDISK_SIZE	(64*1024*1024)
+#define SIM_CMB_SIZE		(256*1024)
+#define SIM_DDR_SIZE		(256*1024*1024)
+
+/* Host addresses seen by the DMA start above 4 GiB to exercise 64-bit PRPs */
+#define SIM_HOST_MEM_BASE	0x100000000ULL
+
+/* Bus address of the Controller Memory Buffer BAR */
+#define SIM_CMB_BUS_BASE	0xe0000000ULL
+
+typedef struct sim_config {
+	/* PCIe DMA engine, per channel */
+	uint32_t dma_latency_ns;
+	uint32_t dma_mbps;
+
+	/* Firmware CPU, charged per ISR run, per work item and per device register access */
+	uint32_t isr_ns;
+	uint32_t work_ns;
+	uint32_t mmio_ns;
+
+	/* Host side */
+	uint32_t doorbell_ns;	/* Posted write reaching the controller */
+	uint32_t msi_ns;	/* Completion interrupt reaching the host */
+	uint32_t host_ns;	/* Host handling of a single completion */
+	uint64_t host_mem_size;
+
+	int log_level;
+} sim_config_t;
+
+extern sim_config_t sim_config;
+
+extern uint32_t sim_tc_regs[SIM_TC_REGS_SIZE/4];
+extern uint32_t sim_dma_regs[SIM_DMA_REGS_SIZE/4];
+extern uint8_t sim_ramdisk[SIM_RAMDISK_SIZE];
+extern uint8_t sim_cmb[SIM_CMB_SIZE];
+extern uint8_t sim_ddr[SIM_DDR_SIZE];
+
+/* Firmware side */
+
+bool sim_is_mmio(uintptr_t addr);
+uint32_t sim_mmio_read32(uintptr_t addr);
+void sim_mmio_write32(uint32_t data, uintptr_t addr);
+
+void sim_irq_connect(unsigned int irq, void (*isr)(void*), void *arg);
+void sim_irq_enable(unsigned int irq);
+
+uint64_t sim_cycles(void);
+
+void sim_log(int level, const char *func, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/* Host side */
+
+typedef void (sim_event_cb)(void *arg);
+
+uint64_t sim_now(void);
+void sim_schedule(uint64_t delay_ns, sim_event_cb *cb, void *arg);
+
+void sim_init(void);
+/* Runs the simulation until done returns true or there is nothing left to do, returns false in the latter case */
+bool sim_run(bool (*done)(void *arg), void *arg);
+
+void *sim_host_ptr(uint64_t host_addr);
+uint64_t sim_host_alloc(uint64_t size, uint64_t align);
+
+void sim_host_write32(uint32_t reg, uint32_t data);
+uint32_t sim_host_read32(uint32_t reg);
+void sim_host_set_msi_handler(void (*handler)(uint32_t vectors));
+
+/* Receives messages the firmware sends over rpmsg, returns the number of bytes taken */
+void sim_set_rpmsg_handler(int (*handler)(const void *data, int len));
+
+typedef struct sim_stats {
+	uint64_t isr_runs;
+	uint64_t work_items;
+	uint64_t mmio_accesses;
+	uint64_t dma_xfers;
+	uint64_t dma_bytes;
+	uint64_t cpu_busy_ns;
+	uint64_t msis;
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "blk.h"
+#include "main.h"
+
+#include <zephyr.h>
+#include <sys/printk.h>
+
+#include <logging/log.h>
+LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
+
+#ifndef NVME_BLK_TIER
+#define NVME_BLK_TIER	NVME_BLK_TIER_NONE
+#endif
+
+/* The ramdisk either holds the namespace itself or caches the slow tier */
+static nvme_blkdev_t fast_dev;
+static nvme_blkdev_t slow_dev;
+static nvme_blkdev_t *top_dev;
+
+int nvme_blk_setup(struct nvme_tc_priv *tc, const nvme_blk_config_t *cfg)
+{
+	int ret;
+
+	switch(cfg->tier) {
+		case NVME_BLK_TIER_NONE:
+			nvme_blk_mem_init(&fast_dev, "ramdisk", cfg->fast_base, cfg->fast_size);
+			top_dev = &fast_dev;
+			return 0;
+		case NVME_BLK_TIER_DDR:
+			nvme_blk_mem_init(&slow_dev, "ddr", cfg->slow_base, cfg->slow_size);
+			break;
+		case NVME_BLK_TIER_APU:
+			nvme_blk_apu_init(&slow_dev, tc);
+			break;
+		default:
+			LOG_ERR("Invalid block tier! (%d)", cfg->tier);
+			return -EINVAL;
+	}
+
+	ret = nvme_blk_cache_init(&fast_dev, &slow_dev, cfg->fast_base, cfg->fast_size, cfg->cache_line_size);
+	if(ret) {
+		LOG_ERR("Failed to set up ramdisk cache! (%d)", ret);
+		return ret;
+	}
+
+	top_dev = &fast_dev;
+	return 0;
+}
+
+int nvme_blk_init(struct nvme_tc_priv *tc)
+{
+	nvme_blk_config_t cfg = {
+		.tier = NVME_BLK_TIER,
+		.fast_base = DT_INST_1_MMIO_SRAM_BASE_ADDRESS,
+		.fast_size = DT_INST_1_MMIO_SRAM_SIZE,
+		.cache_line_size = NVME_BLK_CACHE_LINE_SIZE,
+	};
+
+#if NVME_BLK_TIER == NVME_BLK_TIER_DDR
+#ifndef DT_MMIO_SRAM_40000000_BASE_ADDRESS
+#error "DDR block tier requires the nvme_ddr node to be enabled"
+#endif
+	cfg.slow_base = DT_MMIO_SRAM_40000000_BASE_ADDRESS;
+	cfg.slow_size = DT_MMIO_SRAM_40000000_SIZE;
+#endif
+
+	return nvme_blk_setup(tc, &cfg);
+}
+
+nvme_blkdev_t *nvme_blk_dev(void)
+{
+	return top_dev;
+}
+
+static nvme_blkdev_t *bottom_dev(void)
+{
+	nvme_blkdev_t *dev = top_dev;
+
+	while(dev->lower)
+		dev = dev->lower;
+	return dev;
+}
+
+uint32_t nvme_blk_count(void)
+{
+	return bottom_dev()->blk_cnt;
+}
+
+uint32_t nvme_blk_phys_base(void)
+{
+	return bottom_dev()->phys_base;
+}
+
+bool nvme_blk_has_cache(void)
+{
+	return top_dev->lower != NULL;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef NVME_BLK_H
+#define NVME_BLK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <zephyr.h>
+
+struct nvme_tc_priv;
+
+#define BLK_SHIFT	9
+#define BLK_SIZE	(1<<BLK_SHIFT)
+
+/* Slow tiers that can be placed behind the ramdisk, which then caches them */
+#define NVME_BLK_TIER_NONE	0
+#define NVME_BLK_TIER_DDR	1	/* DDR carve-out described by the nvme_ddr node */
+#define NVME_BLK_TIER_APU	2	/* Blocks kept in APU memory and served over rpmsg */
+
+#define NVME_BLK_OP_READ	0
+#define NVME_BLK_OP_WRITE	1
+#define NVME_BLK_OP_FLUSH	2	/* Makes written blocks durable in the slowest tier */
+#define NVME_BLK_OP_INVALIDATE	3	/* Flush, then drop cached copies so the slow tier can be modified directly */
+
+#define NVME_BLK_CACHE_LINE_SIZE	(64*1024)
+
+/* Returned by submit when the request completes later through its callback */
+#define NVME_BLK_PENDING	1
+
+typedef struct nvme_blk_req nvme_blk_req_t;
+typedef void (nvme_blk_cb)(nvme_blk_req_t *req, int status);
+
+/* Block request, the submitter keeps it alive until it is completed. Flush and invalidate cover
+ * nlb blocks from lba, or the whole device if nlb is 0. */
+struct nvme_blk_req {
+	int op;
+	uint32_t lba;
+	uint32_t nlb;
+	uint8_t *buf;
+	nvme_blk_cb *cb;
+	void *arg;
+	/* Owned by the device while the request is in flight */
+	int state;
+	int status;
+	uint32_t pos;
+	nvme_blk_req_t *next;
+	struct k_work work;
+};
+
+typedef struct nvme_blkdev nvme_blkdev_t;
+
+typedef struct nvme_blkdev_ops {
+	/* Returns the address of nlb blocks from lba if they can be transferred in place, they stay
+	 * there until unmap. Returns NULL if the blocks have to go through submit. */
+	uint8_t *(*map)(nvme_blkdev_t *dev, uint32_t lba, uint32_t nlb, bool write);
+	void (*unmap)(nvme_blkdev_t *dev, uint32_t lba, uint32_t nlb, bool write);
+	/* Returns 0 once done, NVME_BLK_PENDING if req->cb will be called or a negative errno */
+	int (*submit)(nvme_blkdev_t *dev, nvme_blk_req_t *req);
+} nvme_blkdev_ops_t;
+
+struct nvme_blkdev {
+	const char *name;
+	const nvme_blkdev_ops_t *ops;
+	nvme_blkdev_t *lower;	/* Device cached by this one, it defines the capacity */
+	uint32_t blk_cnt;
+	uint32_t phys_base;	/* Address of the blocks in memory, 0 if they are not directly addressable */
+	void *priv;
+};
+
+typedef struct nvme_blk_config {
+	int tier;
+	mem_addr_t fast_base;
+	uint32_t fast_size;
+	uint32_t cache_line_size;
+	mem_addr_t slow_base;	/* DDR tier only */
+	uint32_t slow_size;
+} nvme_blk_config_t;
+
+void nvme_blk_mem_init(nvme_blkdev_t *dev, const char *name, mem_addr_t base, uint32_t size);
+int nvme_blk_cache_init(nvme_blkdev_t *dev, nvme_blkdev_t *lower, mem_addr_t base, uint32_t size, uint32_t line_size);
+void nvme_blk_apu_init(nvme_blkdev_t *dev, struct nvme_tc_priv *tc);
+
+/* Called from the rpmsg endpoint for replies of the APU backend */
+void nvme_blk_apu_done(nvme_blk_req_t *req, int status);
+void nvme_blk_apu_set_count(uint32_t blk_cnt);
+
+int nvme_blk_setup(struct nvme_tc_priv *tc, const nvme_blk_config_t *cfg);
+int nvme_blk_init(struct nvme_tc_priv *tc);
+
+nvme_blkdev_t *nvme_blk_dev(void);
+
+/* Number of blocks in the namespace, the APU backend only knows it once the APU announces it */
+uint32_t nvme_blk_count(void);
+/* Address of the first block for accelerators working on the namespace, 0 if it is kept by the APU */
+uint32_t nvme_blk_phys_base(void);
+bool nvme_blk_has_cache(void);
+
+typedef struct nvme_blk_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t writebacks;
+	uint32_t lines;
+	uint32_t dirty;
+} nvme_blk_cache_stats_t;
+
+int nvme_blk_cache_get_stats(nvme_blkdev_t *dev, nvme_blk_cache_stats_t *stats);
+
+static inline uint8_t *nvme_blk_map(nvme_blkdev_t *dev, uint32_t lba, uint32_t nlb, bool write)
+{
+	return dev->ops->map ? dev->ops->map(dev, lba, nlb, write) : NULL;
+}
+
+static inline void nvme_blk_unmap(nvme_blkdev_t *dev, uint32_t lba, uint32_t nlb, bool write)
+{
+	if(dev->ops->unmap)
+		dev->ops->unmap(dev, lba, nlb, write);
+}
+
+static inline int nvme_blk_submit(nvme_blkdev_t *dev, nvme_blk_req_t *req)
+{
+	return dev->ops->submit(dev, req);
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "blk.h"
+#include "main.h"
+#include "rpmsg.h"
+#include "tc.h"
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <openamp/open_amp.h>
+
+#include <logging/log.h>
+LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
+
+/* Block device kept in APU memory. Requests are sent over rpmsg with the address of the local buffer,
+ * the APU copies the blocks and replies with RPMSG_BLK_DONE. The capacity is announced by the APU with
+ * RPMSG_BLK_INFO, until then the device is empty. */
+
+#define BLK_APU_MSG_WORDS	2	/* LBA and number of blocks */
+
+static nvme_blkdev_t *apu_dev;
+
+static int apu_submit(nvme_blkdev_t *dev, nvme_blk_req_t *req)
+{
+	nvme_tc_priv_t *tc = (nvme_tc_priv_t*)dev->priv;
+	uint32_t msg_buf[sizeof(nvme_rpmsg_payload_t)/4 + BLK_APU_MSG_WORDS];
+	nvme_rpmsg_payload_t *msg = (nvme_rpmsg_payload_t*)msg_buf;
+	int ret;
+
+	switch(req->op) {
+		case NVME_BLK_OP_READ:
+			msg->id = RPMSG_BLK_READ;
+			break;
+		case NVME_BLK_OP_WRITE:
+			msg->id = RPMSG_BLK_WRITE;
+			break;
+		default: // Nothing is cached here, invalidation only has to flush
+			msg->id = RPMSG_BLK_FLUSH;
+	}
+
+	msg->len = BLK_APU_MSG_WORDS*4;
+	msg->priv = (uint32_t)req;
+	msg->buf = (uint32_t)req->buf;
+	msg->buf_len = (msg->id == RPMSG_BLK_FLUSH) ? 0 : req->nlb*BLK_SIZE;
+	msg->data[0] = req->lba;
+	msg->data[1] = req->nlb;
+
+	ret = rpmsg_send(&tc->lept, msg, sizeof(msg_buf));
+	if(ret != sizeof(msg_buf)) {
+		LOG_ERR("Failed to send block request: %d", ret);
+		return -EIO;
+	}
+
+	return NVME_BLK_PENDING;
+}
+
+static const nvme_blkdev_ops_t apu_ops = {
+	.submit = apu_submit,
+};
+
+void nvme_blk_apu_init(nvme_blkdev_t *dev, struct nvme_tc_priv *tc)
+{
+	dev->name = "apu";
+	dev->ops = &apu_ops;
+	dev->lower = NULL;
+	dev->blk_cnt = 0;
+	dev->phys_base = 0;
+	dev->priv = tc;
+
+	apu_dev = dev;
+
+	LOG_INF("Creating apu block device, waiting for the APU to report its capacity");
+}
+
+static void apu_done_work(struct k_work *work)
+{
+	nvme_blk_req_t *req = CONTAINER_OF(work, nvme_blk_req_t, work);
+
+	req->cb(req, req->status);
+}
+
+/* Completions are handed over to the IO work queue, which the block devices are used from */
+void nvme_blk_apu_done(nvme_blk_req_t *req, int status)
+{
+	nvme_tc_priv_t *tc = (nvme_tc_priv_t*)apu_dev->priv;
+
+	req->status = status;
+	k_work_init(&req->work, apu_done_work);
+	k_work_submit_to_queue(&tc->io_wq, &req->work);
+}
+
+void nvme_blk_apu_set_count(uint32_t blk_cnt)
+{
+	if(!apu_dev) {
+		LOG_WRN("APU reported %u blocks, but the APU block tier is not used", blk_cnt);
+		return;
+	}
+
+	LOG_INF("APU block device has %u blocks", blk_cnt);
+	apu_dev->blk_cnt = blk_cnt;
+}
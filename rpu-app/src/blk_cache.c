@@ -0,0 +1,504 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "blk.h"
+#include "main.h"
+
+#include <string.h>
+#include <sys/printk.h>
+
+#include <logging/log.h>
+LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
+
+/* Write-back cache keeping recently used lines of a slow block device in the ramdisk.
+ *
+ * Lines are looked up through a hash of their line number and replaced in LRU order. Writes only mark
+ * lines dirty, they are written back when evicted or flushed. Lines being filled or written back are
+ * busy and lines handed out with map are pinned, neither can be replaced. Requests that have to wait
+ * for a line are queued on it and resumed when it becomes available.
+ *
+ * The cache is only used from the cooperative work queue threads, so it needs no locking. The lower
+ * device has to complete asynchronous requests from one of these threads as well. */
+
+#define CACHE_ALIGN		4096
+#define CACHE_NO_TAG		0xffffffff
+
+#define FLUSH_START		0	/* Start writebacks of all dirty lines in range */
+#define FLUSH_WAIT		1	/* Wait for the writebacks, write back lines dirtied meanwhile */
+#define FLUSH_LOWER		2	/* Pass the flush to the lower device */
+
+typedef struct cache cache_t;
+
+typedef struct cache_line {
+	cache_t *cache;
+	struct cache_line *hash_next;
+	struct cache_line *lru_prev;
+	struct cache_line *lru_next;
+	uint32_t tag;		/* Line number in the lower device */
+	uint8_t *data;
+	bool valid;
+	bool dirty;
+	bool busy;		/* Fill or writeback in flight */
+	uint16_t pins;
+	nvme_blk_req_t *waiters;
+	nvme_blk_req_t io;	/* Fill or writeback request to the lower device */
+} cache_line_t;
+
+struct cache {
+	nvme_blkdev_t *lower;
+	uint32_t line_blks;
+	cache_line_t *lines;
+	uint32_t nlines;
+	cache_line_t **hash;
+	uint32_t hash_mask;
+	cache_line_t lru;	/* List head, most recently used line first */
+	nvme_blk_req_t *waiters;	/* Waiting for any line to become replaceable */
+	nvme_blk_cache_stats_t stats;
+};
+
+static int cache_run(cache_t *c, nvme_blk_req_t *req);
+
+static inline uint32_t line_blks(cache_t *c, uint32_t tag)
+{
+	const uint32_t left = c->lower->blk_cnt - tag*c->line_blks;
+	return MIN(left, c->line_blks);
+}
+
+static inline bool in_range(cache_t *c, uint32_t lba, uint32_t nlb)
+{
+	return (lba < c->lower->blk_cnt) && (nlb <= c->lower->blk_cnt - lba);
+}
+
+static cache_line_t *lookup(cache_t *c, uint32_t tag)
+{
+	cache_line_t *line = c->hash[tag & c->hash_mask];
+
+	while(line && line->tag != tag)
+		line = line->hash_next;
+	return line;
+}
+
+static void hash_insert(cache_t *c, cache_line_t *line, uint32_t tag)
+{
+	cache_line_t **bucket = &c->hash[tag & c->hash_mask];
+
+	line->tag = tag;
+	line->hash_next = *bucket;
+	*bucket = line;
+}
+
+static void hash_remove(cache_t *c, cache_line_t *line)
+{
+	cache_line_t **link = &c->hash[line->tag & c->hash_mask];
+
+	while(*link != line)
+		link = &(*link)->hash_next;
+	*link = line->hash_next;
+	line->tag = CACHE_NO_TAG;
+}
+
+static void lru_unlink(cache_line_t *line)
+{
+	line->lru_prev->lru_next = line->lru_next;
+	line->lru_next->lru_prev = line->lru_prev;
+}
+
+static void lru_insert_after(cache_line_t *pos, cache_line_t *line)
+{
+	line->lru_prev = pos;
+	line->lru_next = pos->lru_next;
+	pos->lru_next->lru_prev = line;
+	pos->lru_next = line;
+}
+
+static void lru_touch(cache_t *c, cache_line_t *line)
+{
+	lru_unlink(line);
+	lru_insert_after(&c->lru, line);
+}
+
+/* Drops a line that holds no data worth keeping, it is reused first */
+static void line_drop(cache_t *c, cache_line_t *line)
+{
+	if(line->tag != CACHE_NO_TAG)
+		hash_remove(c, line);
+	line->valid = false;
+	lru_unlink(line);
+	lru_insert_after(c->lru.lru_prev, line);
+}
+
+static void line_set_dirty(cache_t *c, cache_line_t *line)
+{
+	if(!line->dirty) {
+		line->dirty = true;
+		c->stats.dirty++;
+	}
+}
+
+static void wait_on(nvme_blk_req_t **list, nvme_blk_req_t *req)
+{
+	req->next = NULL;
+	while(*list)
+		list = &(*list)->next;
+	*list = req;
+}
+
+/* Resumes all requests queued on list, they fail with status if it is nonzero */
+static void wake(cache_t *c, nvme_blk_req_t **list, int status)
+{
+	nvme_blk_req_t *req = *list;
+
+	*list = NULL;
+	while(req) {
+		nvme_blk_req_t *next = req->next;
+		const int ret = status ? status : cache_run(c, req);
+
+		if(ret != NVME_BLK_PENDING)
+			req->cb(req, ret);
+		req = next;
+	}
+}
+
+static void line_io_end(cache_t *c, cache_line_t *line, int status)
+{
+	line->busy = false;
+
+	if(line->io.op == NVME_BLK_OP_READ) {
+		if(status)
+			line_drop(c, line);
+		else
+			line->valid = true;
+	} else if(status) { // Keep the data dirty, the next flush or eviction retries the writeback
+		line_set_dirty(c, line);
+	}
+}
+
+static void line_io_cb(nvme_blk_req_t *io, int status)
+{
+	cache_line_t *line = (cache_line_t*)io->arg;
+	cache_t *c = line->cache;
+
+	if(status)
+		LOG_ERR("Cache line %s failed! (line: %u, ret: %d)", (io->op == NVME_BLK_OP_READ) ? "fill" : "writeback",
+			line->tag, status);
+
+	line_io_end(c, line, status);
+	wake(c, &line->waiters, status);
+	wake(c, &c->waiters, 0);
+}
+
+/* Fills the line from or writes it back to the lower device, completions of pending transfers
+ * are delivered from the work queue so the caller can still queue itself on the line */
+static int line_io(cache_t *c, cache_line_t *line, int op)
+{
+	nvme_blk_req_t *io = &line->io;
+	int ret;
+
+	io->op = op;
+	io->lba = line->tag*c->line_blks;
+	io->nlb = line_blks(c, line->tag);
+	io->buf = line->data;
+	io->cb = line_io_cb;
+	io->arg = line;
+
+	if(op == NVME_BLK_OP_WRITE) {
+		line->dirty = false;
+		c->stats.dirty--;
+		c->stats.writebacks++;
+	}
+
+	line->busy = true;
+	ret = nvme_blk_submit(c->lower, io);
+	if(ret != NVME_BLK_PENDING)
+		line_io_end(c, line, ret);
+
+	return ret;
+}
+
+/* Finds a line for tag, writing back the least recently used one if it is dirty */
+static int line_alloc(cache_t *c, nvme_blk_req_t *req, uint32_t tag, cache_line_t **line)
+{
+	cache_line_t *victim = c->lru.lru_prev;
+	int ret;
+
+	while(victim != &c->lru && (victim->busy || victim->pins))
+		victim = victim->lru_prev;
+
+	if(victim == &c->lru) {
+		wait_on(&c->waiters, req);
+		return NVME_BLK_PENDING;
+	}
+
+	if(victim->dirty) {
+		ret = line_io(c, victim, NVME_BLK_OP_WRITE);
+		if(ret == NVME_BLK_PENDING)
+			wait_on(&victim->waiters, req);
+		if(ret)
+			return ret;
+	}
+
+	if(victim->tag != CACHE_NO_TAG) {
+		hash_remove(c, victim);
+		c->stats.evictions++;
+	}
+
+	victim->valid = false;
+	hash_insert(c, victim, tag);
+	*line = victim;
+	return 0;
+}
+
+/* The request state is set once the line at pos is found missing, so resuming it is not counted again */
+static int cache_rw(cache_t *c, nvme_blk_req_t *req)
+{
+	const bool write = (req->op == NVME_BLK_OP_WRITE);
+	int ret;
+
+	while(req->pos < req->nlb) {
+		const uint32_t lba = req->lba + req->pos;
+		const uint32_t tag = lba / c->line_blks;
+		const uint32_t off = lba % c->line_blks;
+		const uint32_t nlb = MIN(req->nlb - req->pos, c->line_blks - off);
+		uint8_t *buf = req->buf + (size_t)req->pos*BLK_SIZE;
+		cache_line_t *line = lookup(c, tag);
+
+		if(line && line->busy) {
+			wait_on(&line->waiters, req);
+			return NVME_BLK_PENDING;
+		}
+
+		if(line) {
+			if(!req->state)
+				c->stats.hits++;
+		} else {
+			if(!req->state)
+				c->stats.misses++;
+			req->state = 1;
+
+			ret = line_alloc(c, req, tag, &line);
+			if(ret)
+				return ret;
+
+			// Lines overwritten as a whole do not have to be read first
+			if(write && off == 0 && nlb == line_blks(c, tag)) {
+				line->valid = true;
+			} else {
+				ret = line_io(c, line, NVME_BLK_OP_READ);
+				if(ret == NVME_BLK_PENDING)
+					wait_on(&line->waiters, req);
+				if(ret)
+					return ret;
+			}
+		}
+
+		if(write) {
+			memcpy(line->data + off*BLK_SIZE, buf, nlb*BLK_SIZE);
+			line_set_dirty(c, line);
+		} else {
+			memcpy(buf, line->data + off*BLK_SIZE, nlb*BLK_SIZE);
+		}
+
+		lru_touch(c, line);
+		req->pos += nlb;
+		req->state = 0;
+	}
+
+	return 0;
+}
+
+static inline bool line_in_flush(cache_t *c, cache_line_t *line, nvme_blk_req_t *req)
+{
+	const uint32_t lba = line->tag*c->line_blks;
+
+	if(line->tag == CACHE_NO_TAG)
+		return false;
+	if(req->nlb == 0)
+		return true;
+	return (lba < req->lba + req->nlb) && (req->lba < lba + c->line_blks);
+}
+
+/* Writebacks are all started before waiting for any of them, so the lower device sees them at once */
+static int cache_flush(cache_t *c, nvme_blk_req_t *req)
+{
+	int ret;
+
+	if(req->state == FLUSH_START) {
+		for(uint32_t i = 0; i < c->nlines; i++) {
+			cache_line_t *line = &c->lines[i];
+
+			if(line_in_flush(c, line, req) && line->dirty && !line->busy) {
+				ret = line_io(c, line, NVME_BLK_OP_WRITE);
+				if(ret < 0)
+					return ret;
+			}
+		}
+		req->state = FLUSH_WAIT;
+		req->pos = 0;
+	}
+
+	if(req->state == FLUSH_WAIT) {
+		for(; req->pos < c->nlines; req->pos++) {
+			cache_line_t *line = &c->lines[req->pos];
+
+			if(!line_in_flush(c, line, req))
+				continue;
+
+			if(line->busy) {
+				wait_on(&line->waiters, req);
+				return NVME_BLK_PENDING;
+			}
+
+			if(line->dirty) {
+				ret = line_io(c, line, NVME_BLK_OP_WRITE);
+				if(ret == NVME_BLK_PENDING)
+					wait_on(&line->waiters, req);
+				if(ret)
+					return ret;
+			}
+
+			if(req->op == NVME_BLK_OP_INVALIDATE) {
+				// Lines still being transferred to or from the host are dropped once released
+				if(line->pins) {
+					wait_on(&c->waiters, req);
+					return NVME_BLK_PENDING;
+				}
+				line_drop(c, line);
+			}
+		}
+		req->state = FLUSH_LOWER;
+	}
+
+	// The lower device completes the request from here on
+	req->state = 0;
+	req->pos = 0;
+	return nvme_blk_submit(c->lower, req);
+}
+
+static int cache_run(cache_t *c, nvme_blk_req_t *req)
+{
+	if(req->op == NVME_BLK_OP_READ || req->op == NVME_BLK_OP_WRITE)
+		return cache_rw(c, req);
+	return cache_flush(c, req);
+}
+
+static int cache_submit(nvme_blkdev_t *dev, nvme_blk_req_t *req)
+{
+	cache_t *c = (cache_t*)dev->priv;
+
+	if((req->op == NVME_BLK_OP_READ || req->op == NVME_BLK_OP_WRITE || req->nlb) && !in_range(c, req->lba, req->nlb))
+		return -EINVAL;
+
+	req->state = 0;
+	req->pos = 0;
+	return cache_run(c, req);
+}
+
+static uint8_t *cache_map(nvme_blkdev_t *dev, uint32_t lba, uint32_t nlb, bool write)
+{
+	cache_t *c = (cache_t*)dev->priv;
+	const uint32_t off = lba % c->line_blks;
+	cache_line_t *line;
+
+	if(!in_range(c, lba, nlb) || off + nlb > c->line_blks)
+		return NULL;
+
+	line = lookup(c, lba / c->line_blks);
+	if(!line || line->busy || !line->valid)
+		return NULL;
+
+	c->stats.hits++;
+	line->pins++;
+	lru_touch(c, line);
+	return line->data + off*BLK_SIZE;
+}
+
+static void cache_unmap(nvme_blkdev_t *dev, uint32_t lba, uint32_t nlb, bool write)
+{
+	cache_t *c = (cache_t*)dev->priv;
+	cache_line_t *line = lookup(c, lba / c->line_blks);
+
+	if(write)
+		line_set_dirty(c, line);
+
+	if(--line->pins == 0)
+		wake(c, &c->waiters, 0);
+}
+
+static const nvme_blkdev_ops_t cache_ops = {
+	.map = cache_map,
+	.unmap = cache_unmap,
+	.submit = cache_submit,
+};
+
+/* Places the cache metadata at the start of the memory and as many lines as fit after it */
+int nvme_blk_cache_init(nvme_blkdev_t *dev, nvme_blkdev_t *lower, mem_addr_t base, uint32_t size, uint32_t line_size)
+{
+	const uint32_t line_cost = line_size + sizeof(cache_line_t) + 2*sizeof(cache_line_t*);
+	uint32_t nlines, buckets = 1;
+	mem_addr_t addr = base;
+	cache_t *c;
+
+	if(line_size < BLK_SIZE || line_size % BLK_SIZE)
+		return -EINVAL;
+
+	if(size < sizeof(cache_t) + CACHE_ALIGN + 2*line_cost)
+		return -ENOMEM;
+
+	nlines = (size - sizeof(cache_t) - CACHE_ALIGN) / line_cost;
+	while(buckets < nlines)
+		buckets <<= 1;
+
+	c = (cache_t*)addr;
+	addr += sizeof(cache_t);
+	memset(c, 0, sizeof(cache_t));
+
+	c->lower = lower;
+	c->line_blks = line_size / BLK_SIZE;
+	c->nlines = nlines;
+	c->lines = (cache_line_t*)addr;
+	addr += nlines*sizeof(cache_line_t);
+	c->hash = (cache_line_t**)addr;
+	c->hash_mask = buckets - 1;
+	addr += buckets*sizeof(cache_line_t*);
+	addr = (addr + CACHE_ALIGN - 1) & ~(mem_addr_t)(CACHE_ALIGN - 1);
+
+	memset(c->hash, 0, buckets*sizeof(cache_line_t*));
+	c->lru.lru_prev = c->lru.lru_next = &c->lru;
+
+	for(uint32_t i = 0; i < nlines; i++) {
+		cache_line_t *line = &c->lines[i];
+
+		memset(line, 0, sizeof(cache_line_t));
+		line->cache = c;
+		line->tag = CACHE_NO_TAG;
+		line->data = (uint8_t*)(addr + (size_t)i*line_size);
+		lru_insert_after(c->lru.lru_prev, line);
+	}
+
+	c->stats.lines = nlines;
+
+	dev->name = "cache";
+	dev->ops = &cache_ops;
+	dev->lower = lower;
+	dev->blk_cnt = 0;
+	dev->phys_base = 0;
+	dev->priv = c;
+
+	LOG_INF("Caching %s block device in %d lines of %d bytes at %08x", lower->name, nlines, line_size,
+		(uint32_t)base);
+
+	return 0;
+}
+
+int nvme_blk_cache_get_stats(nvme_blkdev_t *dev, nvme_blk_cache_stats_t *stats)
+{
+	if(dev->ops != &cache_ops)
+		return -EINVAL;
+
+	*stats = ((cache_t*)dev->priv)->stats;
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "blk.h"
+#include "main.h"
+
+#include <string.h>
+#include <sys/printk.h>
+
+#include <logging/log.h>
+LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
+
+/* Block device over memory the DMA can reach directly: the ramdisk or a DDR carve-out */
+
+static inline bool mem_in_range(nvme_blkdev_t *dev, uint32_t lba, uint32_t nlb)
+{
+	return (lba < dev->blk_cnt) && (nlb <= dev->blk_cnt - lba);
+}
+
+static uint8_t *mem_map(nvme_blkdev_t *dev, uint32_t lba, uint32_t nlb, bool write)
+{
+	uint8_t *base = (uint8_t*)dev->priv;
+
+	return mem_in_range(dev, lba, nlb) ? &base[(size_t)lba*BLK_SIZE] : NULL;
+}
+
+static int mem_submit(nvme_blkdev_t *dev, nvme_blk_req_t *req)
+{
+	uint8_t *base = (uint8_t*)dev->priv;
+
+	if(req->op == NVME_BLK_OP_FLUSH || req->op == NVME_BLK_OP_INVALIDATE)
+		return 0;
+
+	if(!mem_in_range(dev, req->lba, req->nlb))
+		return -EINVAL;
+
+	if(req->op == NVME_BLK_OP_READ)
+		memcpy(req->buf, &base[(size_t)req->lba*BLK_SIZE], req->nlb*BLK_SIZE);
+	else
+		memcpy(&base[(size_t)req->lba*BLK_SIZE], req->buf, req->nlb*BLK_SIZE);
+
+	return 0;
+}
+
+static const nvme_blkdev_ops_t mem_ops = {
+	.map = mem_map,
+	.submit = mem_submit,
+};
+
+void nvme_blk_mem_init(nvme_blkdev_t *dev, const char *name, mem_addr_t base, uint32_t size)
+{
+	dev->name = name;
+	dev->ops = &mem_ops;
+	dev->lower = NULL;
+	dev->blk_cnt = size / BLK_SIZE;
+	dev->phys_base = (uint32_t)base;
+	dev->priv = (void*)base;
+
+	LOG_INF("Creating %s block device, start: %08x, blocks: %d, block size: %d", name, (uint32_t)base,
+		dev->blk_cnt, BLK_SIZE);
+}
@@ -8,6 +8,9 @@
 #include "cmd.h"
 #include "dma.h"
 #include "main.h"
+#include "blk.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <zephyr.h>
 #include <sys/printk.h>
@@ -60,6 +63,10 @@ static void handle_adm(nvme_cmd_priv_t *priv)
 			LOG_DBG("Handling NVME_ADM_CMD_DELETE_IO_CQ");
 			nvme_cmd_adm_delete_cq(priv);
 			break;
+		case NVME_ADM_CMD_DBBUF_CONFIG:
+			LOG_DBG("Handling NVME_ADM_CMD_DBBUF_CONFIG");
+			nvme_cmd_adm_dbbuf_config(priv);
+			break;
 		case NVME_ADM_CMD_FW_COMMIT: // Vendor command layout is compatible with FW commands and in the end FW commands are handled by the APU
 			LOG_DBG("Handling NVME_ADM_CMD_FW_COMMIT");
 			nvme_cmd_vendor(priv, 0);
@@ -89,7 +96,7 @@ static void handle_io(nvme_cmd_priv_t *priv)
 	switch(cmd->cdw0.opc) {
 		case NVME_IO_CMD_FLUSH:
 			LOG_DBG("Handling NVME_IO_CMD_FLUSH");
-			nvme_cmd_return(priv);
+			nvme_cmd_io_flush(priv);
 			break;
 		case NVME_IO_CMD_WRITE:
 			LOG_DBG("Handling NVME_IO_CMD_WRITE");
@@ -110,9 +117,30 @@ static void handle_io(nvme_cmd_priv_t *priv)
 	}
 }
 
-void nvme_cmd_handler(void *cmd_priv, void *buf)
+static void cmd_work_handler(struct k_work *work)
+{
+	nvme_cmd_priv_t *priv = CONTAINER_OF(work, nvme_cmd_priv_t, work);
+	nvme_dma_xfer_cb *cb = priv->work_cb;
+	void *buf = priv->work_buf;
+
+	cb(priv, buf);
+}
+
+/* Runs cb from the work queue serving the command's queue instead of the DMA completion ISR */
+static void nvme_cmd_defer(nvme_cmd_priv_t *priv, nvme_dma_xfer_cb *cb, void *buf)
+{
+	priv->work_cb = cb;
+	priv->work_buf = buf;
+	k_work_init(&priv->work, cmd_work_handler);
+	nvme_tc_queue_work(priv->tc, priv->qid, &priv->work);
+}
+
+static void dispatch_cmd(void *cmd_priv, void *buf)
 {
 	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
+	nvme_sq_entry_base_t *cmd = (nvme_sq_entry_base_t*)priv->sq_buf;
+
+	nvme_trace(NVME_TRACE_CMD_START, priv->qid, cmd->cdw0.cid, cmd->cdw0.opc, cmd->nsid);
 	fill_cq_resp(priv);
 
 	if(priv->qid == ADM_QUEUE_ID)
@@ -121,11 +149,73 @@ void nvme_cmd_handler(void *cmd_priv, void *buf)
 		handle_io(priv);
 }
 
+void nvme_cmd_handler(void *cmd_priv, void *buf)
+{
+	nvme_cmd_defer((nvme_cmd_priv_t*)cmd_priv, dispatch_cmd, buf);
+}
+
+/* Processes a command whose SQ entry is already in sq_buf, called from work queue context */
+void nvme_cmd_dispatch(nvme_cmd_priv_t *priv)
+{
+	dispatch_cmd(priv, priv->sq_buf);
+}
+
+static void xfer_done_cb(void *cmd_priv, void *buf)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)&priv->cq_buf;
+
+	nvme_trace(NVME_TRACE_XFER_DONE, priv->qid, cq->cid, priv->xfer_size, 0);
+	if(priv->xfer_cb)
+		nvme_cmd_defer(priv, priv->xfer_cb, buf);
+}
+
+/* Drops a reference to the transfer, the last one fires the completion callback.
+ * The issuer holds one reference until all chunks are queued and each queued chunk holds one more. */
+static void xfer_put(nvme_cmd_priv_t *priv, void *buf)
+{
+	if(atomic_dec(&priv->xfer_pending) == 1)
+		xfer_done_cb(priv, buf);
+}
+
+static void chunk_cb(void *cmd_priv, void *buf)
+{
+	xfer_put((nvme_cmd_priv_t*)cmd_priv, buf);
+}
+
+static void cmd_account(nvme_cmd_priv_t *priv, bool error)
+{
+	nvme_sq_entry_base_t *cmd = (nvme_sq_entry_base_t*)priv->sq_buf;
+	const uint32_t nlb = (priv->sq_buf[12] & 0xffff) + 1; // CDW12 NLB of reads and writes, 0's based
+	uint32_t bytes = 0;
+	int op;
+
+	if(priv->qid == ADM_QUEUE_ID) {
+		op = NVME_STATS_OP_ADMIN;
+	} else if(cmd->cdw0.opc == NVME_IO_CMD_READ) {
+		op = NVME_STATS_OP_READ;
+		bytes = nlb * BLK_SIZE;
+	} else if(cmd->cdw0.opc == NVME_IO_CMD_WRITE) {
+		op = NVME_STATS_OP_WRITE;
+		bytes = nlb * BLK_SIZE;
+	} else if(cmd->cdw0.opc == NVME_IO_CMD_FLUSH) {
+		op = NVME_STATS_OP_FLUSH;
+	} else {
+		op = NVME_STATS_OP_IO_OTHER;
+	}
+
+	nvme_stats_cmd_done(priv->qid, op, error, bytes, priv->start_cycles);
+}
+
 static void cq_cb(void *cmd_priv, void *buf)
 {
 	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
-	LOG_INF("Sending completion interrupt to host");
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)&priv->cq_buf;
+
+	nvme_trace(NVME_TRACE_CQ_NOTIFY, priv->qid, cq->cid, priv->tc->cq_iv[priv->qid], 0);
 	nvme_tc_cq_notify(priv->tc, priv->qid);
+	cmd_account(priv, cq->sc || cq->sct);
+	nvme_tc_cmd_done(priv->tc, priv->qid);
 	k_mem_slab_free(&priv->tc->cmd_slab, &cmd_priv);
 }
 
@@ -143,37 +233,38 @@ void nvme_cmd_return(nvme_cmd_priv_t *priv)
 
 	if (!cq_addr) {
 		LOG_ERR("Completion Queue host memory address is invalid!");
+		cmd_account(priv, true);
+		nvme_tc_cmd_done(priv->tc, priv->qid);
 		return;
 	}
 
 	// We know the correct phase only after obtaining next CQ entry address
 	cq->p = priv->tc->cq_phase[priv->qid];
 
+	nvme_trace(NVME_TRACE_CMD_DONE, priv->qid, cq->cid, cq->sc, cq->sct);
+
 	nvme_dma_xfer_mem_to_host(priv->tc->dma_priv, (uint32_t)cq, cq_addr, NVME_TC_CQ_ENTRY_SIZE, cq_cb, (void*)priv);
 }
 
 static void transfer_chunk(nvme_cmd_priv_t *priv, uint64_t host_addr, uint32_t local_addr, uint32_t len)
 {
-	nvme_dma_xfer_cb *cb = NULL;
-	void *arg = NULL;
-
 	// const uint32_t lo = host_addr & 0xffffffff;
 	// const uint32_t hi = (host_addr >> 32) & 0xffffffff;
 	// LOG_DBG("Transferring data, host: %08x %08x, local: %08x, len: %d", hi, lo, local_addr, len);
 
-	if(priv->xfer_len == len) {
-		cb = priv->xfer_cb;
-		arg = priv;
-	}
+	atomic_inc(&priv->xfer_pending);
 
 	if(priv->dir == DIR_TO_HOST) {
-		nvme_dma_xfer_mem_to_host(priv->tc->dma_priv, local_addr, host_addr, len, cb, arg);
+		nvme_dma_xfer_mem_to_host(priv->tc->dma_priv, local_addr, host_addr, len, chunk_cb, priv);
 	} else {
-		nvme_dma_xfer_host_to_mem(priv->tc->dma_priv, host_addr, local_addr, len, cb, arg);
+		nvme_dma_xfer_host_to_mem(priv->tc->dma_priv, host_addr, local_addr, len, chunk_cb, priv);
 	}
 
 	priv->xfer_len -= len;
 	priv->xfer_buf += len;
+
+	if(priv->xfer_len == 0) // All chunks are queued, drop the issuer reference
+		xfer_put(priv, (void*)local_addr);
 }
 
 static uint32_t calc_prp_size(uint64_t base, uint32_t mps, uint32_t len)
@@ -183,6 +274,24 @@ static uint32_t calc_prp_size(uint64_t base, uint32_t mps, uint32_t len)
 	return (page > total) ? total : page;
 }
 
+static void prp_fetched_cb(void *cmd_priv, void *buf);
+static void prp_cb(void *cmd_priv, void *buf);
+
+/* Fetches priv->prp_size bytes of PRP list to buf, lists placed in the Controller Memory Buffer are read locally */
+static void fetch_prp_list(nvme_cmd_priv_t *priv, uint64_t host_addr, void *buf)
+{
+	mem_addr_t cmb_addr = nvme_tc_cmb_local_addr(priv->tc, host_addr, priv->prp_size);
+
+	LOG_DBG("Fetching list of PRPs (%d bytes)", priv->prp_size);
+
+	if(cmb_addr) {
+		nvme_tc_cmb_read(buf, cmb_addr, priv->prp_size);
+		prp_cb(priv, buf);
+	} else {
+		nvme_dma_xfer_host_to_mem(priv->tc->dma_priv, host_addr, (uint32_t)buf, priv->prp_size, prp_fetched_cb, priv);
+	}
+}
+
 static void prp_cb(void *cmd_priv, void *buf)
 {
 	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
@@ -198,8 +307,7 @@ static void prp_cb(void *cmd_priv, void *buf)
 
 		if((i == prp_last) && (priv->xfer_len > mps)) { // We need to fetch another PRP list
 			priv->prp_size = calc_prp_size(prp_list[prp_last], mps, priv->xfer_len);
-			nvme_dma_xfer_host_to_mem(priv->tc->dma_priv, prp_list[prp_last], (uint32_t)buf, priv->prp_size, prp_cb, priv);
-			LOG_DBG("Fetching list of PRPs (%d bytes)", priv->prp_size);
+			fetch_prp_list(priv, prp_list[prp_last], buf);
 			return;
 		}
 
@@ -211,6 +319,11 @@ static void prp_cb(void *cmd_priv, void *buf)
 	k_mem_slab_free(&priv->tc->prp_slab, &buf);
 }
 
+static void prp_fetched_cb(void *cmd_priv, void *buf)
+{
+	nvme_cmd_defer((nvme_cmd_priv_t*)cmd_priv, prp_cb, buf);
+}
+
 static void transfer_data_with_prps(nvme_cmd_priv_t *priv)
 {
 	nvme_sq_entry_base_t *cmd = (nvme_sq_entry_base_t*)priv->sq_buf;
@@ -222,8 +335,6 @@ static void transfer_data_with_prps(nvme_cmd_priv_t *priv)
 
 	transfer_chunk(priv, host_addr, priv->xfer_buf, xfer_len);
 
-    printk("transfer_data_with_prps()\n"); // FIXME: This is a temporary workaround for a race condition.
-
 	if(priv->xfer_len == 0) {
 		return;
 	}
@@ -232,12 +343,15 @@ static void transfer_data_with_prps(nvme_cmd_priv_t *priv)
 		void *prp_buf;
 		if(k_mem_slab_alloc(&priv->tc->prp_slab, (void**)&prp_buf, K_NO_WAIT) == 0) {
 			priv->prp_size = calc_prp_size(cmd->dptr.prp.prp2, mps, priv->xfer_len);
-			nvme_dma_xfer_host_to_mem(priv->tc->dma_priv, cmd->dptr.prp.prp2, (uint32_t)prp_buf, priv->prp_size, prp_cb, priv);
-			LOG_DBG("Fetching list of PRPs (%d bytes)", priv->prp_size);
+			fetch_prp_list(priv, cmd->dptr.prp.prp2, prp_buf);
 			return;
 		} else {
+			nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
 			LOG_ERR("Failed to allocate PRP buffer!");
-			nvme_cmd_return(priv);
+			// xfer_cb still runs once the chunk already queued retires, so it can release its buffers
+			priv->xfer_status = NVME_SC_INTERNAL;
+			cq->sc = NVME_SC_INTERNAL;
+			xfer_put(priv, NULL);
 			return;
 		}
 	} else { // Second PRP is in PRP2
@@ -257,32 +371,57 @@ int nvme_cmd_transfer_data(nvme_cmd_priv_t *priv)
 		LOG_ERR("Invalid PSDT value! (%d != 0)", psdt);
 		return 1;
 	} else {
+		nvme_trace(NVME_TRACE_XFER_START, priv->qid, cmd->cdw0.cid, priv->xfer_size, priv->dir);
+		atomic_set(&priv->xfer_pending, 1);
+		priv->xfer_status = 0;
 		transfer_data_with_prps(priv);
 		return 0;
 	}
 
 }
 
-void nvme_cmd_get_data(nvme_cmd_priv_t *priv, void *ret_buf, uint32_t ret_len)
+/* Transfers len bytes between buf and the host, cb is called from the work queue once done.
+ * Returns nonzero without calling cb if the data pointer of the command is not supported. */
+int nvme_cmd_xfer(nvme_cmd_priv_t *priv, void *buf, uint32_t len, int dir, nvme_dma_xfer_cb *cb)
 {
-	priv->xfer_base = priv->xfer_buf = (uint32_t)ret_buf;
-	priv->xfer_size = priv->xfer_len = ret_len;
+	priv->xfer_base = priv->xfer_buf = (uint32_t)buf;
+	priv->xfer_size = priv->xfer_len = len;
 
-	priv->dir = DIR_FROM_HOST;
-	priv->xfer_cb = nvme_cmd_return_cb;
+	priv->dir = dir;
+	priv->xfer_cb = cb;
 
-	if(nvme_cmd_transfer_data(priv))
-		nvme_cmd_return(priv);
+	return nvme_cmd_transfer_data(priv);
 }
 
-void nvme_cmd_return_data(nvme_cmd_priv_t *priv, void *ret_buf, uint32_t ret_len)
+/* Sets the command status and returns nonzero if nlb blocks from slba are not all in the namespace */
+int nvme_cmd_check_lba_range(nvme_cmd_priv_t *priv, uint64_t slba, uint32_t nlb)
 {
-	priv->xfer_base = priv->xfer_buf = (uint32_t)ret_buf;
-	priv->xfer_size = priv->xfer_len = ret_len;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+	const uint32_t blk_cnt = nvme_blk_count();
+
+	if(!blk_cnt) {
+		LOG_WRN("Namespace capacity is not known yet!");
+		cq->sc = NVME_SC_NS_NOT_READY;
+		return 1;
+	}
+
+	if(slba >= blk_cnt || nlb > blk_cnt - slba) {
+		LOG_ERR("LBA out of range! (slba: %u, nlb: %u)", (uint32_t)slba, nlb);
+		cq->sc = NVME_SC_LBA_OUT_OF_RANGE;
+		return 1;
+	}
 
-	priv->dir = DIR_TO_HOST;
-	priv->xfer_cb = nvme_cmd_return_cb;
+	return 0;
+}
 
-	if(nvme_cmd_transfer_data(priv))
+void nvme_cmd_get_data(nvme_cmd_priv_t *priv, void *ret_buf, uint32_t ret_len)
+{
+	if(nvme_cmd_xfer(priv, ret_buf, ret_len, DIR_FROM_HOST, nvme_cmd_return_cb))
+		nvme_cmd_return(priv);
+}
+
+void nvme_cmd_return_data(nvme_cmd_priv_t *priv, void *ret_buf, uint32_t ret_len)
+{
+	if(nvme_cmd_xfer(priv, ret_buf, ret_len, DIR_TO_HOST, nvme_cmd_return_cb))
 		nvme_cmd_return(priv);
 }
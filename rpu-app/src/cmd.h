@@ -14,6 +14,7 @@
 #include "tc.h"
 
 void nvme_cmd_handler(void *cmd_priv, void *cmd);
+void nvme_cmd_dispatch(nvme_cmd_priv_t *priv);
 
 typedef struct nvme_cmd_cdw0 {
 	uint32_t opc : 8;
@@ -77,6 +78,7 @@ typedef struct nvme_cq_entry {
 #define NVME_ADM_CMD_FW_COMMIT		0x10
 #define NVME_ADM_CMD_FW_DOWNLOAD	0x11
 #define NVME_ADM_CMD_KEEP_ALIVE		0x18
+#define NVME_ADM_CMD_DBBUF_CONFIG	0x7C
 
 #define NVME_ADM_CMD_VENDOR		0xC0
 
@@ -92,9 +94,18 @@ typedef struct nvme_cq_entry {
 #define NVME_CMD_XFER_BIDIR		0x03
 #define NVME_CMD_XFER_MASK		0x03
 
+/* Generic Command Status values */
+#define NVME_SC_INVALID_FIELD		0x02
+#define NVME_SC_INTERNAL		0x06
+#define NVME_SC_LBA_OUT_OF_RANGE	0x80
+#define NVME_SC_NS_NOT_READY		0x82
+
 int nvme_cmd_transfer_data(nvme_cmd_priv_t *priv);
+int nvme_cmd_xfer(nvme_cmd_priv_t *priv, void *buf, uint32_t len, int dir, nvme_dma_xfer_cb *cb);
+int nvme_cmd_check_lba_range(nvme_cmd_priv_t *priv, uint64_t slba, uint32_t nlb);
 
 void nvme_cmd_vendor(nvme_cmd_priv_t *priv, int zero_based);
+void nvme_cmd_forward(nvme_cmd_priv_t *priv, int buffer_size);
 
 void nvme_cmd_adm_identify(nvme_cmd_priv_t *priv);
 void nvme_cmd_adm_get_log(nvme_cmd_priv_t *priv);
@@ -106,6 +117,9 @@ void nvme_cmd_adm_create_cq(nvme_cmd_priv_t *priv);
 void nvme_cmd_adm_delete_sq(nvme_cmd_priv_t *priv);
 void nvme_cmd_adm_delete_cq(nvme_cmd_priv_t *priv);
 
+void nvme_cmd_adm_dbbuf_config(nvme_cmd_priv_t *priv);
+
+void nvme_cmd_io_flush(nvme_cmd_priv_t *priv);
 void nvme_cmd_io_write(nvme_cmd_priv_t *priv);
 void nvme_cmd_io_read(nvme_cmd_priv_t *priv);
 
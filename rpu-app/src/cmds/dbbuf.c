@@ -0,0 +1,36 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "cmd.h"
+#include "main.h"
+
+#include <zephyr.h>
+#include <sys/printk.h>
+
+#include <logging/log.h>
+LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
+
+void nvme_cmd_adm_dbbuf_config(nvme_cmd_priv_t *priv)
+{
+	nvme_sq_entry_base_t *cmd = (nvme_sq_entry_base_t*)priv->sq_buf;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+	nvme_tc_priv_t *tc = priv->tc;
+
+	uint64_t shadow = cmd->dptr.prp.prp1;
+	uint64_t eventidx = cmd->dptr.prp.prp2;
+
+	// Both buffers are a single memory page
+	if(!shadow || !eventidx || shadow % tc->memory_page_size || eventidx % tc->memory_page_size) {
+		LOG_ERR("Invalid Doorbell Buffer Config buffers!");
+		cq->sc = NVME_SC_INVALID_FIELD;
+		return nvme_cmd_return(priv);
+	}
+
+	nvme_tc_dbbuf_enable(tc, shadow, eventidx);
+
+	nvme_cmd_return(priv);
+}
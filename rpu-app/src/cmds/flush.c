@@ -0,0 +1,43 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "cmd.h"
+#include "blk.h"
+#include "main.h"
+
+#include <logging/log.h>
+LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
+
+static void flush_cb(nvme_blk_req_t *req, int status)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)req->arg;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+
+	if(status) {
+		LOG_ERR("Failed to flush the block device! (%d)", status);
+		cq->sc = NVME_SC_INTERNAL;
+	}
+
+	nvme_cmd_return(priv);
+}
+
+/* Writes back everything held in the ramdisk cache, there is only one namespace to flush */
+void nvme_cmd_io_flush(nvme_cmd_priv_t *priv)
+{
+	nvme_blk_req_t *req = &priv->blk;
+	int ret;
+
+	req->op = NVME_BLK_OP_FLUSH;
+	req->lba = 0;
+	req->nlb = 0;
+	req->cb = flush_cb;
+	req->arg = priv;
+
+	ret = nvme_blk_submit(nvme_blk_dev(), req);
+	if(ret != NVME_BLK_PENDING)
+		flush_cb(req, ret);
+}
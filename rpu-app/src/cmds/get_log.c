@@ -7,6 +7,8 @@
 
 #include "cmd.h"
 #include "main.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <zephyr.h>
 #include <sys/printk.h>
@@ -44,36 +46,126 @@ typedef struct cmd_sq {
 #define SMART_RESP_SIZE	512
 
 #define LID_SMART	0x02
+#define LID_ACC_TELEMETRY	0xC0
+#define LID_RPU_TRACE	0xC1
+#define LID_RPU_PERF	0xC2
+
+/* SMART / Health Information field offsets */
+#define SMART_CRIT_WARN		0
+#define SMART_TEMP		1
+#define SMART_AVAIL_SPARE	3
+#define SMART_SPARE_THRESH	4
+#define SMART_PERCENT_USED	5
+#define SMART_DATA_UNITS_READ	32
+#define SMART_DATA_UNITS_WRITTEN	48
+#define SMART_HOST_READS	64
+#define SMART_HOST_WRITES	80
+#define SMART_BUSY_TIME		96
+#define SMART_POWER_CYCLES	112
+#define SMART_POWER_ON_HOURS	128
+#define SMART_UNSAFE_SHUTDOWNS	144
+#define SMART_MEDIA_ERRORS	160
+#define SMART_ERR_LOG_ENTRIES	176
+
+/* Data units are thousands of 512 byte units, rounded up */
+#define SMART_DATA_UNIT		(512*1000)
+
+/* Writes the lower half of a 128-bit SMART counter, the upper one stays zeroed */
+static void smart_write_u128(uint64_t val, mem_addr_t addr)
+{
+	sys_write32(val & 0xffffffff, addr);
+	sys_write32(val >> 32, addr + 4);
+}
 
 static void fill_smart_struct(uint8_t *ptr)
 {
 	mem_addr_t buf = (mem_addr_t)ptr;
+	uint64_t bytes_read = 0, bytes_written = 0, reads = 0, writes = 0;
+	nvme_stats_t stats;
+
 	memset(ptr, 0, SMART_RESP_SIZE);
 
-	sys_write16(298, buf + 1);
-	sys_write8(100, buf + 3);
-	sys_write8(5, buf + 4);
+	nvme_stats_get(&stats);
+	for(int qid = ADM_QUEUE_ID + 1; qid < QUEUES; qid++) {
+		bytes_read += stats.queue[qid].bytes_read;
+		bytes_written += stats.queue[qid].bytes_written;
+		reads += stats.queue[qid].read_cmds;
+		writes += stats.queue[qid].write_cmds;
+	}
 
-	sys_write32(2000, buf + 128);
+	// The RPU has no access to a temperature sensor and the ramdisk does not wear out
+	sys_write16(298, buf + SMART_TEMP);
+	sys_write8(100, buf + SMART_AVAIL_SPARE);
+	sys_write8(5, buf + SMART_SPARE_THRESH);
+
+	smart_write_u128((bytes_read + SMART_DATA_UNIT - 1) / SMART_DATA_UNIT, buf + SMART_DATA_UNITS_READ);
+	smart_write_u128((bytes_written + SMART_DATA_UNIT - 1) / SMART_DATA_UNIT, buf + SMART_DATA_UNITS_WRITTEN);
+	smart_write_u128(reads, buf + SMART_HOST_READS);
+	smart_write_u128(writes, buf + SMART_HOST_WRITES);
+	smart_write_u128(nvme_stats_cycles_to_us(stats.busy_cycles) / 60000000, buf + SMART_BUSY_TIME);
+	smart_write_u128(k_uptime_get() / 3600000, buf + SMART_POWER_ON_HOURS);
+}
+
+/* Completes a read starting past the end of the log with Invalid Field */
+static void get_log_invalid_offset(nvme_cmd_priv_t *priv, uint64_t off)
+{
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
 
-	sys_write32(10, buf + 144);
-	sys_write32(0, buf + 148);
-	sys_write32(0, buf + 152);
-	sys_write32(0, buf + 156);
+	LOG_ERR("Incorrect Get Log offset! (%llu)", off);
+	cq->sc = NVME_SC_INVALID_FIELD;
+	nvme_cmd_return(priv);
 }
 
 static void get_smart_log(nvme_cmd_priv_t *priv, uint32_t len, uint64_t off)
 {
 	static uint8_t resp_buf[SMART_RESP_SIZE];
 
-	len = (len > SMART_RESP_SIZE) ? SMART_RESP_SIZE : len;
+	if(off >= SMART_RESP_SIZE) {
+		get_log_invalid_offset(priv, off);
+		return;
+	}
 
-	if (off != 0)
-		LOG_ERR("Incorrect Get Log offset! (%llu)", off);
+	len = (len > SMART_RESP_SIZE - off) ? SMART_RESP_SIZE - off : len;
 
 	fill_smart_struct(resp_buf);
 
-	nvme_cmd_return_data(priv, resp_buf, len);
+	nvme_cmd_return_data(priv, resp_buf + off, len);
+}
+
+static void get_perf_log(nvme_cmd_priv_t *priv, uint32_t len, uint64_t off)
+{
+	static uint8_t perf_buf[NVME_STATS_LOG_SIZE];
+
+	if(off >= NVME_STATS_LOG_SIZE) {
+		get_log_invalid_offset(priv, off);
+		return;
+	}
+
+	// Same as the trace log, the counters are copied when a read starts at offset 0
+	if(off == 0)
+		nvme_stats_snapshot(perf_buf);
+
+	len = (len > NVME_STATS_LOG_SIZE - off) ? NVME_STATS_LOG_SIZE - off : len;
+
+	nvme_cmd_return_data(priv, perf_buf + off, len);
+}
+
+static void get_trace_log(nvme_cmd_priv_t *priv, uint32_t len, uint64_t off)
+{
+	static uint8_t trace_buf[NVME_TRACE_LOG_SIZE];
+
+	if(off >= NVME_TRACE_LOG_SIZE) {
+		get_log_invalid_offset(priv, off);
+		return;
+	}
+
+	// The host reads the log in pieces, take a consistent copy at the start of each read
+	if(off == 0)
+		nvme_trace_snapshot(trace_buf);
+
+	len = (len > NVME_TRACE_LOG_SIZE - off) ? NVME_TRACE_LOG_SIZE - off : len;
+
+	nvme_cmd_return_data(priv, trace_buf + off, len);
 }
 
 void nvme_cmd_adm_get_log(nvme_cmd_priv_t *priv)
@@ -89,6 +181,15 @@ void nvme_cmd_adm_get_log(nvme_cmd_priv_t *priv)
 		case LID_SMART:
 			get_smart_log(priv, len, off);
 			break;
+		case LID_ACC_TELEMETRY: // Accelerator telemetry is kept by the APU
+			nvme_cmd_forward(priv, len);
+			break;
+		case LID_RPU_TRACE:
+			get_trace_log(priv, len, off);
+			break;
+		case LID_RPU_PERF:
+			get_perf_log(priv, len, off);
+			break;
 		default:
 			LOG_ERR("Invalid Get Log LID value! (%d)", cmd->cdw10.lid);
 			nvme_cmd_return(priv);
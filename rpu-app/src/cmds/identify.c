@@ -7,7 +7,7 @@
 
 #include "cmd.h"
 #include "nvme_ident_fields.h"
-#include "ramdisk.h"
+#include "blk.h"
 #include "main.h"
 
 #include <zephyr.h>
@@ -61,6 +61,10 @@ typedef struct cmd_sq {
 
 #define IO_CNTRL 1
 
+#define OACS_DBBUF_CONFIG (1<<8)
+
+#define VWC_PRESENT (1<<0)
+
 #define SUBNQN "NVMe Open Source Controller"
 
 static void fill_identify_struct(uint8_t *ptr)
@@ -83,6 +87,8 @@ static void fill_identify_struct(uint8_t *ptr)
 
 	sys_write8(IO_CNTRL, buf + NVME_ID_FIELD_CNTRLTYPE);
 
+	sys_write16(OACS_DBBUF_CONFIG, buf + NVME_ID_FIELD_OACS);
+
 	sys_write8(3, buf + NVME_ID_FIELD_ACL);
 	sys_write8(3, buf + NVME_ID_FIELD_AERL);
 
@@ -104,6 +110,9 @@ static void fill_identify_struct(uint8_t *ptr)
 
 	sys_write8(1, buf + NVME_ID_FIELD_FNA);
 
+	// Writes stay in the ramdisk until flushed when it caches a slower tier
+	sys_write8(nvme_blk_has_cache() ? VWC_PRESENT : 0, buf + NVME_ID_FIELD_VWC);
+
 	sys_write16(0xFFFF, buf + NVME_ID_FIELD_AWUN);
 
 	sys_write16(0xFFFF, buf + NVME_ID_FIELD_AWUPF);
@@ -168,9 +177,10 @@ static void identify_namespace(nvme_cmd_priv_t *priv)
 	mem_addr_t buf = (mem_addr_t)resp_buf;
 	memset(resp_buf, 0, NVME_CMD_IDENTIFY_RESP_SIZE);
 
-	sys_write32(BLK_CNT, buf + 0);
+	// Capacity depends on the block tier and may only be known once the APU reports it
+	sys_write32(nvme_blk_count(), buf + 0);
 
-	sys_write32(BLK_CNT, buf + 8);
+	sys_write32(nvme_blk_count(), buf + 8);
 
 	sys_write32((BLK_SHIFT << 16), buf + 128);
 
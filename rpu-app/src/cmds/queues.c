@@ -32,6 +32,13 @@ typedef struct cmd_sq {
 	cmd_cdw11_t cdw11;
 } cmd_sq_t;
 
+typedef struct cmd_create_sq_cdw11 {
+	uint32_t pc : 1;
+	uint32_t qprio : 2;
+	uint32_t rsvd : 13;
+	uint32_t cqid : 16;
+} cmd_create_sq_cdw11_t;
+
 void nvme_cmd_adm_create_sq(nvme_cmd_priv_t *priv)
 {
 	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
@@ -39,7 +46,7 @@ void nvme_cmd_adm_create_sq(nvme_cmd_priv_t *priv)
 
 	uint16_t qid = cmd->cdw10.qid;
 
-	if(qid == 0 || qid > QUEUES) {
+	if(qid == 0 || qid >= QUEUES) {
 		LOG_ERR("Invalid Create SQ QID(%d)!", qid);
 		//cq_buf->sct = 1;
 		//cq_buf->sc = 1;
@@ -51,7 +58,10 @@ void nvme_cmd_adm_create_sq(nvme_cmd_priv_t *priv)
 	tc->sq_head[qid] = 0;
 	tc->sq_tail[qid] = 0;
 
-	tc->sq_pc[qid] = cmd->cdw11.pc;
+	cmd_create_sq_cdw11_t *cdw11 = (cmd_create_sq_cdw11_t*)&cmd->cdw11;
+
+	tc->sq_pc[qid] = cdw11->pc;
+	tc->sq_prio[qid] = cdw11->qprio; // Only used with Weighted Round Robin arbitration
 	tc->sq_size[qid] = cmd->cdw10.qsize + 1; // 0's based value
 
 	tc->sq_valid[qid] = true;
@@ -66,7 +76,7 @@ void nvme_cmd_adm_delete_sq(nvme_cmd_priv_t *priv)
 
 	uint16_t qid = cmd->cdw10.qid;
 
-	if(qid == 0 || qid > QUEUES) {
+	if(qid == 0 || qid >= QUEUES) {
 		LOG_ERR("Invalid Delete SQ QID(%d)!", qid);
 		//cq_buf->sct = 1;
 		//cq_buf->sc = 1;
@@ -85,7 +95,7 @@ void nvme_cmd_adm_create_cq(nvme_cmd_priv_t *priv)
 
 	uint16_t qid = cmd->cdw10.qid;
 
-	if(qid == 0 || qid > QUEUES) {
+	if(qid == 0 || qid >= QUEUES) {
 		LOG_ERR("Invalid Create CQ QID(%d)!", qid);
 		//cq_buf->sct = 1;
 		//cq_buf->sc = 1;
@@ -115,7 +125,7 @@ void nvme_cmd_adm_delete_cq(nvme_cmd_priv_t *priv)
 
 	uint16_t qid = cmd->cdw10.qid;
 
-	if(qid == 0 || qid > QUEUES) {
+	if(qid == 0 || qid >= QUEUES) {
 		LOG_ERR("Invalid Delete CQ QID(%d)!", qid);
 		//cq_buf->sct = 1;
 		//cq_buf->sc = 1;
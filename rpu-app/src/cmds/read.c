@@ -6,7 +6,7 @@
  */
 
 #include "cmd.h"
-#include "ramdisk.h"
+#include "blk.h"
 #include "main.h"
 
 #include <logging/log.h>
@@ -43,22 +43,87 @@ typedef struct cmd_sq {
 	cmd_cdw15_t cdw15;
 } cmd_sq_t;
 
+static void read_done_cb(void *cmd_priv, void *buf)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
+	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
+
+	nvme_blk_unmap(nvme_blk_dev(), cmd->cdw10, cmd->cdw12.nlb + 1, false);
+	nvme_cmd_return(priv);
+}
+
+static void read_bounce_done_cb(void *cmd_priv, void *buf)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
+
+	k_mem_pool_free(&priv->block);
+	nvme_cmd_return(priv);
+}
+
+static void read_blk_cb(nvme_blk_req_t *req, int status)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)req->arg;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+
+	if(status) {
+		LOG_ERR("Failed to read blocks! (lba: %u, nlb: %u, ret: %d)", req->lba, req->nlb, status);
+		cq->sc = NVME_SC_INTERNAL;
+		read_bounce_done_cb(priv, NULL);
+		return;
+	}
+
+	if(nvme_cmd_xfer(priv, req->buf, req->nlb*BLK_SIZE, DIR_TO_HOST, read_bounce_done_cb)) {
+		cq->sc = NVME_SC_INVALID_FIELD;
+		read_bounce_done_cb(priv, NULL);
+	}
+}
+
 void nvme_cmd_io_read(nvme_cmd_priv_t *priv)
 {
 	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+	nvme_blkdev_t *dev = nvme_blk_dev();
+	nvme_blk_req_t *req = &priv->blk;
 	uint8_t *buf;
+	int ret;
 
-	uint32_t lba = cmd->cdw10;
-	uint32_t nlb = cmd->cdw12.nlb + 1; // 0's based
+	const uint64_t lba = ((uint64_t)cmd->cdw11 << 32) | cmd->cdw10;
+	const uint32_t nlb = cmd->cdw12.nlb + 1; // 0's based
 
-	LOG_DBG("Ramdisk read: %d blocks from %d", nlb, lba);
+	LOG_DBG("Ramdisk read: %d blocks from %d", nlb, (uint32_t)lba);
 
-	buf = ramdisk_read(lba, nlb);
+	if(nvme_cmd_check_lba_range(priv, lba, nlb)) {
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	// Blocks the DMA can reach are sent to the host in place
+	buf = nvme_blk_map(dev, lba, nlb, false);
+	if(buf) {
+		if(nvme_cmd_xfer(priv, buf, nlb*BLK_SIZE, DIR_TO_HOST, read_done_cb)) {
+			nvme_blk_unmap(dev, lba, nlb, false);
+			cq->sc = NVME_SC_INVALID_FIELD;
+			nvme_cmd_return(priv);
+		}
+		return;
+	}
 
-	if (buf) {
-		nvme_cmd_return_data(priv, (void*)buf, nlb*BLK_SIZE);
-	} else {
-		LOG_ERR("Failed to get ramdisk address!");
+	ret = k_mem_pool_alloc(priv->tc->buffer_pool, &priv->block, nlb*BLK_SIZE, K_NO_WAIT);
+	if(ret) {
+		LOG_ERR("Failed to allocate read buffer! (size: %d, ret: %d)", nlb*BLK_SIZE, ret);
+		cq->sc = NVME_SC_INTERNAL;
 		nvme_cmd_return(priv);
+		return;
 	}
+
+	req->op = NVME_BLK_OP_READ;
+	req->lba = lba;
+	req->nlb = nlb;
+	req->buf = priv->block.data;
+	req->cb = read_blk_cb;
+	req->arg = priv;
+
+	ret = nvme_blk_submit(dev, req);
+	if(ret != NVME_BLK_PENDING)
+		read_blk_cb(req, ret);
 }
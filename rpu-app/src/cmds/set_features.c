@@ -32,20 +32,47 @@ typedef struct cmd_sq {
 	cmd_cdw14_t cdw14;
 } cmd_sq_t;
 
+typedef struct cmd_arb_cdw11 {
+	uint32_t ab : 3;
+	uint32_t rsvd : 5;
+	uint32_t lpw : 8;
+	uint32_t mpw : 8;
+	uint32_t hpw : 8;
+} cmd_arb_cdw11_t;
+
+#define FID_ARBITRATION		0x01
 #define FID_NUMBER_OF_QUEUES	0x07
 
+#define ARB_BURST_NO_LIMIT	0x7
+
+static void arbitration(nvme_cmd_priv_t *priv)
+{
+	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
+	cmd_arb_cdw11_t *cdw11 = (cmd_arb_cdw11_t*)&cmd->cdw[0];
+	nvme_tc_priv_t *tc = priv->tc;
+
+	tc->arb_burst = (cdw11->ab == ARB_BURST_NO_LIMIT) ? 0 : (1 << cdw11->ab);
+	tc->arb_weight[NVME_QPRIO_HIGH] = cdw11->hpw;
+	tc->arb_weight[NVME_QPRIO_MEDIUM] = cdw11->mpw;
+	tc->arb_weight[NVME_QPRIO_LOW] = cdw11->lpw;
+
+	LOG_DBG("AB: %d, HPW: %d, MPW: %d, LPW: %d", cdw11->ab, cdw11->hpw, cdw11->mpw, cdw11->lpw);
+
+	nvme_tc_arb_reset(tc);
+}
+
 static void number_of_queues(nvme_cmd_priv_t *priv)
 {
 	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
 
-	// cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
-	// uint16_t ncqr = (cmd->cdw[0] >> 16) & 0xFFFF;
-	// uint16_t nsqr = cmd->cdw[0] & 0xFFFF;
-	// LOG_DBG("NCQR: %d, NSQR: %d", ncqr, nsqr);
+	uint16_t ncqr = (cmd->cdw[0] >> 16) & 0xFFFF;
+	uint16_t nsqr = cmd->cdw[0] & 0xFFFF;
+	LOG_DBG("NCQR: %d, NSQR: %d", ncqr, nsqr);
 
-	// For now create only one IO queue
+	// Queue pairs share the ID, so the same number of SQs and CQs is allocated
 
-	priv->tc->queues = 1;
+	priv->tc->queues = IO_QUEUES;
 
 	cq->cdw0 = ((priv->tc->queues-1) << 16) | (priv->tc->queues-1);
 }
@@ -55,6 +82,10 @@ void nvme_cmd_adm_set_features(nvme_cmd_priv_t *priv)
 	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
 
 	switch(cmd->cdw10.fid) {
+		case FID_ARBITRATION:
+			LOG_DBG("Handling FID_ARBITRATION");
+			arbitration(priv);
+			break;
 		case FID_NUMBER_OF_QUEUES:
 			LOG_DBG("Handling FID_NUMBER_OF_QUEUES");
 			number_of_queues(priv);
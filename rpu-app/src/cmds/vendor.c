@@ -6,18 +6,37 @@
  */
 
 #include "cmd.h"
+#include "blk.h"
 #include "main.h"
 #include "rpmsg.h"
+#include "trace.h"
 
 #include <logging/log.h>
 LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
 
-static int send_cmd(nvme_cmd_priv_t *priv)
+#define NVME_IO_CMD_READ_LBA	0x88
+#define NVME_IO_CMD_WRITE_LBA	0x8c
+
+/* Accelerator LBA commands address 4 KiB pages */
+#define VENDOR_LBA_BLKS		(4096 / BLK_SIZE)
+
+typedef struct cmd_lba_sq {
+	nvme_sq_entry_base_t base;
+	uint32_t cdw10;
+	uint32_t cdw11;
+	uint32_t cdw12; // LBA 31:00
+	uint32_t cdw13; // LBA 63:32
+	uint32_t nlb : 16;
+	uint32_t rsvd : 16;
+	uint32_t cdw15;
+} cmd_lba_sq_t;
+
+static void vendor_start(nvme_cmd_priv_t *priv);
+
+static int send_cmd(nvme_cmd_priv_t *priv, int buffer_size)
 {
-	nvme_sq_entry_vendor_base_t *cmd = (nvme_sq_entry_vendor_base_t*)priv->sq_buf;
 	const int msg_size = sizeof(nvme_rpmsg_payload_t) + sizeof(priv->sq_buf);
 	nvme_rpmsg_payload_t *msg = (nvme_rpmsg_payload_t*)k_malloc(msg_size);
-	const int buffer_size = cmd->ndt * 4;
 
 	if(msg == NULL) {
 		LOG_ERR("Failed to allocate rpmsg buffer!");
@@ -34,6 +53,7 @@ static int send_cmd(nvme_cmd_priv_t *priv)
 	memcpy(msg->data, priv->sq_buf, msg->len);
 
 	LOG_DBG("vendor buffer %x, %d", msg->buf, msg->buf_len);
+	nvme_trace(NVME_TRACE_RPMSG_TX, priv->qid, ((nvme_sq_entry_base_t*)priv->sq_buf)->cdw0.cid, msg->id, msg->buf_len);
 
 	int ret = rpmsg_send(&priv->tc->lept, msg, msg_size);
 	if(ret != msg_size) {
@@ -51,21 +71,42 @@ static void vendor_cb(void *cmd_priv, void *buf)
 {
 	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
 
-	send_cmd(priv);
+	if(priv->xfer_status) {
+		k_mem_pool_free(&priv->block);
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	send_cmd(priv, priv->xfer_size);
 }
 
-void nvme_cmd_vendor(nvme_cmd_priv_t *priv, int zero_based)
+/* Forwards a command returning buffer_size bytes of data to the host to the APU */
+void nvme_cmd_forward(nvme_cmd_priv_t *priv, int buffer_size)
+{
+	if(buffer_size > 0) {
+		int ret = k_mem_pool_alloc(priv->tc->buffer_pool, &priv->block, buffer_size, 0);
+		if(ret) {
+			LOG_ERR("Failed to allocate command data buffer! (size: %d, ret: %d)", buffer_size, ret);
+			nvme_cmd_return(priv);
+			return;
+		}
+	}
+
+	if(send_cmd(priv, buffer_size)) {
+		if(buffer_size > 0)
+			k_mem_pool_free(&priv->block);
+		nvme_cmd_return(priv);
+	}
+}
+
+static void vendor_start(nvme_cmd_priv_t *priv)
 {
 	nvme_sq_entry_vendor_base_t *cmd = (nvme_sq_entry_vendor_base_t*)priv->sq_buf;
 	const uint8_t opc = cmd->base.cdw0.opc;
 	const int dir = opc & NVME_CMD_XFER_MASK;
-
-	if(zero_based)
-		cmd->ndt++;
-
 	const int buffer_size = cmd->ndt * 4;
 
-	LOG_INF("Vendor %s command (Opcode: %d, priv: %08x)", (priv->qid > 0) ? "IO" : "Admin", opc, (uint32_t)priv);
+	LOG_DBG("Vendor %s command (Opcode: %d, priv: %08x)", (priv->qid > 0) ? "IO" : "Admin", opc, (uint32_t)priv);
 
 	if((dir != NVME_CMD_XFER_NONE) && (buffer_size > 0)) {
 		int ret = k_mem_pool_alloc(priv->tc->buffer_pool, &priv->block, buffer_size, 0);
@@ -78,7 +119,7 @@ void nvme_cmd_vendor(nvme_cmd_priv_t *priv, int zero_based)
 	}
 
 	if(buffer_size == 0 || dir == NVME_CMD_XFER_TO_HOST) { // No data transfer from host required, we can send rpmsg now
-		send_cmd(priv);
+		send_cmd(priv, buffer_size);
 	} else {
 		priv->xfer_base = priv->xfer_buf = (uint32_t)priv->block.data;
 		priv->xfer_size = priv->xfer_len = buffer_size;
@@ -89,3 +130,63 @@ void nvme_cmd_vendor(nvme_cmd_priv_t *priv, int zero_based)
 		nvme_cmd_transfer_data(priv);
 	}
 }
+
+static void vendor_lba_cb(nvme_blk_req_t *req, int status)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)req->arg;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+
+	if(status) {
+		LOG_ERR("Failed to sync blocks for the accelerator! (lba: %u, nlb: %u, ret: %d)", req->lba, req->nlb, status);
+		cq->sc = NVME_SC_INTERNAL;
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	vendor_start(priv);
+}
+
+/* Accelerators access the slowest tier directly: blocks they read have to be written back from the cache
+ * first and cached copies of blocks they write are dropped, so the host reads their results afterwards */
+static void vendor_lba_sync(nvme_cmd_priv_t *priv)
+{
+	cmd_lba_sq_t *cmd = (cmd_lba_sq_t*)priv->sq_buf;
+	nvme_blk_req_t *req = &priv->blk;
+	const uint64_t lba = ((((uint64_t)cmd->cdw13) << 32) | cmd->cdw12) * VENDOR_LBA_BLKS;
+	const uint32_t nlb = cmd->nlb * VENDOR_LBA_BLKS;
+	int ret;
+
+	if(!nvme_blk_has_cache()) {
+		vendor_start(priv);
+		return;
+	}
+
+	if(nvme_cmd_check_lba_range(priv, lba, nlb)) {
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	req->op = (cmd->base.cdw0.opc == NVME_IO_CMD_READ_LBA) ? NVME_BLK_OP_FLUSH : NVME_BLK_OP_INVALIDATE;
+	req->lba = lba;
+	req->nlb = nlb;
+	req->cb = vendor_lba_cb;
+	req->arg = priv;
+
+	ret = nvme_blk_submit(nvme_blk_dev(), req);
+	if(ret != NVME_BLK_PENDING)
+		vendor_lba_cb(req, ret);
+}
+
+void nvme_cmd_vendor(nvme_cmd_priv_t *priv, int zero_based)
+{
+	nvme_sq_entry_vendor_base_t *cmd = (nvme_sq_entry_vendor_base_t*)priv->sq_buf;
+	const uint8_t opc = cmd->base.cdw0.opc;
+
+	if(zero_based)
+		cmd->ndt++;
+
+	if(priv->qid > 0 && (opc == NVME_IO_CMD_READ_LBA || opc == NVME_IO_CMD_WRITE_LBA))
+		vendor_lba_sync(priv);
+	else
+		vendor_start(priv);
+}
@@ -7,7 +7,7 @@
 
 #include "cmd.h"
 #include "main.h"
-#include "ramdisk.h"
+#include "blk.h"
 
 #include <logging/log.h>
 LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
@@ -46,22 +46,139 @@ typedef struct cmd_sq {
 	cmd_cdw15_t cdw15;
 } cmd_sq_t;
 
+static void write_flush_cb(nvme_blk_req_t *req, int status)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)req->arg;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+
+	if(status) {
+		LOG_ERR("Failed to flush written blocks! (lba: %u, nlb: %u, ret: %d)", req->lba, req->nlb, status);
+		cq->sc = NVME_SC_INTERNAL;
+	}
+
+	nvme_cmd_return(priv);
+}
+
+/* Blocks written with Force Unit Access have to reach the slowest tier before the command completes */
+static void write_complete(nvme_cmd_priv_t *priv)
+{
+	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
+	nvme_blk_req_t *req = &priv->blk;
+	int ret;
+
+	if(!cmd->cdw12.fua) {
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	req->op = NVME_BLK_OP_FLUSH;
+	req->lba = cmd->cdw10;
+	req->nlb = cmd->cdw12.nlb + 1;
+	req->cb = write_flush_cb;
+	req->arg = priv;
+
+	ret = nvme_blk_submit(nvme_blk_dev(), req);
+	if(ret != NVME_BLK_PENDING)
+		write_flush_cb(req, ret);
+}
+
+static void write_done_cb(void *cmd_priv, void *buf)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
+	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
+
+	nvme_blk_unmap(nvme_blk_dev(), cmd->cdw10, cmd->cdw12.nlb + 1, true);
+
+	if(priv->xfer_status) {
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	write_complete(priv);
+}
+
+static void write_blk_cb(nvme_blk_req_t *req, int status)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)req->arg;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+
+	k_mem_pool_free(&priv->block);
+
+	if(status) {
+		LOG_ERR("Failed to write blocks! (lba: %u, nlb: %u, ret: %d)", req->lba, req->nlb, status);
+		cq->sc = NVME_SC_INTERNAL;
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	write_complete(priv);
+}
+
+static void write_bounce_cb(void *cmd_priv, void *buf)
+{
+	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
+	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
+	nvme_blk_req_t *req = &priv->blk;
+	int ret;
+
+	if(priv->xfer_status) {
+		k_mem_pool_free(&priv->block);
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	req->op = NVME_BLK_OP_WRITE;
+	req->lba = cmd->cdw10;
+	req->nlb = cmd->cdw12.nlb + 1;
+	req->buf = priv->block.data;
+	req->cb = write_blk_cb;
+	req->arg = priv;
+
+	ret = nvme_blk_submit(nvme_blk_dev(), req);
+	if(ret != NVME_BLK_PENDING)
+		write_blk_cb(req, ret);
+}
+
 void nvme_cmd_io_write(nvme_cmd_priv_t *priv)
 {
 	cmd_sq_t *cmd = (cmd_sq_t*)priv->sq_buf;
+	nvme_cq_entry_t *cq = (nvme_cq_entry_t*)priv->cq_buf;
+	nvme_blkdev_t *dev = nvme_blk_dev();
 	uint8_t *buf;
+	int ret;
 
-	uint32_t lba = cmd->cdw10;
-	uint32_t nlb = cmd->cdw12.nlb + 1; // 0's based
+	const uint64_t lba = ((uint64_t)cmd->cdw11 << 32) | cmd->cdw10;
+	const uint32_t nlb = cmd->cdw12.nlb + 1; // 0's based
 
-	LOG_DBG("Ramdisk write: %d blocks from %d", nlb, lba);
+	LOG_DBG("Ramdisk write: %d blocks from %d", nlb, (uint32_t)lba);
 
-	buf = ramdisk_write(lba, nlb);
+	if(nvme_cmd_check_lba_range(priv, lba, nlb)) {
+		nvme_cmd_return(priv);
+		return;
+	}
 
+	// Blocks the DMA can reach are received from the host in place
+	buf = nvme_blk_map(dev, lba, nlb, true);
 	if(buf) {
-		nvme_cmd_get_data(priv, (void*)buf, nlb*BLK_SIZE);
-	} else {
-		LOG_ERR("Failed to get ramdisk address!");
+		if(nvme_cmd_xfer(priv, buf, nlb*BLK_SIZE, DIR_FROM_HOST, write_done_cb)) {
+			nvme_blk_unmap(dev, lba, nlb, false);
+			cq->sc = NVME_SC_INVALID_FIELD;
+			nvme_cmd_return(priv);
+		}
+		return;
+	}
+
+	ret = k_mem_pool_alloc(priv->tc->buffer_pool, &priv->block, nlb*BLK_SIZE, K_NO_WAIT);
+	if(ret) {
+		LOG_ERR("Failed to allocate write buffer! (size: %d, ret: %d)", nlb*BLK_SIZE, ret);
+		cq->sc = NVME_SC_INTERNAL;
+		nvme_cmd_return(priv);
+		return;
+	}
+
+	if(nvme_cmd_xfer(priv, priv->block.data, nlb*BLK_SIZE, DIR_FROM_HOST, write_bounce_cb)) {
+		k_mem_pool_free(&priv->block);
+		cq->sc = NVME_SC_INVALID_FIELD;
 		nvme_cmd_return(priv);
 	}
 }
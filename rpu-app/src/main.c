@@ -12,7 +12,7 @@
 #include "main.h"
 #include "dma.h"
 #include "tc.h"
-#include "ramdisk.h"
+#include "blk.h"
 #include "rpmsg.h"
 
 #include "platform_info.h"
@@ -27,15 +27,16 @@ K_MEM_POOL_DEFINE(buffer_pool, PAGE_SIZE, NVME_BUFFER_SIZE, NVME_BUFFER_POOL_ENT
 
 nvme_tc_priv_t *init(void)
 {
-	ramdisk_init();
-	LOG_DBG("Init [1/6]: Ramdisk initialized");
-
 	void *dma_priv = nvme_dma_init();
-	LOG_DBG("Init [2/6]: DMA initialized");
+	LOG_DBG("Init [1/6]: DMA initialized");
 
 	nvme_tc_priv_t *tc = nvme_tc_init(dma_priv);
 	tc->buffer_pool = &buffer_pool;
-	LOG_DBG("Init [3/6]: Target Controller (TC) initialized");
+	LOG_DBG("Init [2/6]: Target Controller (TC) initialized");
+
+	if(nvme_blk_init(tc))
+		LOG_ERR("Failed to initialize block device!");
+	LOG_DBG("Init [3/6]: Block device initialized");
 
 	nvme_dma_irq_init();
 	LOG_DBG("Init [4/6]: DMA IRQ initialized");
@@ -54,14 +55,10 @@ void main(void)
 	log_init();
 	LOG_INF("NVMe Controller FW for %s", CONFIG_BOARD);
 
-	nvme_tc_priv_t *tc = init();
+	init();
 
 	LOG_INF("NVMe controller initialized");
 
-	while(1) {
-		platform_poll(tc->platform);
-		k_sleep(100);
-	}
-
-	rpmsg_destroy_ept(&tc->lept);
+	/* NVMe commands are handled by the admin and IO work queues and rpmsg is serviced
+	 * by its own thread, there is nothing left to do for the main thread */
 }
@@ -2,6 +2,7 @@
 #define MAIN_H
 
 #define NVME_LOGGER_NAME  nvme
-#define NVME_LOGGER_LEVEL 4
+/* Per-command events go to the binary trace (trace.h), debug logging is compiled out */
+#define NVME_LOGGER_LEVEL 3
 
 #endif /* MAIN_H */
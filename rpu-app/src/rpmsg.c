@@ -7,8 +7,12 @@
 
 #include "rpmsg.h"
 #include "main.h"
+#include "blk.h"
 #include "cmd.h"
+#include "platform_info.h"
+#include "trace.h"
 
+#include <zephyr.h>
 #include <openamp/open_amp.h>
 #include <metal/device.h>
 #include <metal/sys.h>
@@ -21,6 +25,15 @@ LOG_MODULE_DECLARE(NVME_LOGGER_NAME, NVME_LOGGER_LEVEL);
 
 #define RPMSG_SERVICE_NAME         "rpmsg-openamp-nvme-channel"
 
+#define RPMSG_THREAD_STACK_SIZE    4096
+#define RPMSG_THREAD_PRIORITY      K_PRIO_COOP(1)
+
+K_THREAD_STACK_DEFINE(rpmsg_thread_stack, RPMSG_THREAD_STACK_SIZE);
+static struct k_thread rpmsg_thread;
+
+/* Given from the IPI callback, wakes the rpmsg thread to drain the vring */
+K_SEM_DEFINE(rpmsg_sem, 0, 1);
+
 static void rpmsg_cmd_return_cb(void *cmd_priv, void *buf)
 {
 	nvme_cmd_priv_t *priv = (nvme_cmd_priv_t*)cmd_priv;
@@ -49,16 +62,52 @@ static void rpmsg_cmd_return_data(nvme_cmd_priv_t *priv, void *ret_buf, uint32_t
 	}
 }
 
+static void rpmsg_send_blk_layout(struct rpmsg_endpoint *ept)
+{
+	nvme_rpmsg_payload_t msg = {
+		.id = RPMSG_BLK_LAYOUT,
+		.buf = nvme_blk_phys_base(),
+		.buf_len = nvme_blk_count()*BLK_SIZE,
+	};
+
+	if(rpmsg_send(ept, &msg, sizeof(msg)) != sizeof(msg))
+		LOG_ERR("Failed to send block layout!");
+}
+
+/* Messages that do not refer to a command */
+static bool rpmsg_handle_blk(struct rpmsg_endpoint *ept, nvme_rpmsg_payload_t *payload)
+{
+	switch(payload->id) {
+		case RPMSG_APU_HELLO:
+			rpmsg_send_blk_layout(ept);
+			return true;
+		case RPMSG_BLK_DONE:
+			nvme_blk_apu_done((nvme_blk_req_t*)payload->priv, (int32_t)payload->data[0]);
+			return true;
+		case RPMSG_BLK_INFO:
+			nvme_blk_apu_set_count(payload->data[0]);
+			return true;
+		default:
+			return false;
+	}
+}
+
 static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
 		u32_t src, void *priv)
 {
 	nvme_rpmsg_payload_t *payload = (nvme_rpmsg_payload_t*)data;
-	LOG_INF("id: %x, len: %u, priv: %08x", payload->id, payload->len, payload->priv);
+	LOG_DBG("id: %x, len: %u, priv: %08x", payload->id, payload->len, payload->priv);
+
+	if(rpmsg_handle_blk(ept, payload))
+		return RPMSG_SUCCESS;
 
 	nvme_cmd_priv_t *cmd = (nvme_cmd_priv_t*)payload->priv;
+	nvme_trace(NVME_TRACE_RPMSG_RX, cmd->qid, ((nvme_cq_entry_t*)cmd->cq_buf)->cid, payload->id, payload->buf_len);
 
 	switch(payload->id) {
 		case RPMSG_CMD_RETURN:
+			if(payload->len >= sizeof(uint32_t))
+				((nvme_cq_entry_t*)cmd->cq_buf)->sc = payload->data[0];
 			nvme_cmd_return(cmd);
 			if(cmd->block.data)
 				k_mem_pool_free(&cmd->block);
@@ -82,6 +131,17 @@ static void ipi_callback(void *context, u32_t cpu_id,
 		volatile void *data)
 {
 	irq_handler(cpu_id);
+	k_sem_give(&rpmsg_sem);
+}
+
+static void rpmsg_thread_entry(void *p1, void *p2, void *p3)
+{
+	nvme_tc_priv_t *tc = (nvme_tc_priv_t*)p1;
+
+	while(1) {
+		k_sem_take(&rpmsg_sem, K_FOREVER);
+		platform_poll(tc->platform);
+	}
 }
 
 int rpmsg_init(nvme_tc_priv_t *tc)
@@ -118,8 +178,18 @@ int rpmsg_init(nvme_tc_priv_t *tc)
 			       0, RPMSG_ADDR_ANY, rpmsg_endpoint_cb,
 			       rpmsg_service_unbind);
 
-	if (ret)
+	if (ret) {
 		LOG_ERR("Failed to create endpoint!");
+		return ret;
+	}
+
+	k_thread_create(&rpmsg_thread, rpmsg_thread_stack,
+			K_THREAD_STACK_SIZEOF(rpmsg_thread_stack),
+			rpmsg_thread_entry, tc, NULL, NULL,
+			RPMSG_THREAD_PRIORITY, 0, K_NO_WAIT);
+
+	/* Drain messages that arrived before the thread was started */
+	k_sem_give(&rpmsg_sem);
 
-	return ret;
+	return 0;
 }
@@ -24,8 +24,20 @@ typedef struct nvme_rpmsg_payload {
 #define RPMSG_HANDLE_CUSTOM_ADM_COMMAND	0x10
 #define RPMSG_HANDLE_CUSTOM_IO_COMMAND	0x11
 
-#define RPMSG_CMD_RETURN		0x20
+#define RPMSG_CMD_RETURN		0x20	/* NVMe status code in data[0] if len is set */
 #define RPMSG_CMD_RETURN_DATA		0x21
 
+/* Sent by the APU once its endpoint is up */
+#define RPMSG_APU_HELLO			1234
+
+/* Block tier kept by the APU, requests carry the LBA and number of blocks in data */
+#define RPMSG_BLK_READ			0x30
+#define RPMSG_BLK_WRITE			0x31
+#define RPMSG_BLK_FLUSH			0x32
+#define RPMSG_BLK_DONE			0x22	/* Status in data[0] */
+#define RPMSG_BLK_INFO			0x23	/* Number of blocks in data[0] */
+
+/* Tells the APU where accelerators find the namespace blocks, buf is 0 if they are kept by the APU */
+#define RPMSG_BLK_LAYOUT		0x33
 
 #endif
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "stats.h"
+
+#include <string.h>
+
+/* Updated from the work queues and from the DMA completion ISR, all accesses are done with interrupts locked
+ * since the 64-bit counters are not atomic on the RPU */
+static nvme_stats_t nvme_stats;
+
+/* Adds the time since the last update while IO commands are outstanding. It is called on every command start
+ * and completion, so only a single command taking longer than the cycle counter wrap period is miscounted. */
+static void busy_update(uint32_t now)
+{
+	if(nvme_stats.io_outstanding)
+		nvme_stats.busy_cycles += now - nvme_stats.busy_last;
+	nvme_stats.busy_last = now;
+}
+
+uint64_t nvme_stats_cycles_to_us(uint64_t cycles)
+{
+	const uint32_t hz = sys_clock_hw_cycles_per_sec();
+
+	// Split so that the multiplication does not overflow for long busy times
+	return (cycles / hz) * 1000000 + (cycles % hz) * 1000000 / hz;
+}
+
+static int lat_bucket(uint32_t us)
+{
+	int bucket = 0;
+
+	while(us >>= 1)
+		bucket++;
+
+	return MIN(bucket, NVME_STATS_LAT_BUCKETS - 1);
+}
+
+void nvme_stats_cmd_start(int qid)
+{
+	unsigned int key;
+
+	if(qid == ADM_QUEUE_ID)
+		return;
+
+	key = irq_lock();
+	busy_update(k_cycle_get_32());
+	nvme_stats.io_outstanding++;
+	irq_unlock(key);
+}
+
+void nvme_stats_cmd_done(int qid, int op, bool error, uint32_t bytes, uint32_t start_cycles)
+{
+	const uint32_t now = k_cycle_get_32();
+	const uint32_t lat_us = (uint32_t)nvme_stats_cycles_to_us(now - start_cycles);
+	nvme_stats_queue_t *queue = &nvme_stats.queue[qid];
+	nvme_stats_op_t *stats_op = &nvme_stats.op[op];
+	unsigned int key = irq_lock();
+
+	if(qid != ADM_QUEUE_ID) {
+		busy_update(now);
+		nvme_stats.io_outstanding--;
+	}
+
+	if(error) {
+		queue->errors++;
+	} else if(op == NVME_STATS_OP_READ) {
+		queue->read_cmds++;
+		queue->bytes_read += bytes;
+	} else if(op == NVME_STATS_OP_WRITE) {
+		queue->write_cmds++;
+		queue->bytes_written += bytes;
+	} else {
+		queue->other_cmds++;
+	}
+
+	stats_op->cmds++;
+	stats_op->lat_sum_us += lat_us;
+	stats_op->lat_max_us = MAX(stats_op->lat_max_us, lat_us);
+	stats_op->lat_hist[lat_bucket(lat_us)]++;
+
+	irq_unlock(key);
+}
+
+void nvme_stats_get(nvme_stats_t *stats)
+{
+	unsigned int key = irq_lock();
+
+	busy_update(k_cycle_get_32());
+	memcpy(stats, &nvme_stats, sizeof(*stats));
+
+	irq_unlock(key);
+}
+
+void nvme_stats_snapshot(uint8_t *buf)
+{
+	nvme_stats_hdr_t *hdr = (nvme_stats_hdr_t*)buf;
+	nvme_stats_t stats;
+
+	nvme_stats_get(&stats);
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = NVME_STATS_MAGIC;
+	hdr->version = NVME_STATS_VERSION;
+	hdr->queues = QUEUES;
+	hdr->ops = NVME_STATS_OPS;
+	hdr->lat_buckets = NVME_STATS_LAT_BUCKETS;
+	hdr->uptime_ms = k_uptime_get();
+	hdr->busy_us = nvme_stats_cycles_to_us(stats.busy_cycles);
+
+	memcpy(buf + sizeof(*hdr), stats.queue, sizeof(stats.queue));
+	memcpy(buf + sizeof(*hdr) + sizeof(stats.queue), stats.op, sizeof(stats.op));
+}
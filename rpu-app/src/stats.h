@@ -0,0 +1,85 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef NVME_STATS_H
+#define NVME_STATS_H
+
+#include <stdint.h>
+#include <zephyr.h>
+
+#include "tc.h"
+
+#define NVME_STATS_MAGIC	0x4650564e /* "NVPF" */
+#define NVME_STATS_VERSION	1
+
+/* Command classes with a latency histogram of their own */
+#define NVME_STATS_OP_READ	0
+#define NVME_STATS_OP_WRITE	1
+#define NVME_STATS_OP_FLUSH	2
+#define NVME_STATS_OP_IO_OTHER	3	/* Remaining IO commands, including vendor ones */
+#define NVME_STATS_OP_ADMIN	4
+#define NVME_STATS_OPS		5
+
+/* Bucket n counts latencies of [2^n, 2^(n+1)) microseconds, the first one also takes shorter ones
+ * and the last one everything longer */
+#define NVME_STATS_LAT_BUCKETS	24
+
+typedef struct nvme_stats_queue {
+	uint64_t read_cmds;
+	uint64_t write_cmds;
+	uint64_t other_cmds;
+	uint64_t errors;	/* Completions with a nonzero status */
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+} nvme_stats_queue_t;
+
+typedef struct nvme_stats_op {
+	uint64_t cmds;
+	uint64_t lat_sum_us;
+	uint32_t lat_max_us;
+	uint32_t rsvd;
+	uint32_t lat_hist[NVME_STATS_LAT_BUCKETS];
+} nvme_stats_op_t;
+
+/* Vendor performance log page: the header followed by nvme_stats_queue_t for each queue, admin queue first,
+ * and nvme_stats_op_t for each command class */
+typedef struct nvme_stats_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t queues;
+	uint16_t ops;
+	uint16_t lat_buckets;
+	uint32_t rsvd;
+	uint64_t uptime_ms;
+	uint64_t busy_us;	/* Time with at least one IO command outstanding */
+} nvme_stats_hdr_t;
+
+typedef struct nvme_stats {
+	nvme_stats_queue_t queue[QUEUES];
+	nvme_stats_op_t op[NVME_STATS_OPS];
+	uint64_t busy_cycles;
+	uint32_t busy_last;
+	int io_outstanding;
+} nvme_stats_t;
+
+#define NVME_STATS_LOG_SIZE	(sizeof(nvme_stats_hdr_t) + QUEUES*sizeof(nvme_stats_queue_t) + NVME_STATS_OPS*sizeof(nvme_stats_op_t))
+
+/* Called when a command is fetched from an SQ */
+void nvme_stats_cmd_start(int qid);
+
+/* Called once the completion is posted, op is one of NVME_STATS_OP_*, bytes is the amount of data read or written */
+void nvme_stats_cmd_done(int qid, int op, bool error, uint32_t bytes, uint32_t start_cycles);
+
+/* Takes a consistent copy of the counters */
+void nvme_stats_get(nvme_stats_t *stats);
+
+uint64_t nvme_stats_cycles_to_us(uint64_t cycles);
+
+/* Copies the vendor log page to buf which must hold NVME_STATS_LOG_SIZE bytes */
+void nvme_stats_snapshot(uint8_t *buf);
+
+#endif
@@ -9,10 +9,13 @@
 #include "dma.h"
 #include "cmd.h"
 #include "main.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <sys/printk.h>
 
 #include <string.h>
+#include <limits.h>
 #include <math.h>
 
 #include <logging/log.h>
@@ -22,6 +25,9 @@ static nvme_tc_priv_t p_tc = {0};
 static char __aligned(16) cmd_slab_buffer[sizeof(nvme_cmd_priv_t)*NVME_CMD_SLAB_SIZE];
 static char __aligned(16) prp_slab_buffer[NVME_PRP_LIST_SIZE*NVME_PRP_SLAB_SIZE];
 
+K_THREAD_STACK_DEFINE(adm_wq_stack, NVME_TC_ADM_WQ_STACK_SIZE);
+K_THREAD_STACK_DEFINE(io_wq_stack, NVME_TC_IO_WQ_STACK_SIZE);
+
 static void nvme_tc_cc_handler(nvme_tc_priv_t *priv)
 {
 	uint32_t cc = sys_read32(priv->base + NVME_TC_REG_CC);
@@ -39,9 +45,11 @@ static void nvme_tc_cc_handler(nvme_tc_priv_t *priv)
 		NVME_TC_SET_FIELD(csts, NVME_TC_SHUTDOWN_COMPLETE, CSTS_SHST);
 	}
 
-	if(NVME_TC_GET_FIELD(cc, CC_AMS)) {
+	priv->arb_method = NVME_TC_GET_FIELD(cc, CC_AMS);
+	if(priv->arb_method != NVME_TC_AMS_RR && priv->arb_method != NVME_TC_AMS_WRR) {
 		LOG_WRN("Unsupported arbitration method selected!");
-		LOG_WRN("We only support Round Robin (000b)");
+		LOG_WRN("We only support Round Robin (000b) and Weighted Round Robin with Urgent Priority Class (001b)");
+		priv->arb_method = NVME_TC_AMS_RR;
 	}
 
 	priv->memory_page_size = pow(2, NVME_TC_GET_FIELD(cc, CC_MPS) + 12);
@@ -60,6 +68,7 @@ static void nvme_tc_cc_handler(nvme_tc_priv_t *priv)
 		csts |= NVME_TC_REG_CSTS_RDY;
 	} else if (priv->enabled) {
 		priv->enabled = false;
+		priv->dbbuf_enabled = false;
 		LOG_DBG("Controller reset requested");
 		csts &= ~NVME_TC_REG_CSTS_RDY;
 	}
@@ -93,6 +102,54 @@ static void nvme_tc_acq_handler(nvme_tc_priv_t *priv)
 	priv->cq_valid[ADM_QUEUE_ID] = true;
 }
 
+static void nvme_tc_cmbmsc_handler(nvme_tc_priv_t *priv)
+{
+	uint32_t cmbmsc0 = sys_read32(priv->base + NVME_TC_REG_CMBMSC_0);
+	uint32_t cmbmsc1 = sys_read32(priv->base + NVME_TC_REG_CMBMSC_1);
+	uint64_t cmbmsc = ((uint64_t)cmbmsc1 << 32) | cmbmsc0;
+
+#ifdef NVME_TC_CMB_BASE
+	priv->cmb_addr = cmbmsc & NVME_TC_CMBMSC_CBA_MASK;
+	priv->cmb_enabled = (cmbmsc & NVME_TC_CMBMSC_CRE) && (cmbmsc & NVME_TC_CMBMSC_CMSE);
+#else
+	if(cmbmsc & NVME_TC_CMBMSC_CMSE)
+		LOG_WRN("Controller Memory Buffer is not supported!");
+#endif
+}
+
+/* Returns the local address of a host address range placed in the Controller Memory Buffer, 0 if it is not there */
+mem_addr_t nvme_tc_cmb_local_addr(nvme_tc_priv_t *priv, uint64_t host_addr, uint32_t len)
+{
+#ifdef NVME_TC_CMB_BASE
+	if(priv->cmb_enabled && host_addr >= priv->cmb_addr && host_addr - priv->cmb_addr + len <= NVME_TC_CMB_SIZE)
+		return (mem_addr_t)NVME_TC_CMB_BASE + (mem_addr_t)(host_addr - priv->cmb_addr);
+#endif
+	return 0;
+}
+
+/* The CMB is device memory, read it with word accesses */
+void nvme_tc_cmb_read(void *buf, mem_addr_t addr, uint32_t len)
+{
+	uint32_t *dst = (uint32_t*)buf;
+
+	for(uint32_t i = 0; i < len; i += 4)
+		*dst++ = sys_read32(addr + i);
+}
+
+static void nvme_tc_cmb_init(nvme_tc_priv_t *priv)
+{
+#ifdef NVME_TC_CMB_BASE
+	uint32_t cmbloc = (NVME_TC_CMB_BIR << NVME_TC_CMBLOC_BIR_SHIFT) | (0 << NVME_TC_CMBLOC_OFST_SHIFT);
+	uint32_t cmbsz = NVME_TC_CMBSZ_SQS | NVME_TC_CMBSZ_LISTS | (NVME_TC_CMBSZ_SZU_4K << NVME_TC_CMBSZ_SZU_SHIFT) |
+		((NVME_TC_CMB_SIZE / 4096) << NVME_TC_CMBSZ_SZ_SHIFT);
+
+	LOG_INF("Controller Memory Buffer: %d KiB", NVME_TC_CMB_SIZE / 1024);
+
+	sys_write32(cmbloc, priv->base + NVME_TC_REG_CMBLOC);
+	sys_write32(cmbsz, priv->base + NVME_TC_REG_CMBSZ);
+#endif
+}
+
 uint64_t nvme_tc_get_sq_addr(nvme_tc_priv_t *priv, const int qid)
 {
 	uint64_t addr = priv->sq_base[qid] + priv->sq_head[qid] * NVME_TC_SQ_ENTRY_SIZE;
@@ -130,31 +187,355 @@ uint64_t nvme_tc_get_cq_addr(nvme_tc_priv_t *priv, const int qid)
 	return addr;
 }
 
-static void nvme_tc_tail_handler(nvme_tc_priv_t *priv, const int qid)
+void nvme_tc_queue_work(nvme_tc_priv_t *priv, const int qid, struct k_work *work)
 {
-	uint32_t tail = sys_read32(priv->base + DOORBELL_TAIL(qid));
+	k_work_submit_to_queue((qid == ADM_QUEUE_ID) ? &priv->adm_wq : &priv->io_wq, work);
+}
 
-	priv->sq_tail[qid] = tail;
+static bool nvme_tc_sq_fetch(nvme_tc_priv_t *priv, const int qid)
+{
+	nvme_cmd_priv_t *arg;
+
+	if(k_mem_slab_alloc(&priv->cmd_slab, (void**)&arg, K_NO_WAIT) != 0) {
+		LOG_ERR("Failed to allocate memory for command!(tail: %d, head: %d)", priv->sq_tail[qid], priv->sq_head[qid]);
+		return false;
+	}
+
+	uint64_t host_addr = nvme_tc_get_sq_addr(priv, qid);
+	mem_addr_t cmb_addr = nvme_tc_cmb_local_addr(priv, host_addr, NVME_TC_SQ_ENTRY_SIZE);
+
+	nvme_trace(NVME_TRACE_CMD_FETCH, qid, 0, priv->sq_head[qid], 0);
+	memset(arg, 0, sizeof(*arg));
+	arg->qid = qid;
+	arg->tc = priv;
+	arg->start_cycles = k_cycle_get_32();
+	nvme_stats_cmd_start(qid);
 
-	while(priv->sq_tail[qid] != priv->sq_head[qid]) {
-		uint64_t host_addr = nvme_tc_get_sq_addr(priv, qid);
-		nvme_cmd_priv_t *arg;
-		if(k_mem_slab_alloc(&priv->cmd_slab, (void**)&arg, K_NO_WAIT) == 0) {
-			memset(arg, 0, sizeof(*arg));
-			arg->qid = qid;
-			arg->tc = priv;
-			nvme_dma_xfer_host_to_mem(priv->dma_priv, host_addr, (uint32_t)arg->sq_buf, NVME_TC_SQ_ENTRY_SIZE, nvme_cmd_handler, arg);
-		} else {
-			LOG_ERR("Failed to allocate memory for command!(tail: %d, head: %d)", priv->sq_tail[qid], priv->sq_head[qid]);
+	if(cmb_addr) {
+		nvme_tc_cmb_read(arg->sq_buf, cmb_addr, NVME_TC_SQ_ENTRY_SIZE);
+		nvme_cmd_dispatch(arg);
+	} else {
+		nvme_dma_xfer_host_to_mem(priv->dma_priv, host_addr, (uint32_t)arg->sq_buf, NVME_TC_SQ_ENTRY_SIZE, nvme_cmd_handler, arg);
+	}
+	return true;
+}
+
+static void nvme_tc_adm_sq_work(struct k_work *work)
+{
+	nvme_tc_priv_t *priv = CONTAINER_OF(work, nvme_tc_priv_t, adm_sq_work);
+
+	while(priv->sq_tail[ADM_QUEUE_ID] != priv->sq_head[ADM_QUEUE_ID]) {
+		if(!nvme_tc_sq_fetch(priv, ADM_QUEUE_ID))
+			break;
+	}
+}
+
+static int nvme_tc_sq_pending(nvme_tc_priv_t *priv, const int qid)
+{
+	if(!priv->sq_valid[qid] || !priv->sq_size[qid])
+		return 0;
+
+	return (priv->sq_tail[qid] + priv->sq_size[qid] - priv->sq_head[qid]) % priv->sq_size[qid];
+}
+
+/* Returns the next IO SQ with pending entries in the given priority class, in Round Robin order */
+static int nvme_tc_arb_next(nvme_tc_priv_t *priv, const int prio)
+{
+	for(int i = 0; i < IO_QUEUES; i++) {
+		const int qid = (priv->arb_next[prio] + i) % IO_QUEUES + 1;
+
+		if(priv->arb_method == NVME_TC_AMS_WRR && priv->sq_prio[qid] != prio)
+			continue;
+
+		if(nvme_tc_sq_pending(priv, qid)) {
+			priv->arb_next[prio] = qid % IO_QUEUES;
+			return qid;
+		}
+	}
+
+	return -1;
+}
+
+/* Picks the IO SQ to fetch from and the number of entries it may contribute.
+ * With Round Robin all IO SQs are in a single class. With Weighted Round Robin the Urgent class
+ * is served first, then High, Medium and Low share the rest according to their weights. */
+static int nvme_tc_arb_select(nvme_tc_priv_t *priv, int *limit)
+{
+	int qid = nvme_tc_arb_next(priv, NVME_QPRIO_URGENT);
+
+	*limit = INT_MAX;
+	if(qid >= 0 || priv->arb_method != NVME_TC_AMS_WRR)
+		return qid;
+
+	for(int pass = 0; pass < 2; pass++) {
+		for(int prio = NVME_QPRIO_HIGH; prio <= NVME_QPRIO_LOW; prio++) {
+			if(priv->arb_credit[prio] <= 0)
+				continue;
+
+			qid = nvme_tc_arb_next(priv, prio);
+			if(qid >= 0) {
+				*limit = priv->arb_credit[prio];
+				return qid;
+			}
+		}
+
+		/* All classes with pending entries ran out of credits, start a new round */
+		for(int prio = NVME_QPRIO_HIGH; prio <= NVME_QPRIO_LOW; prio++)
+			priv->arb_credit[prio] = priv->arb_weight[prio] + 1;
+	}
+
+	return -1;
+}
+
+static void nvme_tc_arb_work(struct k_work *work)
+{
+	nvme_tc_priv_t *priv = CONTAINER_OF(work, nvme_tc_priv_t, arb_work);
+
+	while(atomic_get(&priv->arb_inflight) < NVME_TC_ARB_WINDOW) {
+		int limit;
+		const int qid = nvme_tc_arb_select(priv, &limit);
+
+		if(qid < 0)
+			break;
+
+		int count = MIN(limit, nvme_tc_sq_pending(priv, qid));
+		count = MIN(count, NVME_TC_ARB_WINDOW - atomic_get(&priv->arb_inflight));
+		if(priv->arb_burst)
+			count = MIN(count, priv->arb_burst);
+
+		for(int i = 0; i < count; i++) {
+			/* Out of command buffers, retried when a command completes */
+			if(!nvme_tc_sq_fetch(priv, qid))
+				return;
+
+			atomic_inc(&priv->arb_inflight);
+			if(priv->arb_method == NVME_TC_AMS_WRR && priv->sq_prio[qid] != NVME_QPRIO_URGENT)
+				priv->arb_credit[priv->sq_prio[qid]]--;
 		}
 	}
 }
 
+/* Moves the SQ tail forward, values older than the current one are ignored.
+ * Shadow and MMIO doorbell values can be seen out of order. */
+static bool nvme_tc_sq_tail_advance(nvme_tc_priv_t *priv, const int qid, uint32_t tail)
+{
+	const uint16_t size = priv->sq_size[qid];
+
+	if(!size || tail >= size)
+		return false;
+
+	if((tail + size - priv->sq_head[qid]) % size <= (priv->sq_tail[qid] + size - priv->sq_head[qid]) % size)
+		return false;
+
+	priv->sq_tail[qid] = tail;
+	return true;
+}
+
+static bool nvme_tc_cq_head_advance(nvme_tc_priv_t *priv, const int qid, uint32_t head)
+{
+	const uint16_t size = priv->cq_size[qid];
+
+	if(!size || head >= size)
+		return false;
+
+	if((priv->cq_tail[qid] + size - head) % size >= (priv->cq_tail[qid] + size - priv->cq_head[qid]) % size)
+		return false;
+
+	priv->cq_head[qid] = head;
+	return true;
+}
+
+static void nvme_tc_sq_kick(nvme_tc_priv_t *priv, const int qid)
+{
+	nvme_trace(NVME_TRACE_DOORBELL, qid, 0, priv->sq_tail[qid], priv->sq_head[qid]);
+	nvme_tc_queue_work(priv, qid, (qid == ADM_QUEUE_ID) ? &priv->adm_sq_work : &priv->arb_work);
+}
+
+/* Shadow doorbells
+ *
+ * While IO commands are in flight the shadow doorbells are read after command completions, with at most one read in
+ * flight, and the SQ EventIdx is left behind so the host skips the MMIO doorbell writes. Once idle, the SQ EventIdx is
+ * set to the current tail and the shadow doorbells are read once more to catch updates that raced with it, from then on
+ * the next submission rings the MMIO doorbell again. The CQ head is only needed to find free CQ entries, its EventIdx
+ * is kept half a queue ahead so the host rings it about twice per pass. The transfers are chained from the DMA
+ * interrupt, the admin queue keeps using the MMIO doorbells. */
+
+static void nvme_tc_dbbuf_dma_cb(void *arg, void *buf);
+
+static void nvme_tc_dbbuf_fetch(nvme_tc_priv_t *priv)
+{
+	priv->dbbuf_state = NVME_TC_DBBUF_FETCH;
+	nvme_dma_xfer_host_to_mem(priv->dma_priv, priv->dbbuf_shadow, (uint32_t)priv->dbbuf_shadow_buf, NVME_TC_DBBUF_SIZE, nvme_tc_dbbuf_dma_cb, priv);
+}
+
+static bool nvme_tc_dbbuf_armed(nvme_tc_priv_t *priv)
+{
+	for(int qid = ADM_QUEUE_ID + 1; qid < QUEUES; qid++) {
+		if(priv->dbbuf_eventidx_buf[qid*2] != priv->sq_tail[qid])
+			return false;
+	}
+
+	return true;
+}
+
+static void nvme_tc_dbbuf_arm(nvme_tc_priv_t *priv)
+{
+	for(int qid = ADM_QUEUE_ID + 1; qid < QUEUES; qid++) {
+		priv->dbbuf_eventidx_buf[qid*2] = priv->sq_tail[qid];
+		priv->dbbuf_eventidx_buf[qid*2+1] = priv->cq_size[qid] ? (priv->cq_head[qid] + priv->cq_size[qid] / 2) % priv->cq_size[qid] : 0;
+	}
+
+	priv->dbbuf_state = NVME_TC_DBBUF_ARM;
+	nvme_dma_xfer_mem_to_host(priv->dma_priv, (uint32_t)priv->dbbuf_eventidx_buf, priv->dbbuf_eventidx, NVME_TC_DBBUF_SIZE, nvme_tc_dbbuf_dma_cb, priv);
+}
+
+static void nvme_tc_dbbuf_update(nvme_tc_priv_t *priv)
+{
+	for(int qid = ADM_QUEUE_ID + 1; qid < QUEUES; qid++) {
+		if(priv->sq_valid[qid] && nvme_tc_sq_tail_advance(priv, qid, priv->dbbuf_shadow_buf[qid*2]))
+			nvme_tc_sq_kick(priv, qid);
+		if(priv->cq_valid[qid])
+			nvme_tc_cq_head_advance(priv, qid, priv->dbbuf_shadow_buf[qid*2+1]);
+	}
+}
+
+static bool nvme_tc_io_busy(nvme_tc_priv_t *priv)
+{
+	if(atomic_get(&priv->arb_inflight))
+		return true;
+
+	for(int qid = ADM_QUEUE_ID + 1; qid < QUEUES; qid++) {
+		if(nvme_tc_sq_pending(priv, qid))
+			return true;
+	}
+
+	return false;
+}
+
+/* Called with interrupts locked and no transfer in flight */
+static void nvme_tc_dbbuf_next(nvme_tc_priv_t *priv)
+{
+	priv->dbbuf_state = NVME_TC_DBBUF_IDLE;
+
+	if(!priv->dbbuf_enabled)
+		return;
+
+	if(!nvme_tc_io_busy(priv) && !nvme_tc_dbbuf_armed(priv)) {
+		priv->dbbuf_kick = false; // Covered by the read following the EventIdx update
+		nvme_tc_dbbuf_arm(priv);
+	} else if(priv->dbbuf_kick) {
+		priv->dbbuf_kick = false;
+		nvme_tc_dbbuf_fetch(priv);
+	}
+}
+
+static void nvme_tc_dbbuf_dma_cb(void *arg, void *buf)
+{
+	nvme_tc_priv_t *priv = (nvme_tc_priv_t*)arg;
+	unsigned int key = irq_lock();
+
+	if(priv->dbbuf_state == NVME_TC_DBBUF_ARM && priv->dbbuf_enabled)
+		nvme_tc_dbbuf_fetch(priv);
+	else {
+		if(priv->dbbuf_state == NVME_TC_DBBUF_FETCH && priv->dbbuf_enabled)
+			nvme_tc_dbbuf_update(priv);
+		nvme_tc_dbbuf_next(priv);
+	}
+
+	irq_unlock(key);
+}
+
+static void nvme_tc_dbbuf_kick(nvme_tc_priv_t *priv)
+{
+	unsigned int key;
+
+	if(!priv->dbbuf_enabled)
+		return;
+
+	key = irq_lock();
+	priv->dbbuf_kick = true;
+	if(priv->dbbuf_state == NVME_TC_DBBUF_IDLE)
+		nvme_tc_dbbuf_next(priv);
+	irq_unlock(key);
+}
+
+void nvme_tc_dbbuf_enable(nvme_tc_priv_t *priv, uint64_t shadow, uint64_t eventidx)
+{
+	priv->dbbuf_shadow = shadow;
+	priv->dbbuf_eventidx = eventidx;
+	// Forces the first EventIdx write
+	memset(priv->dbbuf_eventidx_buf, 0xff, sizeof(priv->dbbuf_eventidx_buf));
+	priv->dbbuf_enabled = true;
+
+	nvme_tc_dbbuf_kick(priv);
+}
+
+void nvme_tc_cmd_done(nvme_tc_priv_t *priv, const int qid)
+{
+	if(qid == ADM_QUEUE_ID)
+		return;
+
+	atomic_dec(&priv->arb_inflight);
+	nvme_tc_queue_work(priv, qid, &priv->arb_work);
+	nvme_tc_dbbuf_kick(priv);
+}
+
+void nvme_tc_arb_reset(nvme_tc_priv_t *priv)
+{
+	for(int prio = 0; prio < NVME_QPRIO_LEVELS; prio++) {
+		priv->arb_credit[prio] = priv->arb_weight[prio] + 1;
+		priv->arb_next[prio] = 0;
+	}
+}
+
+static void nvme_tc_ctrl_work(struct k_work *work)
+{
+	nvme_tc_priv_t *priv = CONTAINER_OF(work, nvme_tc_priv_t, ctrl_work);
+	atomic_val_t pending = atomic_clear(&priv->ctrl_pending);
+
+	/* Handlers read the current register values, so coalesced writes are handled once.
+	 * Queue configuration is applied before CC as the host sets it up before enabling the controller. */
+	if(pending & NVME_TC_CTRL_AQA) {
+		LOG_DBG("Handling NVME_TC_REG_AQA");
+		nvme_tc_aqa_handler(priv);
+	}
+	if(pending & NVME_TC_CTRL_ASQ) {
+		LOG_DBG("Handling NVME_TC_REG_ASQ_1");
+		nvme_tc_asq_handler(priv);
+	}
+	if(pending & NVME_TC_CTRL_ACQ) {
+		LOG_DBG("Handling NVME_TC_REG_ACQ_1");
+		nvme_tc_acq_handler(priv);
+	}
+	if(pending & NVME_TC_CTRL_CMBMSC) {
+		LOG_DBG("Handling NVME_TC_REG_CMBMSC");
+		nvme_tc_cmbmsc_handler(priv);
+	}
+	if(pending & NVME_TC_CTRL_CC) {
+		LOG_DBG("Handling NVME_TC_REG_CC");
+		nvme_tc_cc_handler(priv);
+	}
+}
+
+static void nvme_tc_ctrl_queue(nvme_tc_priv_t *priv, atomic_val_t reg)
+{
+	atomic_or(&priv->ctrl_pending, reg);
+	nvme_tc_queue_work(priv, ADM_QUEUE_ID, &priv->ctrl_work);
+}
+
+static void nvme_tc_tail_handler(nvme_tc_priv_t *priv, const int qid)
+{
+	uint32_t tail = sys_read32(priv->base + DOORBELL_TAIL(qid));
+
+	if(nvme_tc_sq_tail_advance(priv, qid, tail))
+		nvme_tc_sq_kick(priv, qid);
+}
+
 static void nvme_tc_head_handler(nvme_tc_priv_t *priv, const int qid)
 {
 	uint32_t head = sys_read32(priv->base + DOORBELL_HEAD(qid));
 
-	priv->cq_head[qid] = head;
+	nvme_tc_cq_head_advance(priv, qid, head);
 }
 
 static void nvme_tc_irq_handler(void *arg)
@@ -169,46 +550,41 @@ static void nvme_tc_irq_handler(void *arg)
 
 		switch(reg) {
 			case NVME_TC_REG_CC:
-				LOG_DBG("Handling NVME_TC_REG_CC");
-				nvme_tc_cc_handler(priv);
+				nvme_tc_ctrl_queue(priv, NVME_TC_CTRL_CC);
 				break;
 			case NVME_TC_REG_AQA:
-				LOG_DBG("Handling NVME_TC_REG_AQA");
-				nvme_tc_aqa_handler(priv);
+				nvme_tc_ctrl_queue(priv, NVME_TC_CTRL_AQA);
 				break;
 			case NVME_TC_REG_ASQ_0:
-				LOG_DBG("Handling NVME_TC_REG_ASQ_0");
 				/* This will be handled in ASQ_1 handler */
 				break;
 			case NVME_TC_REG_ASQ_1:
-				LOG_DBG("Handling NVME_TC_REG_ASQ_1");
-				nvme_tc_asq_handler(priv);
+				nvme_tc_ctrl_queue(priv, NVME_TC_CTRL_ASQ);
 				break;
 			case NVME_TC_REG_ACQ_0:
-				LOG_DBG("Handling NVME_TC_REG_ACQ_0");
 				/* This will be handled in ACQ_1 handler */
 				break;
 			case NVME_TC_REG_ACQ_1:
-				LOG_DBG("Handling NVME_TC_REG_ACQ_1");
-				nvme_tc_acq_handler(priv);
+				nvme_tc_ctrl_queue(priv, NVME_TC_CTRL_ACQ);
+				break;
+			case NVME_TC_REG_CMBMSC_0:
+			case NVME_TC_REG_CMBMSC_1:
+				/* Host may write either half, the handler reads both */
+				nvme_tc_ctrl_queue(priv, NVME_TC_CTRL_CMBMSC);
 				break;
 			case NVME_TC_REG_ADM_TAIL:
-				LOG_DBG("Handling NVME_TC_REG_ADM_TAIL");
 				nvme_tc_tail_handler(priv, ADM_QUEUE_ID);
 				break;
 			case NVME_TC_REG_ADM_HEAD:
-				LOG_DBG("Handling NVME_TC_REG_ADM_HEAD");
 				nvme_tc_head_handler(priv, ADM_QUEUE_ID);
 				break;
 			default:
-				for(int i = 0; i < QUEUES; i++) {
+				for(int i = 0; i < IO_QUEUES; i++) {
 					if(reg == NVME_TC_REG_IO_TAIL(i)) {
-						LOG_DBG("Handling NVME_TC_REG_IO_TAIL");
 						nvme_tc_tail_handler(priv, i + 1);
 						io_queue_handled = true;
 						break;
 					} else if(reg == NVME_TC_REG_IO_HEAD(i)) {
-						LOG_DBG("Handling NVME_TC_REG_IO_HEAD");
 						nvme_tc_head_handler(priv, i + 1);
 						io_queue_handled = true;
 						break;
@@ -238,9 +614,22 @@ nvme_tc_priv_t *nvme_tc_init(void *dma_priv)
 
 	k_mem_slab_init(&priv->prp_slab, prp_slab_buffer, NVME_PRP_LIST_SIZE, NVME_PRP_SLAB_SIZE);
 
+	k_work_init(&priv->ctrl_work, nvme_tc_ctrl_work);
+	k_work_init(&priv->adm_sq_work, nvme_tc_adm_sq_work);
+	k_work_init(&priv->arb_work, nvme_tc_arb_work);
+
+	/* Arbitration feature defaults: burst of one command, all weights 0 */
+	priv->arb_burst = 1;
+	nvme_tc_arb_reset(priv);
+
+	k_work_q_start(&priv->adm_wq, adm_wq_stack, K_THREAD_STACK_SIZEOF(adm_wq_stack), NVME_TC_ADM_WQ_PRIORITY);
+	k_work_q_start(&priv->io_wq, io_wq_stack, K_THREAD_STACK_SIZEOF(io_wq_stack), NVME_TC_IO_WQ_PRIORITY);
+
 	LOG_INF("Clearing registers");
 	for(int i = 0; i < NVME_TC_REG_IRQ_STA; i+=4)
 		sys_write32(0, priv->base + i);
 
+	nvme_tc_cmb_init(priv);
+
 	return priv;
 }
@@ -11,13 +11,14 @@
 #include "nvme_reg_map.h"
 #include "nvme_reg_fields.h"
 #include "dma.h"
+#include "blk.h"
 
 #include <stdint.h>
 #include <zephyr.h>
 
 #include <openamp/open_amp.h>
 
-#define IO_QUEUES		1
+#define IO_QUEUES		4
 
 #define QUEUES	((IO_QUEUES)+1)
 
@@ -27,8 +28,8 @@
 
 #define DOORBELL_REG(n)		(DOORBELL_BASE+(n)*4)
 
-#define DOORBELL_TAIL(n)	(DOORBELL_REG((n*2)))
-#define DOORBELL_HEAD(n)	(DOORBELL_REG((n*2)+1))
+#define DOORBELL_TAIL(n)	(DOORBELL_REG((n)*2))
+#define DOORBELL_HEAD(n)	(DOORBELL_REG((n)*2+1))
 
 #define ADM_QUEUE_ID		0
 #define ADM_QUEUE_IV		0
@@ -36,14 +37,41 @@
 #define NVME_TC_REG_ADM_TAIL	(DOORBELL_TAIL(ADM_QUEUE_ID))
 #define NVME_TC_REG_ADM_HEAD	(DOORBELL_HEAD(ADM_QUEUE_ID))
 
-#define NVME_TC_REG_IO_TAIL(n)	(DOORBELL_TAIL(n+1))
-#define NVME_TC_REG_IO_HEAD(n)	(DOORBELL_HEAD(n+1))
+#define NVME_TC_REG_IO_TAIL(n)	(DOORBELL_TAIL((n)+1))
+#define NVME_TC_REG_IO_HEAD(n)	(DOORBELL_HEAD((n)+1))
 
 #define NVME_TC_REG_IRQ_STA	(DOORBELL_TAIL(DOORBELLS))
 #define NVME_TC_REG_IRQ_DAT	(DOORBELL_HEAD(DOORBELLS))
 
 #define NVME_TC_REG_IRQ_HOST	(NVME_TC_REG_IRQ_DAT+4)
 
+/* Controller Memory Buffer registers, not all NVMe spec revisions used for the register map define them */
+#ifndef NVME_TC_REG_CMBLOC
+#define NVME_TC_REG_CMBLOC	0x38
+#endif
+#ifndef NVME_TC_REG_CMBSZ
+#define NVME_TC_REG_CMBSZ	0x3c
+#endif
+#ifndef NVME_TC_REG_CMBMSC_0
+#define NVME_TC_REG_CMBMSC_0	0x50
+#endif
+#ifndef NVME_TC_REG_CMBMSC_1
+#define NVME_TC_REG_CMBMSC_1	0x54
+#endif
+
+#define NVME_TC_CMBLOC_BIR_SHIFT	0
+#define NVME_TC_CMBLOC_OFST_SHIFT	12
+
+#define NVME_TC_CMBSZ_SQS		(1<<0)
+#define NVME_TC_CMBSZ_LISTS		(1<<2)
+#define NVME_TC_CMBSZ_SZU_SHIFT		8
+#define NVME_TC_CMBSZ_SZU_4K		0x0
+#define NVME_TC_CMBSZ_SZ_SHIFT		12
+
+#define NVME_TC_CMBMSC_CRE		(1<<0)
+#define NVME_TC_CMBMSC_CMSE		(1<<1)
+#define NVME_TC_CMBMSC_CBA_MASK		(~0xfffULL)
+
 #define NVME_TC_GET_FIELD(reg,name)	(((reg) >> NVME_TC_REG_##name##_SHIFT) & NVME_TC_REG_##name##_MASK)
 
 #define NVME_TC_SET_FIELD(reg, val, name)	(reg) |= (((val) & NVME_TC_REG_##name##_MASK) << NVME_TC_REG_##name##_SHIFT)
@@ -68,6 +96,52 @@
 #define NVME_BUFFER_SIZE		(4096*1024)
 #define PAGE_SIZE			4096
 
+/* Commands are processed by cooperative work queue threads, the ISRs only acknowledge and queue events.
+ * The admin queue is served ahead of IO queues, the rpmsg thread is above both. */
+#define NVME_TC_ADM_WQ_STACK_SIZE	4096
+#define NVME_TC_ADM_WQ_PRIORITY		K_PRIO_COOP(2)
+#define NVME_TC_IO_WQ_STACK_SIZE	4096
+#define NVME_TC_IO_WQ_PRIORITY		K_PRIO_COOP(3)
+
+/* Controller register writes pending processing, see nvme_tc_ctrl_work */
+#define NVME_TC_CTRL_AQA	(1<<0)
+#define NVME_TC_CTRL_ASQ	(1<<1)
+#define NVME_TC_CTRL_ACQ	(1<<2)
+#define NVME_TC_CTRL_CC		(1<<3)
+#define NVME_TC_CTRL_CMBMSC	(1<<4)
+
+/* Controller Memory Buffer, device memory the PL exposes to the host in BAR NVME_TC_CMB_BIR.
+ * Hosts may place SQs and PRP lists in it, which are then read locally instead of over PCIe.
+ * It is advertised only if the nvme_cmb node is enabled, which is looked up by its address since
+ * instance numbers skip disabled nodes. */
+#ifdef DT_MMIO_SRAM_A0100000_BASE_ADDRESS
+#define NVME_TC_CMB_BASE	DT_MMIO_SRAM_A0100000_BASE_ADDRESS
+#define NVME_TC_CMB_SIZE	DT_MMIO_SRAM_A0100000_SIZE
+#endif
+#define NVME_TC_CMB_BIR		2
+
+/* Shadow doorbell and EventIdx buffers (Doorbell Buffer Config) mirror the doorbell registers with a 4 byte stride */
+#define NVME_TC_DBBUF_SIZE	(QUEUES*2*4)
+
+#define NVME_TC_DBBUF_IDLE	0
+#define NVME_TC_DBBUF_FETCH	1	// Shadow doorbell read in flight
+#define NVME_TC_DBBUF_ARM	2	// EventIdx write in flight
+
+/* Arbitration mechanisms (CC.AMS) */
+#define NVME_TC_AMS_RR		0x0
+#define NVME_TC_AMS_WRR		0x1
+
+/* Submission queue priority classes (Create I/O SQ QPRIO) */
+#define NVME_QPRIO_URGENT	0
+#define NVME_QPRIO_HIGH		1
+#define NVME_QPRIO_MEDIUM	2
+#define NVME_QPRIO_LOW		3
+#define NVME_QPRIO_LEVELS	4
+
+/* Maximum number of IO commands fetched but not completed yet.
+ * Arbitration only decides what gets fetched, so further commands wait in their SQs until a slot is freed. */
+#define NVME_TC_ARB_WINDOW	32
+
 void nvme_tc_irq_init(void);
 
 typedef struct nvme_tc_priv {
@@ -86,6 +160,41 @@ typedef struct nvme_tc_priv {
 
 	struct k_mem_pool *buffer_pool;
 
+	/* Deferred processing */
+
+	struct k_work_q adm_wq;
+	struct k_work_q io_wq;
+
+	struct k_work ctrl_work;
+	atomic_t ctrl_pending;
+
+	struct k_work adm_sq_work;
+	struct k_work arb_work;
+
+	/* Arbitration */
+
+	int arb_method;
+	int arb_burst;				// Entries fetched from one SQ in a row, 0 for no limit
+	int arb_weight[NVME_QPRIO_LEVELS];	// 0's based values
+	int arb_credit[NVME_QPRIO_LEVELS];
+	int arb_next[NVME_QPRIO_LEVELS];	// Round Robin position within each priority class
+	atomic_t arb_inflight;			// IO commands fetched but not completed
+
+	/* Controller Memory Buffer, host address set through CMBMSC */
+
+	bool cmb_enabled;
+	uint64_t cmb_addr;
+
+	/* Shadow doorbells */
+
+	bool dbbuf_enabled;
+	int dbbuf_state;
+	uint64_t dbbuf_shadow;
+	uint64_t dbbuf_eventidx;
+	bool dbbuf_kick;			// Commands completed since the last shadow doorbell read started
+	uint32_t dbbuf_shadow_buf[QUEUES*2];
+	uint32_t dbbuf_eventidx_buf[QUEUES*2];
+
 	/* Queue parameters */
 
 	int memory_page_size;
@@ -102,6 +211,7 @@ typedef struct nvme_tc_priv {
 	uint16_t sq_tail[QUEUES];
 	uint16_t sq_head[QUEUES];
 	bool sq_pc[QUEUES];
+	uint8_t sq_prio[QUEUES];
 
 	/* Completion Queues */
 
@@ -122,12 +232,19 @@ typedef struct nvme_tc_priv {
 typedef struct nvme_cmd_priv {
 	int qid;
 	nvme_tc_priv_t *tc;
+	uint32_t start_cycles;		// Fetch time, for latency statistics
 	int dir;
 	int prp_size;
 	uint32_t xfer_base, xfer_size;
 	uint32_t xfer_buf, xfer_len;
 	nvme_dma_xfer_cb *xfer_cb;
+	atomic_t xfer_pending;
+	uint16_t xfer_status;		// Set if the transfer failed, xfer_cb then only releases its buffers
+	struct k_work work;
+	nvme_dma_xfer_cb *work_cb;
+	void *work_buf;
 	struct k_mem_block block;
+	nvme_blk_req_t blk;
 	uint32_t sq_buf[NVME_TC_SQ_ENTRY_SIZE/4];
 	uint32_t cq_buf[NVME_TC_CQ_ENTRY_SIZE/4];
 } nvme_cmd_priv_t;
@@ -138,4 +255,16 @@ uint64_t nvme_tc_get_cq_addr(nvme_tc_priv_t *priv, const int qid);
 
 void nvme_tc_cq_notify(nvme_tc_priv_t *priv, const int qid);
 
+void nvme_tc_queue_work(nvme_tc_priv_t *priv, const int qid, struct k_work *work);
+
+mem_addr_t nvme_tc_cmb_local_addr(nvme_tc_priv_t *priv, uint64_t host_addr, uint32_t len);
+
+void nvme_tc_cmb_read(void *buf, mem_addr_t addr, uint32_t len);
+
+void nvme_tc_dbbuf_enable(nvme_tc_priv_t *priv, uint64_t shadow, uint64_t eventidx);
+
+void nvme_tc_cmd_done(nvme_tc_priv_t *priv, const int qid);
+
+void nvme_tc_arb_reset(nvme_tc_priv_t *priv);
+
 #endif
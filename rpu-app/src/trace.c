@@ -0,0 +1,34 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "trace.h"
+
+#include <string.h>
+
+nvme_trace_rec_t nvme_trace_ring[NVME_TRACE_ENTRIES];
+atomic_t nvme_trace_head = ATOMIC_INIT(0);
+
+void nvme_trace_snapshot(uint8_t *buf)
+{
+	nvme_trace_hdr_t *hdr = (nvme_trace_hdr_t*)buf;
+	nvme_trace_rec_t *recs = (nvme_trace_rec_t*)(buf + sizeof(*hdr));
+	const uint32_t head = (uint32_t)atomic_get(&nvme_trace_head);
+	const uint32_t first = head & (NVME_TRACE_ENTRIES - 1);
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = NVME_TRACE_MAGIC;
+	hdr->version = NVME_TRACE_VERSION;
+	hdr->rec_size = sizeof(nvme_trace_rec_t);
+	hdr->entries = NVME_TRACE_ENTRIES;
+	hdr->head = head;
+	hdr->cycles_per_sec = sys_clock_hw_cycles_per_sec();
+
+	/* Records written while copying may show up torn or out of order, the decoder
+	 * relies on timestamps rather than on the ring being quiescent */
+	memcpy(recs, &nvme_trace_ring[first], (NVME_TRACE_ENTRIES - first)*sizeof(nvme_trace_rec_t));
+	memcpy(recs + (NVME_TRACE_ENTRIES - first), nvme_trace_ring, first*sizeof(nvme_trace_rec_t));
+}
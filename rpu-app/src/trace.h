@@ -0,0 +1,71 @@
+/*
+ * Copyright 2021-2022 Western Digital Corporation or its affiliates
+ * Copyright 2021-2022 Antmicro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef NVME_TRACE_H
+#define NVME_TRACE_H
+
+#include <stdint.h>
+#include <zephyr.h>
+
+/* Number of records kept in the trace ring, must be a power of two */
+#define NVME_TRACE_ENTRIES	2048
+
+#define NVME_TRACE_MAGIC	0x5254564e /* "NVTR" */
+#define NVME_TRACE_VERSION	1
+
+#define NVME_TRACE_DOORBELL	0x01 /* arg0: tail, arg1: head */
+#define NVME_TRACE_CMD_FETCH	0x02 /* arg0: SQ head */
+#define NVME_TRACE_CMD_START	0x03 /* arg0: opcode, arg1: nsid */
+#define NVME_TRACE_XFER_START	0x04 /* arg0: length, arg1: direction */
+#define NVME_TRACE_XFER_DONE	0x05 /* arg0: length */
+#define NVME_TRACE_RPMSG_TX	0x06 /* arg0: payload id, arg1: buffer length */
+#define NVME_TRACE_RPMSG_RX	0x07 /* arg0: payload id, arg1: buffer length */
+#define NVME_TRACE_CMD_DONE	0x08 /* arg0: status code, arg1: status code type */
+#define NVME_TRACE_CQ_NOTIFY	0x09 /* arg0: interrupt vector */
+
+typedef struct nvme_trace_rec {
+	uint32_t ts;		/* k_cycle_get_32() */
+	uint8_t event;
+	uint8_t qid;
+	uint16_t cid;
+	uint32_t arg0;
+	uint32_t arg1;
+} nvme_trace_rec_t;
+
+typedef struct nvme_trace_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint32_t entries;	/* Ring capacity */
+	uint32_t head;		/* Number of records written since boot, the oldest valid one is at head - entries */
+	uint32_t cycles_per_sec;
+	uint32_t rsvd[3];
+} nvme_trace_hdr_t;
+
+#define NVME_TRACE_LOG_SIZE	(sizeof(nvme_trace_hdr_t) + NVME_TRACE_ENTRIES*sizeof(nvme_trace_rec_t))
+
+extern nvme_trace_rec_t nvme_trace_ring[NVME_TRACE_ENTRIES];
+extern atomic_t nvme_trace_head;
+
+/* Safe to call from any context, a slot is claimed with a single atomic increment */
+static inline void nvme_trace(uint8_t event, uint8_t qid, uint16_t cid, uint32_t arg0, uint32_t arg1)
+{
+	uint32_t idx = (uint32_t)atomic_inc(&nvme_trace_head) & (NVME_TRACE_ENTRIES - 1);
+	nvme_trace_rec_t *rec = &nvme_trace_ring[idx];
+
+	rec->ts = k_cycle_get_32();
+	rec->event = event;
+	rec->qid = qid;
+	rec->cid = cid;
+	rec->arg0 = arg0;
+	rec->arg1 = arg1;
+}
+
+/* Copies the header and the ring, oldest record first, to buf which must hold NVME_TRACE_LOG_SIZE bytes */
+void nvme_trace_snapshot(uint8_t *buf);
+
+#endif
@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+# Copyright 2021-2022 Western Digital Corporation or its affiliates
+# Copyright 2021-2022 Antmicro
+#
+# SPDX-License-Identifier: Apache-2.0
+
+# Decodes the RPU performance log page (LID 0xC2), e.g. dumped with:
+#   nvme get-log /dev/nvme0 --log-id=0xc2 --log-len=872 --raw-binary > perf.bin
+
+import struct
+import argparse
+
+HDR_FMT = '<IHHHH4xQQ'
+QUEUE_FMT = '<6Q'
+OP_FMT = '<QQI4x'
+MAGIC = 0x4650564e
+
+OPS = ['read', 'write', 'flush', 'io other', 'admin']
+
+parser = argparse.ArgumentParser(description='Decode RPU performance log page')
+parser.add_argument('log', help='raw log page dump')
+args = parser.parse_args()
+
+with open(args.log, 'rb') as f:
+    data = f.read()
+
+magic, version, queues, ops, buckets, uptime_ms, busy_us = struct.unpack_from(HDR_FMT, data)
+if magic != MAGIC:
+    raise SystemExit(f'Invalid performance log magic: {magic:#x}')
+
+off = struct.calcsize(HDR_FMT)
+print(f'uptime {uptime_ms / 1e3:.1f} s, busy {busy_us / 1e6:.1f} s ({busy_us / 10 / max(uptime_ms, 1):.1f}%)')
+
+for qid in range(queues):
+    reads, writes, other, errors, bytes_read, bytes_written = struct.unpack_from(QUEUE_FMT, data, off)
+    off += struct.calcsize(QUEUE_FMT)
+    print(f'q{qid}: reads {reads} ({bytes_read} B), writes {writes} ({bytes_written} B), other {other}, errors {errors}')
+
+for op in range(ops):
+    cmds, lat_sum, lat_max = struct.unpack_from(OP_FMT, data, off)
+    off += struct.calcsize(OP_FMT)
+    hist = struct.unpack_from(f'<{buckets}I', data, off)
+    off += 4 * buckets
+    if not cmds:
+        continue
+    name = OPS[op] if op < len(OPS) else f'op {op}'
+    print(f'{name}: {cmds} cmds, latency avg {lat_sum / cmds:.1f} us, max {lat_max} us')
+    for b, count in enumerate(hist):
+        if count:
+            print(f'  {1 << b:>8d} us  {count}')
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+# Copyright 2021-2022 Western Digital Corporation or its affiliates
+# Copyright 2021-2022 Antmicro
+#
+# SPDX-License-Identifier: Apache-2.0
+
+# Decodes the RPU trace log page (LID 0xC1), e.g. dumped with:
+#   nvme get-log /dev/nvme0 --log-id=0xc1 --log-len=32800 --raw-binary > trace.bin
+
+import struct
+import argparse
+
+HDR_FMT = '<IHHIII12x'
+REC_FMT = '<IBBHII'
+MAGIC = 0x5254564e
+
+EVENTS = {
+    0x01: ('DOORBELL', 'tail', 'head'),
+    0x02: ('CMD_FETCH', 'sq_head', None),
+    0x03: ('CMD_START', 'opc', 'nsid'),
+    0x04: ('XFER_START', 'len', 'dir'),
+    0x05: ('XFER_DONE', 'len', None),
+    0x06: ('RPMSG_TX', 'id', 'buf_len'),
+    0x07: ('RPMSG_RX', 'id', 'buf_len'),
+    0x08: ('CMD_DONE', 'sc', 'sct'),
+    0x09: ('CQ_NOTIFY', 'iv', None),
+}
+
+parser = argparse.ArgumentParser(description='Decode RPU trace log page')
+parser.add_argument('log', help='raw log page dump')
+args = parser.parse_args()
+
+with open(args.log, 'rb') as f:
+    data = f.read()
+
+magic, version, rec_size, entries, head, hz = struct.unpack_from(HDR_FMT, data)
+if magic != MAGIC:
+    raise SystemExit(f'Invalid trace magic: {magic:#x}')
+
+hdr_size = struct.calcsize(HDR_FMT)
+valid = min(head, entries)
+# Records are stored oldest first, the valid ones are at the end if the ring never wrapped
+recs = [
+    struct.unpack_from(REC_FMT, data, hdr_size + i * rec_size)
+    for i in range(entries - valid, entries)
+    if hdr_size + (i + 1) * rec_size <= len(data)
+]
+
+prev = recs[0][0] if recs else 0
+elapsed = 0
+for ts, event, qid, cid, arg0, arg1 in recs:
+    elapsed += (ts - prev) & 0xffffffff
+    prev = ts
+    name, a0, a1 = EVENTS.get(event, (f'EVENT_{event:#x}', 'arg0', 'arg1'))
+    fields = f'{a0}={arg0:#x}' + (f' {a1}={arg1:#x}' if a1 else '')
+    print(f'{elapsed * 1e6 / hz:12.2f} us  q{qid} cid {cid:5d}  {name:10s} {fields}')